@@ -0,0 +1,402 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <span>
+
+// レベルデータやアトラスなどのファイルを 1 つにまとめたアセットパック
+// 起動時に 1 回ファイルを開いてメモリマップし、パスの整列済みの索引を二分探索して中身を引く
+// 圧縮していない中身はマップしたメモリをそのまま指し（コピーしない）、圧縮した中身は読むときに展開する
+// 起動時に unpack() で圧縮した項目を並列に展開しておけば、以後は展開済みの中身を返す
+// 同じパスの個別のファイルがあれば、読み込む側はそちらを優先する（HasLooseFile()）
+//
+// ファイルの形式:
+//   "NPAK" (4 バイト), バージョン (uint32), 項目数 (uint32)
+//   項目ごとに 位置 (uint64, データ領域の先頭から), 格納した大きさ (uint32), 元の大きさ (uint32),
+//     フラグ (uint8), パスの長さ (uint16), パス (UTF-8, '/' 区切り)。パスの順に並べる
+//   データ領域
+class AssetPack
+{
+public:
+
+	static constexpr uint32 Version = 1;
+
+	// 項目のフラグ
+	enum Flag : uint8
+	{
+		// zstd で圧縮している
+		Compressed = (1 << 0),
+	};
+
+	struct Entry
+	{
+		String path;
+
+		uint64 offset = 0;
+
+		uint32 storedSize = 0;
+
+		uint32 size = 0;
+
+		uint8 flags = 0;
+	};
+
+	// path のアセットパックを開く
+	bool open(const FilePath& path)
+	{
+		close();
+
+		if (not m_file.open(path))
+		{
+			return false;
+		}
+
+		m_mapped = m_file.map();
+
+		if ((not m_mapped.data) || (not parseIndex()))
+		{
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void close()
+	{
+		m_entries.clear();
+		m_unpacked.clear();
+		m_dataBegin = 0;
+		m_mapped = {};
+		m_file.unmap();
+		m_file.close();
+	}
+
+	[[nodiscard]]
+	bool isOpen() const noexcept
+	{
+		return (not m_entries.isEmpty());
+	}
+
+	[[nodiscard]]
+	size_t size() const noexcept
+	{
+		return m_entries.size();
+	}
+
+	[[nodiscard]]
+	bool contains(StringView path) const
+	{
+		return (find(path) != nullptr);
+	}
+
+	// 中身を、コピーせずに指す（圧縮していて展開済みでない・見つからなければ none）
+	[[nodiscard]]
+	Optional<std::span<const Byte>> view(StringView path) const
+	{
+		const Entry* entry = find(path);
+
+		if (not entry)
+		{
+			return none;
+		}
+
+		if (entry->flags & Compressed)
+		{
+			if (const auto& unpacked = m_unpacked[indexOf(*entry)])
+			{
+				return std::span<const Byte>{ unpacked->data(), unpacked->size() };
+			}
+
+			return none;
+		}
+
+		return stored(*entry);
+	}
+
+	// 中身を読む（圧縮していれば展開する）。別のスレッドから呼んでもよい
+	[[nodiscard]]
+	Optional<Blob> read(StringView path) const
+	{
+		if (const Entry* entry = find(path))
+		{
+			return read(*entry);
+		}
+
+		return none;
+	}
+
+	// 圧縮した項目の番号（entries() の番号）
+	[[nodiscard]]
+	Array<size_t> compressedEntries() const
+	{
+		Array<size_t> indices;
+
+		for (size_t i = 0; i < m_entries.size(); ++i)
+		{
+			if (m_entries[i].flags & Compressed)
+			{
+				indices << i;
+			}
+		}
+
+		return indices;
+	}
+
+	// 圧縮した項目 index を展開しておく。番号が違えば別々のスレッドから同時に呼んでよいが、
+	// 展開している項目を view() や read() で読むのは、展開が終わってからにすること
+	void unpack(size_t index)
+	{
+		const Entry& entry = m_entries[index];
+
+		if ((entry.flags & Compressed) && (not m_unpacked[index]))
+		{
+			const std::span<const Byte> data = stored(entry);
+			m_unpacked[index] = Compression::Decompress(data.data(), data.size());
+		}
+	}
+
+	[[nodiscard]]
+	const Array<Entry>& entries() const noexcept
+	{
+		return m_entries;
+	}
+
+	// directories の中のすべてのファイルを 1 つのアセットパックにまとめる
+	// 圧縮して 1 割以上小さくなるものだけを圧縮して格納する
+	static bool Build(const Array<FilePath>& directories, const FilePath& outputPath)
+	{
+		struct Item
+		{
+			Entry entry;
+			Blob data;
+		};
+
+		Array<Item> items;
+
+		for (const auto& directory : directories)
+		{
+			for (const auto& path : FileSystem::DirectoryContents(directory, Recursive::Yes))
+			{
+				if (not FileSystem::IsFile(path))
+				{
+					continue;
+				}
+
+				Blob raw{ path };
+				Item item;
+				item.entry.path = NormalizePath(FileSystem::RelativePath(path));
+				item.entry.size = static_cast<uint32>(raw.size());
+
+				if (Blob compressed = Compression::Compress(raw); (compressed.size() * 10) < (raw.size() * 9))
+				{
+					item.entry.flags = Compressed;
+					item.data = std::move(compressed);
+				}
+				else
+				{
+					item.data = std::move(raw);
+				}
+
+				item.entry.storedSize = static_cast<uint32>(item.data.size());
+				items << std::move(item);
+			}
+		}
+
+		items.sort_by([](const Item& a, const Item& b) { return (a.entry.path < b.entry.path); });
+
+		uint64 offset = 0;
+
+		for (auto& item : items)
+		{
+			item.entry.offset = offset;
+			offset += item.entry.storedSize;
+		}
+
+		BinaryWriter writer{ outputPath };
+
+		if (not writer)
+		{
+			Console << U"assets: failed to open {}"_fmt(outputPath);
+			return false;
+		}
+
+		writer.write("NPAK", 4);
+		writer.write(Version);
+		writer.write(static_cast<uint32>(items.size()));
+
+		for (const auto& item : items)
+		{
+			const std::string path = item.entry.path.toUTF8();
+			writer.write(item.entry.offset);
+			writer.write(item.entry.storedSize);
+			writer.write(item.entry.size);
+			writer.write(item.entry.flags);
+			writer.write(static_cast<uint16>(path.size()));
+			writer.write(path.data(), path.size());
+		}
+
+		for (const auto& item : items)
+		{
+			writer.write(item.data.data(), item.data.size());
+		}
+
+		Console << U"assets: {} files, {} bytes -> {}"_fmt(items.size(), offset, outputPath);
+		return true;
+	}
+
+	// 索引のキーの形にする（区切りを '/' にそろえる）
+	[[nodiscard]]
+	static String NormalizePath(StringView path)
+	{
+		String result{ path };
+		result.replace(U'\\', U'/');
+		return result;
+	}
+
+private:
+
+	MemoryMappedFileView m_file;
+	MemoryMappedFileView::MappedMemory m_mapped;
+	Array<Entry> m_entries;
+
+	// 展開済みの中身（m_entries と同じ順、展開していなければ none）
+	Array<Optional<Blob>> m_unpacked;
+
+	size_t m_dataBegin = 0;
+
+	bool parseIndex()
+	{
+		MemoryViewReader reader{ m_mapped.data, m_mapped.size };
+
+		char magic[4];
+		uint32 version = 0, count = 0;
+
+		if ((not reader.read(magic, 4)) || (std::memcmp(magic, "NPAK", 4) != 0)
+			|| (not reader.read(version)) || (version != Version)
+			|| (not reader.read(count)))
+		{
+			return false;
+		}
+
+		Array<Entry> entries(count);
+
+		for (auto& entry : entries)
+		{
+			uint16 length = 0;
+
+			if ((not reader.read(entry.offset)) || (not reader.read(entry.storedSize)) || (not reader.read(entry.size))
+				|| (not reader.read(entry.flags)) || (not reader.read(length)))
+			{
+				return false;
+			}
+
+			std::string path(length, '\0');
+
+			if (not reader.read(path.data(), length))
+			{
+				return false;
+			}
+
+			entry.path = Unicode::FromUTF8(path);
+		}
+
+		const size_t dataBegin = static_cast<size_t>(reader.getPos());
+
+		for (const auto& entry : entries)
+		{
+			if (m_mapped.size < (dataBegin + entry.offset + entry.storedSize))
+			{
+				return false;
+			}
+		}
+
+		m_entries = std::move(entries);
+		m_unpacked.resize(m_entries.size());
+		m_dataBegin = dataBegin;
+		return true;
+	}
+
+	[[nodiscard]]
+	const Entry* find(StringView path) const
+	{
+		const String key = NormalizePath(path);
+		const auto it = std::lower_bound(m_entries.begin(), m_entries.end(), key,
+			[](const Entry& entry, const String& key) { return (entry.path < key); });
+
+		if ((it == m_entries.end()) || (it->path != key))
+		{
+			return nullptr;
+		}
+
+		return &(*it);
+	}
+
+	[[nodiscard]]
+	size_t indexOf(const Entry& entry) const noexcept
+	{
+		return static_cast<size_t>(&entry - m_entries.data());
+	}
+
+	[[nodiscard]]
+	std::span<const Byte> stored(const Entry& entry) const
+	{
+		return std::span<const Byte>{ (m_mapped.data + m_dataBegin + entry.offset), entry.storedSize };
+	}
+
+	[[nodiscard]]
+	Blob read(const Entry& entry) const
+	{
+		const std::span<const Byte> data = stored(entry);
+
+		if (entry.flags & Compressed)
+		{
+			if (const auto& unpacked = m_unpacked[indexOf(entry)])
+			{
+				return *unpacked;
+			}
+
+			return Compression::Decompress(data.data(), data.size());
+		}
+
+		return Blob{ data.data(), data.size() };
+	}
+};
+
+// ゲーム全体で使うアセットパック（開いていなければ、各所は個別のファイルから読む）
+[[nodiscard]]
+inline AssetPack& GameAssets()
+{
+	static AssetPack pack;
+	return pack;
+}
+
+// 個別のファイルとアセットパックのどちらから読むか
+// 個別のファイルがあればそちらを優先する。開発中はファイルを編集すればホットリロードでそのまま反映され、
+// 一度 --pack-assets を実行した後でも古いアセットパックの中身を読むことはない
+// 配布するときは level, atlas, lang のフォルダを置かず、アセットパックだけを置く
+[[nodiscard]]
+inline bool HasLooseFile(const FilePath& path)
+{
+	return FileSystem::IsFile(path);
+}
+
+// JSON を読み込む（個別のファイルがあればそこから、なければアセットパックから）
+[[nodiscard]]
+inline JSON LoadJSON(const FilePath& path)
+{
+	if (HasLooseFile(path))
+	{
+		return JSON::Load(path);
+	}
+
+	if (const auto view = GameAssets().view(path))
+	{
+		return JSON::Parse(Unicode::FromUTF8(std::string_view{ reinterpret_cast<const char*>(view->data()), view->size() }));
+	}
+
+	if (const auto data = GameAssets().read(path))
+	{
+		return JSON::Parse(Unicode::FromUTF8(std::string_view{ reinterpret_cast<const char*>(data->data()), data->size() }));
+	}
+
+	return JSON::Load(path);
+}
@@ -0,0 +1,425 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "Telemetry.hpp"
+
+// 1 回の挑戦の記録（ファイルにもこの形のまま書き出す）
+struct AttemptRecord
+{
+	// 挑戦が終わった時刻（UNIX 時間 [ミリ秒]）
+	int64 timestamp = 0;
+
+	// ステージ（State の値）
+	uint8 stage = 0;
+
+	// 結果（TelemetryOutcome の値）
+	uint8 outcome = 0;
+
+	// ワールドに置いた設置物の数
+	uint16 placements = 0;
+
+	// 挑戦時間 [秒]
+	float time = 0.0f;
+};
+
+static_assert(sizeof(AttemptRecord) == 16);
+
+// ステージごとの集計（ファイルにもこの形のまま書き出す）
+struct AttemptAggregate
+{
+	uint32 attempts = 0;
+
+	uint32 clears = 0;
+
+	uint32 failures = 0;
+
+	uint32 abandons = 0;
+
+	// 最も速いクリアの時間 [秒]（クリアしていなければ 0）
+	double bestTime = 0.0;
+
+	double totalTime = 0.0;
+
+	uint64 placements = 0;
+
+	void add(const AttemptRecord& record) noexcept
+	{
+		++attempts;
+		totalTime += record.time;
+		placements += record.placements;
+
+		switch (static_cast<TelemetryOutcome>(record.outcome))
+		{
+		case TelemetryOutcome::Cleared:
+			++clears;
+			bestTime = ((bestTime == 0.0) ? record.time : Min(bestTime, static_cast<double>(record.time)));
+			break;
+		case TelemetryOutcome::Failed:
+			++failures;
+			break;
+		default:
+			++abandons;
+			break;
+		}
+	}
+};
+
+static_assert(sizeof(AttemptAggregate) == 40);
+
+// ステージごとの挑戦の統計
+//
+// 挑戦が終わるたびに 16 バイトの記録を、追記だけのログ（セグメント）に書き足し、メモリ上の集計にも足し込む
+// 集計は記録 1 件ごとに一定の手間で更新するので、タイトル画面は履歴を読み直さずに合計を表示できる
+//
+// directory/
+// ├── summary.bin          … 集計と、集計に畳み込み済みの最後のセグメントの番号
+// └── attempts_<番号>.log   … セグメント。SegmentRecords 件で閉じて次の番号に移る
+//
+// 閉じたセグメントは別のスレッドで summary.bin に畳み込んで消す（コンパクション）
+// 起動時に読むのは summary.bin と、まだ畳み込んでいない少数のセグメントだけなので、何年分の記録があっても速い
+class AttemptStats
+{
+public:
+
+	static constexpr uint32 Version = 1;
+
+	// 記録できるステージの数
+	static constexpr size_t MaxStages = 16;
+
+	// 1 つのセグメントの記録数
+	static constexpr uint32 SegmentRecords = 4096;
+
+	AttemptStats() = default;
+
+	~AttemptStats()
+	{
+		close();
+	}
+
+	AttemptStats(const AttemptStats&) = delete;
+	AttemptStats& operator =(const AttemptStats&) = delete;
+
+	// directory の記録を読み込み、追記を始める
+	bool open(const FilePath& directory)
+	{
+		close();
+
+		m_directory = directory;
+		m_stages = {};
+		m_total = {};
+
+		uint32 folded = 0;
+		bool hasSummary = false;
+
+		if (const auto summary = LoadSummary(summaryPath()))
+		{
+			folded = summary->lastSegment;
+			m_stages = summary->stages;
+			hasSummary = true;
+		}
+
+		for (const auto& stage : m_stages)
+		{
+			Merge(m_total, stage);
+		}
+
+		// まだ畳み込んでいないセグメントを足し込む
+		Array<uint32> segments = ListSegments(directory);
+		segments.remove_if([&](uint32 index) { return (hasSummary && (index <= folded)); });
+		segments.sort();
+
+		for (const uint32 index : segments)
+		{
+			ReadSegment(segmentPath(index), [this](const AttemptRecord& record) { fold(record); });
+		}
+
+		m_segment = (segments ? segments.back() : (hasSummary ? (folded + 1) : 0));
+		m_segmentRecords = 0;
+
+		if (segments)
+		{
+			// 埋まっている、または末尾に半端な記録が残っているセグメントには追記しない
+			const int64 bytes = (FileSystem::FileSize(segmentPath(m_segment)) - HeaderSize);
+
+			if ((bytes < 0) || ((bytes % sizeof(AttemptRecord)) != 0) || (SegmentRecords <= (bytes / sizeof(AttemptRecord))))
+			{
+				++m_segment;
+			}
+			else
+			{
+				m_segmentRecords = static_cast<uint32>(bytes / sizeof(AttemptRecord));
+			}
+		}
+
+		if (not openSegment())
+		{
+			return false;
+		}
+
+		// 前回までに閉じたセグメントが残っていれば畳み込む
+		if (segments && (segments.front() < m_segment))
+		{
+			compact();
+		}
+
+		return true;
+	}
+
+	void close()
+	{
+		if (m_compaction.isValid())
+		{
+			m_compaction.wait();
+		}
+
+		m_writer.close();
+	}
+
+	// 挑戦の結果を記録する
+	void record(uint8 stage, TelemetryOutcome outcome, double time, size_t placements)
+	{
+		if ((not m_writer) || (MaxStages <= stage))
+		{
+			return;
+		}
+
+		const AttemptRecord record{ static_cast<int64>(Time::GetMillisecSinceEpoch()), stage, static_cast<uint8>(outcome),
+			static_cast<uint16>(Min<size_t>(placements, UINT16_MAX)), static_cast<float>(time) };
+
+		m_writer.write(record);
+		m_writer.flush();
+		fold(record);
+
+		// セグメントが埋まったら次に移り、閉じたものを畳み込む
+		if (SegmentRecords <= ++m_segmentRecords)
+		{
+			++m_segment;
+			m_segmentRecords = 0;
+			openSegment();
+			compact();
+		}
+	}
+
+	// ステージごとの集計
+	[[nodiscard]]
+	const AttemptAggregate& stage(uint8 stage) const noexcept
+	{
+		return m_stages[Min<size_t>(stage, (MaxStages - 1))];
+	}
+
+	// 全ステージの合計（bestTime は使わない）
+	[[nodiscard]]
+	const AttemptAggregate& total() const noexcept
+	{
+		return m_total;
+	}
+
+private:
+
+	struct Summary
+	{
+		uint32 lastSegment = 0;
+
+		std::array<AttemptAggregate, MaxStages> stages{};
+	};
+
+	// セグメントの先頭の "NSTA" とバージョン
+	static constexpr int64 HeaderSize = 8;
+
+	FilePath m_directory;
+	std::array<AttemptAggregate, MaxStages> m_stages{};
+	AttemptAggregate m_total;
+
+	BinaryWriter m_writer;
+	uint32 m_segment = 0;
+	uint32 m_segmentRecords = 0;
+
+	AsyncTask<void> m_compaction;
+
+	[[nodiscard]]
+	FilePath summaryPath() const
+	{
+		return FileSystem::PathAppend(m_directory, U"summary.bin");
+	}
+
+	[[nodiscard]]
+	FilePath segmentPath(uint32 index) const
+	{
+		return FileSystem::PathAppend(m_directory, U"attempts_{:0>8}.log"_fmt(index));
+	}
+
+	void fold(const AttemptRecord& record)
+	{
+		if (record.stage < MaxStages)
+		{
+			m_stages[record.stage].add(record);
+			m_total.add(record);
+		}
+	}
+
+	bool openSegment()
+	{
+		const FilePath path = segmentPath(m_segment);
+		const bool exists = FileSystem::Exists(path);
+
+		if (not m_writer.open(path, OpenMode::Append))
+		{
+			return false;
+		}
+
+		if (not exists)
+		{
+			m_writer.write("NSTA", 4);
+			m_writer.write(Version);
+			m_writer.flush();
+		}
+
+		return true;
+	}
+
+	// 今のセグメントより前のセグメントを、別のスレッドで summary.bin に畳み込んで消す
+	void compact()
+	{
+		// 前回のコンパクションが終わっていなければ、次に閉じたときにまとめて行う
+		if (m_compaction.isValid() && (not m_compaction.isReady()))
+		{
+			return;
+		}
+
+		if (m_compaction.isValid())
+		{
+			m_compaction.get();
+		}
+
+		m_compaction = Async([directory = m_directory, summaryFile = summaryPath(), current = m_segment]()
+		{
+			const Optional<Summary> loaded = LoadSummary(summaryFile);
+			const bool hasSummary = loaded.has_value();
+			Summary summary = loaded.value_or(Summary{});
+			Array<uint32> closed = ListSegments(directory);
+			closed.remove_if([&](uint32 index) { return ((current <= index) || (hasSummary && (index <= summary.lastSegment))); });
+			closed.sort();
+
+			if (not closed)
+			{
+				return;
+			}
+
+			for (const uint32 index : closed)
+			{
+				ReadSegment(FileSystem::PathAppend(directory, U"attempts_{:0>8}.log"_fmt(index)),
+					[&](const AttemptRecord& record)
+					{
+						if (record.stage < MaxStages)
+						{
+							summary.stages[record.stage].add(record);
+						}
+					});
+			}
+
+			summary.lastSegment = closed.back();
+
+			// 書き終えてから差し替えるので、途中で止まっても前の summary.bin が残る
+			const FilePath temporary = (summaryFile + U".tmp");
+			{
+				BinaryWriter writer{ temporary };
+
+				if (not writer)
+				{
+					return;
+				}
+
+				writer.write("NSTS", 4);
+				writer.write(Version);
+				writer.write(summary.lastSegment);
+				writer.write(static_cast<uint32>(MaxStages));
+				writer.write(summary.stages.data(), (sizeof(AttemptAggregate) * MaxStages));
+			}
+
+			FileSystem::Rename(temporary, summaryFile);
+
+			for (const uint32 index : closed)
+			{
+				FileSystem::Remove(FileSystem::PathAppend(directory, U"attempts_{:0>8}.log"_fmt(index)));
+			}
+		});
+	}
+
+	[[nodiscard]]
+	static Optional<Summary> LoadSummary(const FilePath& path)
+	{
+		BinaryReader reader{ path };
+
+		if (not reader)
+		{
+			return none;
+		}
+
+		char magic[4];
+		uint32 version = 0, stageCount = 0;
+		Summary summary;
+
+		if ((not reader.read(magic, 4)) || (std::memcmp(magic, "NSTS", 4) != 0)
+			|| (not reader.read(version)) || (version != Version)
+			|| (not reader.read(summary.lastSegment)) || (not reader.read(stageCount)) || (stageCount != MaxStages)
+			|| (not reader.read(summary.stages.data(), (sizeof(AttemptAggregate) * MaxStages))))
+		{
+			return none;
+		}
+
+		return summary;
+	}
+
+	// directory にあるセグメントの番号
+	[[nodiscard]]
+	static Array<uint32> ListSegments(const FilePath& directory)
+	{
+		Array<uint32> indices;
+
+		for (const auto& path : FileSystem::DirectoryContents(directory, Recursive::No))
+		{
+			const String name = FileSystem::BaseName(path);
+
+			if ((FileSystem::Extension(path) == U"log") && name.starts_with(U"attempts_"))
+			{
+				if (const auto index = ParseOpt<uint32>(name.substr(9)))
+				{
+					indices << *index;
+				}
+			}
+		}
+
+		return indices;
+	}
+
+	// セグメントの記録を順に f に渡す（書き込み途中で止まった末尾の半端な記録は読まない）
+	template <class Function>
+	static void ReadSegment(const FilePath& path, Function f)
+	{
+		BinaryReader reader{ path };
+		char magic[4];
+		uint32 version = 0;
+
+		if ((not reader) || (not reader.read(magic, 4)) || (std::memcmp(magic, "NSTA", 4) != 0)
+			|| (not reader.read(version)) || (version != Version))
+		{
+			return;
+		}
+
+		AttemptRecord record;
+
+		while (reader.read(record))
+		{
+			f(record);
+		}
+	}
+
+	static void Merge(AttemptAggregate& to, const AttemptAggregate& from) noexcept
+	{
+		to.attempts += from.attempts;
+		to.clears += from.clears;
+		to.failures += from.failures;
+		to.abandons += from.abandons;
+		to.totalTime += from.totalTime;
+		to.placements += from.placements;
+	}
+};
@@ -0,0 +1,237 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// ベンチマーク用のビルド（Visual Studio と Xcode の Benchmark 構成）では GAME_BENCHMARK を 1 に定義する
+// ・GPU のない環境でも動くよう、描画をヘッドレス（何も描かない）にする
+// ・メモリ確保の回数を数える（operator new を置き換える）
+# ifndef GAME_BENCHMARK
+#	define GAME_BENCHMARK 0
+# endif
+
+// 1 フレームの処理の区分
+enum class FramePhase : uint8
+{
+	// System::Update()（画面の表示とイベント処理）
+	Present,
+
+	// シーンの更新と描画（以下の区分を含む）
+	Scene,
+
+	// 物理演算
+	Physics,
+
+	// ワールドの描画
+	WorldDraw,
+
+	Count,
+};
+
+// 区分ごとの CPU 時間を積算する
+class FrameProfiler
+{
+public:
+
+	// スコープを抜けるまでの時間を区分に加える
+	class ScopedPhase
+	{
+	public:
+
+		ScopedPhase(FrameProfiler& profiler, FramePhase phase)
+			: m_profiler{ profiler }
+			, m_phase{ phase }
+			, m_start{ Clock::now() } {}
+
+		~ScopedPhase()
+		{
+			m_profiler.add(m_phase, std::chrono::duration<double>(Clock::now() - m_start).count());
+		}
+
+		ScopedPhase(const ScopedPhase&) = delete;
+		ScopedPhase& operator =(const ScopedPhase&) = delete;
+
+	private:
+
+		FrameProfiler& m_profiler;
+		FramePhase m_phase;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	[[nodiscard]]
+	ScopedPhase scoped(FramePhase phase)
+	{
+		return ScopedPhase{ *this, phase };
+	}
+
+	void add(FramePhase phase, double seconds) noexcept
+	{
+		auto& total = m_totals[FromEnum(phase)];
+		total.sum += seconds;
+		total.current += seconds;
+	}
+
+	// フレームの終わりに呼ぶ
+	void endFrame() noexcept
+	{
+		for (auto& total : m_totals)
+		{
+			total.max = Max(total.max, total.current);
+			total.current = 0.0;
+		}
+
+		++m_frames;
+	}
+
+	void reset() noexcept
+	{
+		m_totals.fill(Total{});
+		m_frames = 0;
+	}
+
+	// 1 フレームあたりの平均 [ミリ秒]
+	[[nodiscard]]
+	double averageMs(FramePhase phase) const noexcept
+	{
+		return (m_frames ? (m_totals[FromEnum(phase)].sum * 1000.0 / m_frames) : 0.0);
+	}
+
+	// 最も時間のかかったフレーム [ミリ秒]
+	[[nodiscard]]
+	double maxMs(FramePhase phase) const noexcept
+	{
+		return (m_totals[FromEnum(phase)].max * 1000.0);
+	}
+
+	[[nodiscard]]
+	size_t frames() const noexcept
+	{
+		return m_frames;
+	}
+
+private:
+
+	using Clock = std::chrono::steady_clock;
+
+	struct Total
+	{
+		double sum = 0.0;
+		double max = 0.0;
+		double current = 0.0;
+	};
+
+	std::array<Total, FromEnum(FramePhase::Count)> m_totals{};
+	size_t m_frames = 0;
+};
+
+// メモリ確保の回数（GAME_BENCHMARK のビルドでのみ数える）
+// スレッドごとに数え、Get() は呼んだスレッドの回数を返す
+// ベンチマークはメインスレッドから呼ぶため、オーディオやストリーミングなどほかのスレッドの確保は含まれない
+struct AllocationCounter
+{
+	static constexpr bool Enabled = (GAME_BENCHMARK != 0);
+
+	static inline thread_local uint64 count = 0;
+
+	static void Add() noexcept
+	{
+		++count;
+	}
+
+	[[nodiscard]]
+	static uint64 Get() noexcept
+	{
+		return count;
+	}
+};
+
+// シーンごとの予算（bench/budget.toml）
+//
+// [Stage1]
+// sceneMs = 4.0            # 1 フレームのシーンの更新と描画の平均 [ミリ秒]
+// physicsMs = 1.0          # 1 フレームの物理演算の平均 [ミリ秒]
+// allocationsPerFrame = 64 # 1 フレームあたりのメモリ確保回数
+// stateChangesPerFrame = 16 # 1 フレームの描画の状態（シェーダとテクスチャ）の切り替え回数
+struct BenchmarkBudget
+{
+	Optional<double> sceneMs;
+
+	Optional<double> physicsMs;
+
+	Optional<double> allocationsPerFrame;
+
+	Optional<double> stateChangesPerFrame;
+
+	[[nodiscard]]
+	static HashTable<String, BenchmarkBudget> Load(const FilePath& path)
+	{
+		HashTable<String, BenchmarkBudget> budgets;
+		const TOMLReader toml{ path };
+
+		if (not toml)
+		{
+			return budgets;
+		}
+
+		for (const auto& table : toml.tableView())
+		{
+			BenchmarkBudget budget;
+			budget.sceneMs = table.value[U"sceneMs"].getOpt<double>();
+			budget.physicsMs = table.value[U"physicsMs"].getOpt<double>();
+			budget.allocationsPerFrame = table.value[U"allocationsPerFrame"].getOpt<double>();
+			budget.stateChangesPerFrame = table.value[U"stateChangesPerFrame"].getOpt<double>();
+			budgets.emplace(table.name, budget);
+		}
+
+		return budgets;
+	}
+};
+
+// 1 シーン分のベンチマーク結果
+struct BenchmarkResult
+{
+	String name;
+
+	size_t frames = 0;
+
+	double sceneMs = 0.0;
+
+	double sceneMaxMs = 0.0;
+
+	double physicsMs = 0.0;
+
+	double worldDrawMs = 0.0;
+
+	double presentMs = 0.0;
+
+	// 1 フレームの描画の状態の切り替え回数
+	double stateChangesPerFrame = 0.0;
+
+	// 1 フレームあたりのメモリ確保回数（数えていなければ none）
+	Optional<double> allocationsPerFrame;
+
+	// 予算を超えた項目
+	Array<String> failures;
+
+	// 予算と比べて failures を埋める
+	void check(const BenchmarkBudget& budget)
+	{
+		if (budget.sceneMs && (sceneMs > *budget.sceneMs))
+		{
+			failures << U"sceneMs {:.3f} > {:.3f}"_fmt(sceneMs, *budget.sceneMs);
+		}
+
+		if (budget.physicsMs && (physicsMs > *budget.physicsMs))
+		{
+			failures << U"physicsMs {:.3f} > {:.3f}"_fmt(physicsMs, *budget.physicsMs);
+		}
+
+		if (budget.allocationsPerFrame && allocationsPerFrame && (*allocationsPerFrame > *budget.allocationsPerFrame))
+		{
+			failures << U"allocationsPerFrame {:.1f} > {:.1f}"_fmt(*allocationsPerFrame, *budget.allocationsPerFrame);
+		}
+
+		if (budget.stateChangesPerFrame && (stateChangesPerFrame > *budget.stateChangesPerFrame))
+		{
+			failures << U"stateChangesPerFrame {:.1f} > {:.1f}"_fmt(stateChangesPerFrame, *budget.stateChangesPerFrame);
+		}
+	}
+};
@@ -0,0 +1,214 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// 地面（線・折れ線・四角形）までの符号付き距離を格子に記録したもの
+// チャンクごとに、チャンクを読み込むときに 1 回だけ作る（ChunkData::field）
+// 格子は地面を囲む範囲に距離の上限の分の余白を加えた範囲だけを覆い、その外は MaxDistance とみなす
+// 地面全体までの距離は、近くのチャンクの距離の最小値になる（ChunkedWorld::groundDistance()）
+// 四角形の内側は負の距離、線や折れ線は向きを持たないので常に正の距離になる
+class DistanceField
+{
+public:
+
+	// 格子 1 マスの大きさ（ワールド座標）
+	static constexpr double CellSize = 8.0;
+
+	// 記録する距離の上限。地面からこれ以上離れた所は、すべてこの値になる
+	static constexpr double MaxDistance = 256.0;
+
+	DistanceField() = default;
+
+	// 1 チャンク分の地面から作る（別スレッドから呼んでもよい）
+	[[nodiscard]]
+	static DistanceField Build(const Array<Line>& lines, const Array<LineString>& lineStrings, const Array<RectF>& rects)
+	{
+		Array<Line> segments = lines;
+		Array<RectF> solids = rects;
+
+		for (const auto& lineString : lineStrings)
+		{
+			for (size_t i = 1; i < lineString.size(); ++i)
+			{
+				segments << Line{ lineString[i - 1], lineString[i] };
+			}
+		}
+
+		for (const auto& rect : rects)
+		{
+			segments << rect.top() << rect.right() << rect.bottom() << rect.left();
+		}
+
+		DistanceField field;
+
+		if (segments.isEmpty())
+		{
+			return field;
+		}
+
+		// 地面全体を囲む範囲に、距離の上限の分の余白を加える
+		RectF bounds = BoundsOf(segments.front());
+
+		for (const auto& segment : segments)
+		{
+			bounds = MergeBounds(bounds, BoundsOf(segment));
+		}
+
+		field.m_origin = (bounds.pos - Vec2::All(MaxDistance));
+		field.m_distances = Grid<float>(static_cast<size_t>(Ceil((bounds.w + MaxDistance * 2) / CellSize)) + 1,
+			static_cast<size_t>(Ceil((bounds.h + MaxDistance * 2) / CellSize)) + 1, static_cast<float>(MaxDistance));
+
+		// 線分ごとに、距離の上限までの範囲のマスだけを更新する
+		for (const auto& segment : segments)
+		{
+			const Rect cells = field.cellsIn(BoundsOf(segment).stretched(MaxDistance));
+
+			for (int32 y = cells.y; y < cells.bottomY(); ++y)
+			{
+				for (int32 x = cells.x; x < cells.rightX(); ++x)
+				{
+					float& distance = field.m_distances[y][x];
+					distance = Min(distance, static_cast<float>(segment.distanceFrom(field.cellCenter(x, y))));
+				}
+			}
+		}
+
+		// 四角形の内側のマスは負の距離にする
+		for (const auto& solid : solids)
+		{
+			const Rect cells = field.cellsIn(solid);
+
+			for (int32 y = cells.y; y < cells.bottomY(); ++y)
+			{
+				for (int32 x = cells.x; x < cells.rightX(); ++x)
+				{
+					if (solid.contains(field.cellCenter(x, y)))
+					{
+						float& distance = field.m_distances[y][x];
+						distance = -Abs(distance);
+					}
+				}
+			}
+		}
+
+		return field;
+	}
+
+	// pos に最も近いマスの符号付き距離（地面がなければ MaxDistance）
+	[[nodiscard]]
+	double distance(const Vec2& pos) const
+	{
+		const Vec2 cell = ((pos - m_origin) / CellSize);
+		const int64 x = static_cast<int64>(Floor(cell.x));
+		const int64 y = static_cast<int64>(Floor(cell.y));
+
+		if ((x < 0) || (y < 0) || (static_cast<int64>(m_distances.width()) <= x) || (static_cast<int64>(m_distances.height()) <= y))
+		{
+			return MaxDistance;
+		}
+
+		return m_distances[static_cast<size_t>(y)][static_cast<size_t>(x)];
+	}
+
+	// 格子が覆う範囲（ワールド座標、格子がなければ空）
+	[[nodiscard]]
+	RectF region() const noexcept
+	{
+		return RectF{ m_origin, (SizeF{ static_cast<double>(m_distances.width()), static_cast<double>(m_distances.height()) } * CellSize) };
+	}
+
+	// 円が地面に重ならないか（1 回の参照）
+	// distance(pos) は地面までの符号付き距離を返す関数
+	// マスの中心で測った距離なので、マスの対角線の半分だけ余裕を持って判定する
+	template <class Distance>
+	[[nodiscard]]
+	static bool IsFree(const Circle& circle, Distance distance)
+	{
+		return ((circle.r + CellMargin) <= distance(circle.center));
+	}
+
+	// 四角形が地面に重ならないか
+	// 四角形を 2x2 以上の正方形に近い区画に分け、区画を囲む円ごとに判定する
+	template <class Distance>
+	[[nodiscard]]
+	static bool IsFree(const RectF& rect, Distance distance)
+	{
+		const double side = (Min(rect.w, rect.h) / 2.0);
+
+		if (side <= 0.0)
+		{
+			return IsFree(Circle{ rect.center(), (rect.size.length() / 2.0) }, distance);
+		}
+
+		const int32 columns = Max(2, static_cast<int32>(Ceil(rect.w / side)));
+		const int32 rows = Max(2, static_cast<int32>(Ceil(rect.h / side)));
+		const Vec2 partSize{ (rect.w / columns), (rect.h / rows) };
+		const double radius = (partSize.length() / 2.0);
+
+		for (int32 y = 0; y < rows; ++y)
+		{
+			for (int32 x = 0; x < columns; ++x)
+			{
+				if (not IsFree(Circle{ (rect.pos + partSize * Vec2{ (x + 0.5), (y + 0.5) }), radius }, distance))
+				{
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	[[nodiscard]]
+	bool isEmpty() const noexcept
+	{
+		return m_distances.isEmpty();
+	}
+
+	[[nodiscard]]
+	size_t memoryUsage() const noexcept
+	{
+		return (m_distances.size() * sizeof(float));
+	}
+
+private:
+
+	// マスの中心から、マスの中のもっとも遠い点までの距離
+	static constexpr double CellMargin = (CellSize * 0.7072);
+
+	Vec2 m_origin{ 0, 0 };
+
+	Grid<float> m_distances;
+
+	[[nodiscard]]
+	static RectF BoundsOf(const Line& line)
+	{
+		const Vec2 tl{ Min(line.begin.x, line.end.x), Min(line.begin.y, line.end.y) };
+		const Vec2 br{ Max(line.begin.x, line.end.x), Max(line.begin.y, line.end.y) };
+		return RectF{ tl, (br - tl) };
+	}
+
+	[[nodiscard]]
+	static RectF MergeBounds(const RectF& a, const RectF& b)
+	{
+		const Vec2 tl{ Min(a.x, b.x), Min(a.y, b.y) };
+		const Vec2 br{ Max(a.br().x, b.br().x), Max(a.br().y, b.br().y) };
+		return RectF{ tl, (br - tl) };
+	}
+
+	[[nodiscard]]
+	Vec2 cellCenter(int32 x, int32 y) const
+	{
+		return (m_origin + Vec2{ (x + 0.5), (y + 0.5) } * CellSize);
+	}
+
+	// region に中心が入りうるマスの範囲（格子の外は含めない）
+	[[nodiscard]]
+	Rect cellsIn(const RectF& region) const
+	{
+		const int32 left = Max(0, static_cast<int32>(Floor((region.x - m_origin.x) / CellSize)));
+		const int32 top = Max(0, static_cast<int32>(Floor((region.y - m_origin.y) / CellSize)));
+		const int32 right = Min(static_cast<int32>(m_distances.width()), static_cast<int32>(Ceil((region.br().x - m_origin.x) / CellSize)) + 1);
+		const int32 bottom = Min(static_cast<int32>(m_distances.height()), static_cast<int32>(Ceil((region.br().y - m_origin.y) / CellSize)) + 1);
+		return Rect{ left, top, Max(0, (right - left)), Max(0, (bottom - top)) };
+	}
+};
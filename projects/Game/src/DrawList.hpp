@@ -0,0 +1,421 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <variant>
+
+// 描画の層（数の小さい層から描く）
+// 同じ層の中は、描く状態（シェーダとテクスチャ）の順に並べ替えるので、重なり順を決めたいものは層を分ける
+enum class DrawLayer : uint8
+{
+	// 背景（設置物の置き場、ワールドの地面）
+	Background,
+
+	// UI の部品（ボタン、本文、スクロールバー）、ワールドのゴールと軌跡
+	Content,
+
+	// 設置物、ワールドの針
+	Objects,
+
+	// ワールド（UI の DrawList から、ワールドを描くパスを呼ぶ）
+	World,
+
+	// 最前面（結果、案内、押せないボタンの覆い）、ワールドのエフェクト
+	Overlay,
+
+	Count,
+};
+
+// 描画の統計
+struct DrawStats
+{
+	// 記録した描画の数
+	size_t commands = 0;
+
+	// 描く状態（シェーダとテクスチャ）を切り替えた回数。おおよそのドローコールの数になる
+	size_t stateChanges = 0;
+
+	// 記録した順に描いていた場合の切り替えの回数
+	size_t unsortedStateChanges = 0;
+
+	DrawStats& operator +=(const DrawStats& other) noexcept
+	{
+		commands += other.commands;
+		stateChanges += other.stateChanges;
+		unsortedStateChanges += other.unsortedStateChanges;
+		return *this;
+	}
+};
+
+// 描画を記録しておき、まとめて描く
+//
+// シーンは図形や文字を描く代わりに層を指定して記録し、最後に flush() で 1 回だけ描く
+// flush() は層 → シェーダ → テクスチャの順に並べ替え、同じ状態の描画を続けて描く
+// 同じ状態の描画が続いている間は Siv3D の側で 1 回のドローコールにまとまるので、
+// 文字と図形が入り混じる画面でも、切り替えの回数は層と状態の組み合わせの数で済む
+// 同じ層・同じ状態の描画どうしは、記録した順に描く
+//
+// 座標変換やレンダーターゲットは flush() を呼んだ時点のものが使われる
+// 別の変換で描くもの（ワールドなど）は、別の DrawList に記録し、pass() の中で flush() する
+class DrawList
+{
+public:
+
+	DrawList() = default;
+
+	DrawList(const DrawList&) = delete;
+	DrawList& operator =(const DrawList&) = delete;
+
+	void rect(DrawLayer layer, const RectF& rect, const ColorF& color = Palette::White)
+	{
+		addShape(layer, Kind::Fill, rect, color);
+	}
+
+	void rectFrame(DrawLayer layer, const RectF& rect, double thickness, const ColorF& color = Palette::White)
+	{
+		addShape(layer, Kind::Frame, rect, color).size = thickness;
+	}
+
+	void roundRect(DrawLayer layer, const RoundRect& roundRect, const ColorF& color = Palette::White)
+	{
+		addShape(layer, Kind::Fill, roundRect, color);
+	}
+
+	void roundRectFrame(DrawLayer layer, const RoundRect& roundRect, double thickness, const ColorF& color = Palette::White)
+	{
+		addShape(layer, Kind::Frame, roundRect, color).size = thickness;
+	}
+
+	void roundRectShadow(DrawLayer layer, const RoundRect& roundRect, const Vec2& offset, double blurRadius, double spread = 0.0, const ColorF& color = ColorF{ 0.0, 0.5 })
+	{
+		Command& command = addShape(layer, Kind::Shadow, roundRect, color);
+		command.pos = offset;
+		command.size = blurRadius;
+		command.spread = spread;
+	}
+
+	void circle(DrawLayer layer, const Circle& circle, const ColorF& color = Palette::White)
+	{
+		addShape(layer, Kind::Fill, circle, color);
+	}
+
+	void circleFrame(DrawLayer layer, const Circle& circle, double thickness, const ColorF& color = Palette::White)
+	{
+		addShape(layer, Kind::Frame, circle, color).size = thickness;
+	}
+
+	// 折れ線（lineString は flush() まで残っていること）
+	void lineString(DrawLayer layer, const LineString& lineString, const LineStyle& style, double thickness, const ColorF& color = Palette::White)
+	{
+		Command& command = add(layer, Kind::Path, ShapeState, color);
+		command.size = thickness;
+		command.index = static_cast<uint32>(m_paths.size());
+		m_paths << Path{ &lineString, style };
+	}
+
+	// pos を左上にして文字を描く（font は flush() まで残っていること）
+	void text(DrawLayer layer, const Font& font, const String& text, double size, const Vec2& pos, const ColorF& color = Palette::White)
+	{
+		addText(layer, font, text, size, pos, color, false);
+	}
+
+	// pos を中心にして文字を描く（font は flush() まで残っていること）
+	void textAt(DrawLayer layer, const Font& font, const String& text, double size, const Vec2& center, const ColorF& color = Palette::White)
+	{
+		addText(layer, font, text, size, center, color, true);
+	}
+
+	// pos を左上にしてテクスチャを描く
+	void texture(DrawLayer layer, const TextureRegion& region, const Vec2& pos, double scale = 1.0, const ColorF& color = Palette::White)
+	{
+		addTexture(layer, region, pos, scale, 0.0, color, false);
+	}
+
+	// center を中心にして、拡大・回転したスプライトを描く
+	void sprite(DrawLayer layer, const TextureRegion& region, double scale, double angle, const Vec2& center, const ColorF& color = Palette::White)
+	{
+		addTexture(layer, region, center, scale, angle, color, true);
+	}
+
+	// 記録できない描画（別の DrawList や、自前の頂点バッファなど）を、層の順番どおりに呼ぶ
+	// 中で何を描くか分からないので、呼ぶたびに状態を切り替えたものとして数える
+	// pass の中では、この DrawList に記録しない
+	void pass(DrawLayer layer, std::function<void()> function)
+	{
+		add(layer, Kind::Pass, PassState, Palette::White).index = static_cast<uint32>(m_passes.size());
+		m_passes << std::move(function);
+	}
+
+	// 記録した描画を並べ替えて描き、記録を消す
+	DrawStats flush()
+	{
+		DrawStats stats;
+		stats.commands = m_commands.size();
+
+		m_order.clear();
+
+		uint64 previous = NoState;
+
+		for (size_t i = 0; i < m_commands.size(); ++i)
+		{
+			const Command& command = m_commands[i];
+			m_order << SortKey{ ((static_cast<uint64>(command.layer) << 56) | command.state), static_cast<uint32>(i) };
+
+			if ((command.state == PassState) || (command.state != previous))
+			{
+				++stats.unsortedStateChanges;
+			}
+
+			previous = command.state;
+		}
+
+		// 同じ層・同じ状態の中では記録した順を保つ
+		std::sort(m_order.begin(), m_order.end(), [](const SortKey& a, const SortKey& b)
+		{
+			return ((a.key != b.key) ? (a.key < b.key) : (a.index < b.index));
+		});
+
+		previous = NoState;
+
+		for (const auto& entry : m_order)
+		{
+			const Command& command = m_commands[entry.index];
+
+			if ((command.state == PassState) || (command.state != previous))
+			{
+				++stats.stateChanges;
+			}
+
+			previous = command.state;
+			draw(command);
+		}
+
+		clear();
+		m_frame += stats;
+		return stats;
+	}
+
+	// 記録した描画を描かずに消す
+	void clear()
+	{
+		m_commands.clear();
+		m_textCount = 0;
+		m_regions.clear();
+		m_paths.clear();
+		m_passes.clear();
+	}
+
+	// 別の DrawList の flush() の結果を、このフレームの統計に加える
+	void addStats(const DrawStats& stats) noexcept
+	{
+		m_frame += stats;
+	}
+
+	// フレームの終わりに呼ぶ
+	void endFrame() noexcept
+	{
+		m_lastFrame = std::exchange(m_frame, DrawStats{});
+	}
+
+	// 直前のフレームの統計
+	[[nodiscard]]
+	const DrawStats& lastFrame() const noexcept
+	{
+		return m_lastFrame;
+	}
+
+private:
+
+	enum class Kind : uint8
+	{
+		Fill,
+		Frame,
+		Shadow,
+		Path,
+		Text,
+		Texture,
+		Pass,
+	};
+
+	// 描く状態の種類（並べ替えの順）
+	enum class Shader : uint8
+	{
+		Shape,
+		Texture,
+		SDF,
+		MSDF,
+		Pass,
+	};
+
+	// 状態はシェーダの種類（上位）とテクスチャの ID（下位 32 ビット）を並べたもの
+	[[nodiscard]]
+	static uint64 MakeState(Shader shader, uint64 texture) noexcept
+	{
+		return ((static_cast<uint64>(shader) << 32) | (texture & 0xFFFF'FFFFull));
+	}
+
+	static constexpr uint64 ShapeState = (static_cast<uint64>(Shader::Shape) << 32);
+
+	static constexpr uint64 PassState = (static_cast<uint64>(Shader::Pass) << 32);
+
+	static constexpr uint64 NoState = ~0ull;
+
+	struct Command
+	{
+		Kind kind = Kind::Pass;
+
+		DrawLayer layer = DrawLayer::Background;
+
+		uint64 state = 0;
+
+		ColorF color{ 1.0 };
+
+		// 塗り・枠・影の図形
+		std::variant<RectF, RoundRect, Circle> shape;
+
+		// 枠と線の太さ、影のぼかしの大きさ、文字の大きさ、テクスチャの拡大率
+		double size = 0.0;
+
+		// 影の広がり、スプライトの回転角
+		double spread = 0.0;
+
+		// 影のずれ、文字とテクスチャの位置
+		Vec2 pos{ 0, 0 };
+
+		// 文字、テクスチャ、折れ線、パスの番号
+		uint32 index = 0;
+
+		// 文字とテクスチャを pos を中心に描くか
+		bool centered = false;
+
+		const Font* font = nullptr;
+	};
+
+	struct Path
+	{
+		const LineString* lineString;
+
+		LineStyle style;
+	};
+
+	struct SortKey
+	{
+		uint64 key;
+
+		uint32 index;
+	};
+
+	Array<Command> m_commands;
+
+	Array<SortKey> m_order;
+
+	// 文字列は使い回す（String の容量を残しておき、毎フレームの確保を避ける）
+	Array<String> m_texts;
+	size_t m_textCount = 0;
+
+	Array<TextureRegion> m_regions;
+
+	Array<Path> m_paths;
+
+	Array<std::function<void()>> m_passes;
+
+	DrawStats m_frame;
+
+	DrawStats m_lastFrame;
+
+	Command& add(DrawLayer layer, Kind kind, uint64 state, const ColorF& color)
+	{
+		Command& command = m_commands.emplace_back();
+		command.kind = kind;
+		command.layer = layer;
+		command.state = state;
+		command.color = color;
+		return command;
+	}
+
+	template <class Shape>
+	Command& addShape(DrawLayer layer, Kind kind, const Shape& shape, const ColorF& color)
+	{
+		Command& command = add(layer, kind, ShapeState, color);
+		command.shape = shape;
+		return command;
+	}
+
+	void addText(DrawLayer layer, const Font& font, const String& text, double size, const Vec2& pos, const ColorF& color, bool centered)
+	{
+		const Shader shader = ((font.method() == FontMethod::MSDF) ? Shader::MSDF
+			: (font.method() == FontMethod::SDF) ? Shader::SDF : Shader::Texture);
+
+		Command& command = add(layer, Kind::Text, MakeState(shader, font.id().value()), color);
+		command.size = size;
+		command.pos = pos;
+		command.centered = centered;
+		command.font = &font;
+		command.index = static_cast<uint32>(m_textCount);
+
+		if (m_textCount < m_texts.size())
+		{
+			m_texts[m_textCount] = text;
+		}
+		else
+		{
+			m_texts << text;
+		}
+
+		++m_textCount;
+	}
+
+	void addTexture(DrawLayer layer, const TextureRegion& region, const Vec2& pos, double scale, double angle, const ColorF& color, bool centered)
+	{
+		Command& command = add(layer, Kind::Texture, MakeState(Shader::Texture, region.texture.id().value()), color);
+		command.size = scale;
+		command.spread = angle;
+		command.pos = pos;
+		command.centered = centered;
+		command.index = static_cast<uint32>(m_regions.size());
+		m_regions << region;
+	}
+
+	void draw(const Command& command) const
+	{
+		switch (command.kind)
+		{
+		case Kind::Fill:
+			std::visit([&](const auto& shape) { shape.draw(command.color); }, command.shape);
+			break;
+		case Kind::Frame:
+			std::visit([&](const auto& shape) { shape.drawFrame(command.size, command.color); }, command.shape);
+			break;
+		case Kind::Shadow:
+			std::visit([&](const auto& shape) { shape.drawShadow(command.pos, command.size, command.spread, command.color); }, command.shape);
+			break;
+		case Kind::Path:
+			{
+				const Path& path = m_paths[command.index];
+				path.lineString->draw(path.style, command.size, command.color);
+			}
+			break;
+		case Kind::Text:
+			if (command.centered)
+			{
+				(*command.font)(m_texts[command.index]).drawAt(command.size, command.pos, command.color);
+			}
+			else
+			{
+				(*command.font)(m_texts[command.index]).draw(command.size, command.pos, command.color);
+			}
+			break;
+		case Kind::Texture:
+			if (command.centered)
+			{
+				m_regions[command.index].scaled(command.size).rotated(command.spread).drawAt(command.pos, command.color);
+			}
+			else
+			{
+				m_regions[command.index].scaled(command.size).draw(command.pos, command.color);
+			}
+			break;
+		case Kind::Pass:
+			m_passes[command.index]();
+			break;
+		}
+	}
+};
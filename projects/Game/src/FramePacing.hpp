@@ -0,0 +1,283 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <thread>
+
+// フレームレートの制御方法
+enum class FramePacingMode
+{
+	// 垂直同期に合わせる（既定）
+	VSync,
+
+	// 垂直同期を切り、指定したフレームレートに合わせて待機する
+	Target,
+
+	// 待機しない（ベンチマーク用）
+	Uncapped,
+
+	// 省電力のため低いフレームレートに制限する
+	LowPower,
+};
+
+// フレームの待機と、フレームにかかった時間の計測を行う
+class FramePacer
+{
+public:
+
+	// 省電力モードのフレームレート
+	static constexpr double LowPowerFrameRate = 30.0;
+
+	// 垂直同期モードで想定するフレームレート
+	static constexpr double DefaultFrameRate = 60.0;
+
+	void setMode(FramePacingMode mode, double targetFrameRate = DefaultFrameRate)
+	{
+		m_mode = mode;
+		m_targetFrameRate = (mode == FramePacingMode::LowPower) ? LowPowerFrameRate : Max(targetFrameRate, 1.0);
+		Graphics::SetVSyncEnabled(mode == FramePacingMode::VSync);
+		m_refreshRate = System::GetCurrentMonitor().refreshRate.value_or(DefaultFrameRate);
+		m_deadline = Clock::now();
+	}
+
+	// コマンドライン引数（--fps=N, --uncapped, --low-power）から設定する
+	void setModeFromCommandLine()
+	{
+		for (const auto& arg : System::GetCommandLineArgs())
+		{
+			if (arg == U"--uncapped")
+			{
+				setMode(FramePacingMode::Uncapped);
+			}
+			else if (arg == U"--low-power")
+			{
+				setMode(FramePacingMode::LowPower);
+			}
+			else if (arg.starts_with(U"--fps="))
+			{
+				if (const auto fps = ParseOpt<double>(arg.substr(6)))
+				{
+					setMode(FramePacingMode::Target, *fps);
+				}
+			}
+		}
+	}
+
+	// System::Update() から戻った直後に呼び、フレームの処理時間の計測を始める
+	// 前回の beginFrame() からの間隔は、System::Update() 内の GPU への送信・表示・垂直同期の待ちを含むフレーム間隔になる
+	void beginFrame()
+	{
+		const auto now = Clock::now();
+
+		if (m_started)
+		{
+			const double interval = std::chrono::duration<double>(now - m_frameStart).count();
+			m_frameInterval = (m_frameInterval == 0.0) ? interval : (m_frameInterval * (1.0 - Smoothing) + interval * Smoothing);
+		}
+
+		m_frameStart = now;
+		m_started = true;
+	}
+
+	// System::Update() の直前に呼び、目標の時刻まで待機する
+	// beginFrame() からここまでを処理時間とするため、待機や System::Update() 内の表示待ち（垂直同期）は含まれない
+	void wait()
+	{
+		const auto busyEnd = Clock::now();
+		const double busy = std::chrono::duration<double>(busyEnd - m_frameStart).count();
+
+		if ((m_mode == FramePacingMode::Target) || (m_mode == FramePacingMode::LowPower))
+		{
+			const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_targetFrameRate));
+			m_deadline += period;
+
+			// 1 フレーム以上遅れていたら、遅れを取り戻そうとせず基準をやり直す
+			if (m_deadline < busyEnd - period)
+			{
+				m_deadline = busyEnd;
+			}
+
+			// 粗く眠ってから、残りの 1 ms 未満はスピンして合わせる
+			std::this_thread::sleep_until(m_deadline - std::chrono::milliseconds{ 1 });
+
+			while (Clock::now() < m_deadline)
+			{
+				std::this_thread::yield();
+			}
+		}
+
+		m_busyTime = (m_busyTime == 0.0) ? busy : (m_busyTime * (1.0 - Smoothing) + busy * Smoothing);
+	}
+
+	[[nodiscard]]
+	FramePacingMode mode() const noexcept
+	{
+		return m_mode;
+	}
+
+	// 1 フレームに使える時間 [秒]（垂直同期ではモニターのリフレッシュの間隔）
+	[[nodiscard]]
+	double frameBudget() const noexcept
+	{
+		switch (m_mode)
+		{
+		case FramePacingMode::Target:
+		case FramePacingMode::LowPower:
+			return (1.0 / m_targetFrameRate);
+		default:
+			return (1.0 / m_refreshRate);
+		}
+	}
+
+	// 待機を除いた 1 フレームの CPU の処理時間（指数移動平均）[秒]
+	[[nodiscard]]
+	double busyTime() const noexcept
+	{
+		return m_busyTime;
+	}
+
+	// GPU の処理と表示の待ちを含めた、フレームの間隔（指数移動平均）[秒]
+	// GPU が間に合わずに垂直同期を逃すと、リフレッシュの間隔の倍数に伸びる
+	[[nodiscard]]
+	double frameInterval() const noexcept
+	{
+		return m_frameInterval;
+	}
+
+private:
+
+	using Clock = std::chrono::steady_clock;
+
+	// 指数移動平均の係数
+	static constexpr double Smoothing = 0.1;
+
+	FramePacingMode m_mode = FramePacingMode::VSync;
+	double m_targetFrameRate = DefaultFrameRate;
+	double m_refreshRate = DefaultFrameRate;
+	Clock::time_point m_deadline = Clock::now();
+	Clock::time_point m_frameStart = Clock::now();
+	bool m_started = false;
+	double m_busyTime = 0.0;
+	double m_frameInterval = 0.0;
+};
+
+// フレーム時間が予算を超えたとき、ワールドのレイヤーだけを縮小したレンダーテクスチャに描いて拡大表示する
+// UI はこのクラスを通さずに描くため、常に等倍のまま表示される
+class DynamicResolution
+{
+public:
+
+	// 縮小率の下限
+	static constexpr double MinScale = 0.5;
+
+	// 1 回に変える縮小率の幅
+	static constexpr double ScaleStep = 0.1;
+
+	// フレームの間隔（GPU の処理と表示の待ちを含む、FramePacer::frameInterval()）に合わせて縮小率を調整する（毎フレーム 1 回呼ぶ）
+	//
+	// 間隔は指数移動平均なので、垂直同期を 1 回逃しただけでは下げる閾値を超えず、逃し続けたときだけ下げる
+	// 垂直同期中は間に合っていても間隔が予算に張り付き、余裕の大きさは分からないため、
+	// 予算どおりのフレームがしばらく続いたら試しに 1 段上げる。上げた直後にまた下がったら、次に試すまでの待ちを倍にする
+	void update(double frameInterval, double budget)
+	{
+		m_framesSinceRaise = Min((m_framesSinceRaise + 1), MaxRaiseWait);
+
+		if (m_cooldown > 0)
+		{
+			--m_cooldown;
+			return;
+		}
+
+		if (frameInterval > budget * 1.2)
+		{
+			// 予算オーバー：解像度を下げる
+			if (m_scale > MinScale)
+			{
+				m_scale = Max(MinScale, m_scale - ScaleStep);
+				m_cooldown = 30;
+
+				// 試しに上げたのが間に合わなかった
+				if (m_framesSinceRaise < MinRaiseWait)
+				{
+					m_raiseWait = Min((m_raiseWait * 2), MaxRaiseWait);
+				}
+			}
+
+			m_headroomFrames = 0;
+		}
+		else if (frameInterval < budget * 1.05)
+		{
+			if ((m_scale < 1.0) && (++m_headroomFrames >= m_raiseWait))
+			{
+				m_scale = Min(1.0, m_scale + ScaleStep);
+				m_cooldown = 30;
+				m_headroomFrames = 0;
+				m_framesSinceRaise = 0;
+			}
+		}
+		else
+		{
+			m_headroomFrames = 0;
+		}
+	}
+
+	// drawWorld(toTarget) でワールドを描く
+	// toTarget はカメラ行列の後に掛ける行列で、縮小して描くときの拡大縮小を表す
+	template <class DrawWorld>
+	void render(DrawWorld drawWorld)
+	{
+		if (m_scale >= 1.0)
+		{
+			drawWorld(Mat3x2::Identity());
+			return;
+		}
+
+		const Size sceneSize = Scene::Size();
+		const Size reducedSize = (sceneSize * m_scale).asPoint();
+
+		if (m_target.size() != sceneSize)
+		{
+			m_target = RenderTexture{ sceneSize, ColorF{ 0.0, 0.0 } };
+		}
+
+		{
+			const ScopedRenderTarget2D target{ m_target.clear(ColorF{ 0.0, 0.0 }) };
+			const ScopedRenderStates2D blend{ MakeBlendState() };
+			const ScopedViewport2D viewport{ Rect{ reducedSize } };
+			drawWorld(Mat3x2::Scale(m_scale));
+		}
+
+		// 縮小して描いた部分を画面全体に拡大して表示する
+		const ScopedRenderStates2D states{ BlendState::Premultiplied, SamplerState::ClampLinear };
+		m_target(Rect{ reducedSize }).resized(sceneSize).draw();
+	}
+
+	// 現在の縮小率（1.0 で等倍）
+	[[nodiscard]]
+	double scale() const noexcept
+	{
+		return m_scale;
+	}
+
+private:
+
+	// 試しに上げるまでに待つフレーム数の最小と最大
+	static constexpr int32 MinRaiseWait = 120;
+	static constexpr int32 MaxRaiseWait = 1920;
+
+	double m_scale = 1.0;
+	int32 m_cooldown = 0;
+	int32 m_headroomFrames = 0;
+	int32 m_raiseWait = MinRaiseWait;
+	int32 m_framesSinceRaise = MaxRaiseWait;
+	RenderTexture m_target;
+
+	// 透明なレンダーテクスチャに描いた結果を、乗算済みアルファとして合成できるようにするブレンドステート
+	[[nodiscard]]
+	static BlendState MakeBlendState()
+	{
+		BlendState blendState = BlendState::Default2D;
+		blendState.srcAlpha = Blend::SrcAlpha;
+		blendState.dstAlpha = Blend::DestAlpha;
+		blendState.opAlpha = BlendOp::Max;
+		return blendState;
+	}
+};
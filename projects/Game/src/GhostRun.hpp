@@ -0,0 +1,626 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// ゴースト（過去の挑戦の再生）の 1 つの設置物の形
+struct GhostPart
+{
+	// 円なら true（size は直径）、四角形なら false
+	bool circle = true;
+
+	// 大きさ（ワールド座標）
+	Vec2 size{ 0, 0 };
+};
+
+// ある時刻の針と設置物の位置
+struct GhostFrame
+{
+	struct Needle
+	{
+		Vec2 pos{ 0, 0 };
+
+		double angle = 0.0;
+	};
+
+	Array<Needle> needles;
+
+	// ワールドに置かれている設置物（ビット i が GhostRun::parts()[i]、GhostRun::MaxParts 個まで）
+	uint32 placedMask = 0;
+
+	// 設置物の中心（ワールド座標、GhostRun::parts() の順）
+	Array<Vec2> parts;
+};
+
+// 1 回の挑戦の針と設置物の動きを、量子化して差分で符号化したもの
+//
+// 一定のステップごとに 1 つのサンプルを記録する。サンプルの形式:
+//   フラグ (uint8, ビット 0: 設置物の区画がある), 針の数 (varint),
+//   針ごとに x, y, 角度 の差分 (zigzag varint),
+//   設置物の区画があれば 置かれている設置物のビット列 (varint), 置かれている設置物ごとに x, y の差分 (zigzag varint)
+// 差分は直前のサンプルの同じ番号の値から取る。KeyframeInterval サンプルごとのキーフレームは 0 からの差分（絶対値）で、
+// キーフレームの位置の表を引けば、どの時刻にも一定の手間で移れる
+class GhostRun
+{
+public:
+
+	// サンプルの間隔 [秒]
+	static constexpr double SampleInterval = 0.05;
+
+	// キーフレームの間隔（サンプル数）
+	static constexpr uint32 KeyframeInterval = 64;
+
+	// 読み込むサンプル数の上限（30 分）
+	static constexpr uint32 MaxSamples = static_cast<uint32>(30 * 60 / SampleInterval);
+
+	// 設置物の数の上限（置かれているかを placedMask のビットで表すため）
+	static constexpr size_t MaxParts = 32;
+
+	// 座標と角度の量子化の細かさ
+	static constexpr double PositionScale = 16.0;
+	static constexpr double AngleScale = 2048.0;
+
+	GhostRun() = default;
+
+	GhostRun(const Array<GhostPart>& parts, double time, uint32 sampleCount, Array<uint32>&& keyframes, Array<uint8>&& data)
+		: m_parts{ parts }
+		, m_time{ time }
+		, m_sampleCount{ sampleCount }
+		, m_keyframes{ std::move(keyframes) }
+		, m_data{ std::move(data) } {}
+
+	[[nodiscard]]
+	const Array<GhostPart>& parts() const noexcept
+	{
+		return m_parts;
+	}
+
+	// 挑戦にかかった時間 [秒]
+	[[nodiscard]]
+	double time() const noexcept
+	{
+		return m_time;
+	}
+
+	[[nodiscard]]
+	uint32 sampleCount() const noexcept
+	{
+		return m_sampleCount;
+	}
+
+	// サンプル index を含むキーフレームの、データの中の位置
+	[[nodiscard]]
+	uint32 keyframeOffset(uint32 index) const noexcept
+	{
+		return m_keyframes[index / KeyframeInterval];
+	}
+
+	[[nodiscard]]
+	const Array<uint8>& data() const noexcept
+	{
+		return m_data;
+	}
+
+	[[nodiscard]]
+	size_t memoryUsage() const noexcept
+	{
+		return (m_data.size() + (m_keyframes.size() * sizeof(uint32)) + (m_parts.size() * sizeof(GhostPart)));
+	}
+
+	void write(BinaryWriter& writer) const
+	{
+		writer.write(m_time);
+		writer.write(m_sampleCount);
+		writer.write(static_cast<uint32>(m_parts.size()));
+
+		for (const auto& part : m_parts)
+		{
+			writer.write(static_cast<uint8>(part.circle));
+			writer.write(part.size);
+		}
+
+		writer.write(static_cast<uint32>(m_keyframes.size()));
+		writer.write(m_keyframes.data(), (m_keyframes.size() * sizeof(uint32)));
+		writer.write(static_cast<uint32>(m_data.size()));
+		writer.write(m_data.data(), m_data.size());
+	}
+
+	// 壊れたファイルや途中で切れたファイルは none を返す
+	[[nodiscard]]
+	static Optional<GhostRun> Read(BinaryReader& reader)
+	{
+		GhostRun run;
+		uint32 partCount = 0, keyframeCount = 0, dataSize = 0;
+
+		if ((not reader.read(run.m_time)) || (not reader.read(run.m_sampleCount)) || (not reader.read(partCount))
+			|| (MaxSamples < run.m_sampleCount) || (MaxParts < partCount))
+		{
+			return none;
+		}
+
+		run.m_parts.resize(partCount);
+
+		for (auto& part : run.m_parts)
+		{
+			uint8 circle = 0;
+
+			if ((not reader.read(circle)) || (not reader.read(part.size)))
+			{
+				return none;
+			}
+
+			part.circle = (circle != 0);
+		}
+
+		if ((not reader.read(keyframeCount)) || (keyframeCount != ((run.m_sampleCount + KeyframeInterval - 1) / KeyframeInterval)))
+		{
+			return none;
+		}
+
+		run.m_keyframes.resize(keyframeCount);
+
+		if ((not reader.read(run.m_keyframes.data(), (keyframeCount * sizeof(uint32)))) || (not reader.read(dataSize))
+			|| ((reader.size() - reader.getPos()) < dataSize))
+		{
+			return none;
+		}
+
+		// キーフレームは先頭から始まり、データの中で増えていく位置にあること
+		for (uint32 i = 0; i < keyframeCount; ++i)
+		{
+			const uint32 offset = run.m_keyframes[i];
+
+			if ((dataSize <= offset) || ((i == 0) ? (offset != 0) : (offset <= run.m_keyframes[i - 1])))
+			{
+				return none;
+			}
+		}
+
+		run.m_data.resize(dataSize);
+
+		if (not reader.read(run.m_data.data(), dataSize))
+		{
+			return none;
+		}
+
+		return run;
+	}
+
+	// 量子化した値
+	[[nodiscard]]
+	static int32 Quantize(double value, double scale) noexcept
+	{
+		return static_cast<int32>(Math::Round(value * scale));
+	}
+
+	[[nodiscard]]
+	static uint32 ZigZag(int32 value) noexcept
+	{
+		return ((static_cast<uint32>(value) << 1) ^ static_cast<uint32>(value >> 31));
+	}
+
+	[[nodiscard]]
+	static int32 UnZigZag(uint32 value) noexcept
+	{
+		return static_cast<int32>((value >> 1) ^ (~(value & 1) + 1));
+	}
+
+private:
+
+	Array<GhostPart> m_parts;
+
+	double m_time = 0.0;
+
+	uint32 m_sampleCount = 0;
+
+	Array<uint32> m_keyframes;
+
+	Array<uint8> m_data;
+};
+
+// 量子化した針と設置物の値（符号化と復号で、直前のサンプルとして持つ）
+struct GhostState
+{
+	struct Needle
+	{
+		int32 x = 0;
+
+		int32 y = 0;
+
+		int32 angle = 0;
+	};
+
+	Array<Needle> needles;
+
+	uint32 placedMask = 0;
+
+	Array<Point> parts;
+
+	// キーフレームでは 0 からの差分にする
+	void clear(size_t partCount)
+	{
+		needles.clear();
+		placedMask = 0;
+		parts.assign(partCount, Point{ 0, 0 });
+	}
+};
+
+// 挑戦中の動きを GhostRun に符号化する
+class GhostRecorder
+{
+public:
+
+	// 記録するサンプル数の上限
+	static constexpr uint32 MaxSamples = GhostRun::MaxSamples;
+
+	// 記録をやり直す（GhostRun::MaxParts 個を超える設置物は記録しない）
+	void begin(const Array<GhostPart>& parts)
+	{
+		m_parts = parts.take(GhostRun::MaxParts);
+		m_data.clear();
+		m_keyframes.clear();
+		m_count = 0;
+		m_previous.clear(m_parts.size());
+	}
+
+	// サンプルを 1 つ加える（上限に達したら何もしない）
+	void add(const GhostFrame& frame)
+	{
+		if (MaxSamples <= m_count)
+		{
+			return;
+		}
+
+		const bool keyframe = ((m_count % GhostRun::KeyframeInterval) == 0);
+
+		if (keyframe)
+		{
+			m_keyframes << static_cast<uint32>(m_data.size());
+			m_previous.clear(m_parts.size());
+		}
+
+		// 設置物は動いたときだけ書く
+		bool partsChanged = (keyframe || (frame.placedMask != m_previous.placedMask));
+
+		for (size_t i = 0; (i < m_parts.size()) && (not partsChanged); ++i)
+		{
+			partsChanged = ((frame.placedMask & (1u << i)) && (quantize(frame.parts[i]) != m_previous.parts[i]));
+		}
+
+		m_data << static_cast<uint8>(partsChanged ? 1 : 0);
+		writeVarint(static_cast<uint32>(frame.needles.size()));
+
+		for (size_t i = 0; i < frame.needles.size(); ++i)
+		{
+			const GhostState::Needle base = ((i < m_previous.needles.size()) ? m_previous.needles[i] : GhostState::Needle{});
+			const GhostState::Needle value{
+				GhostRun::Quantize(frame.needles[i].pos.x, GhostRun::PositionScale),
+				GhostRun::Quantize(frame.needles[i].pos.y, GhostRun::PositionScale),
+				GhostRun::Quantize(frame.needles[i].angle, GhostRun::AngleScale) };
+
+			writeVarint(GhostRun::ZigZag(value.x - base.x));
+			writeVarint(GhostRun::ZigZag(value.y - base.y));
+			writeVarint(GhostRun::ZigZag(value.angle - base.angle));
+
+			if (i < m_previous.needles.size())
+			{
+				m_previous.needles[i] = value;
+			}
+			else
+			{
+				m_previous.needles << value;
+			}
+		}
+
+		m_previous.needles.resize(frame.needles.size());
+
+		if (partsChanged)
+		{
+			writeVarint(frame.placedMask);
+
+			for (size_t i = 0; i < m_parts.size(); ++i)
+			{
+				if (frame.placedMask & (1u << i))
+				{
+					const Point value = quantize(frame.parts[i]);
+					writeVarint(GhostRun::ZigZag(value.x - m_previous.parts[i].x));
+					writeVarint(GhostRun::ZigZag(value.y - m_previous.parts[i].y));
+					m_previous.parts[i] = value;
+				}
+			}
+
+			m_previous.placedMask = frame.placedMask;
+		}
+
+		++m_count;
+	}
+
+	// 記録したサンプル数
+	[[nodiscard]]
+	uint32 sampleCount() const noexcept
+	{
+		return m_count;
+	}
+
+	// 記録を GhostRun にする（time: 挑戦にかかった時間）
+	[[nodiscard]]
+	GhostRun finish(double time) const
+	{
+		return GhostRun{ m_parts, time, m_count, Array<uint32>(m_keyframes), Array<uint8>(m_data) };
+	}
+
+private:
+
+	Array<GhostPart> m_parts;
+	Array<uint8> m_data;
+	Array<uint32> m_keyframes;
+	uint32 m_count = 0;
+	GhostState m_previous;
+
+	[[nodiscard]]
+	static Point quantize(const Vec2& pos) noexcept
+	{
+		return Point{ GhostRun::Quantize(pos.x, GhostRun::PositionScale), GhostRun::Quantize(pos.y, GhostRun::PositionScale) };
+	}
+
+	void writeVarint(uint32 value)
+	{
+		while (0x80 <= value)
+		{
+			m_data << static_cast<uint8>((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+
+		m_data << static_cast<uint8>(value);
+	}
+};
+
+// GhostRun を時刻に合わせて少しずつ復号し、前後のサンプルを補間した位置を作る
+// 持つのは直前・直後の 2 サンプル分だけで、時刻が戻ったり飛んだりしたときは
+// 直前のキーフレームから復号し直す（最大 KeyframeInterval サンプル）
+// データが壊れていて復号できなかったときは GhostRun を手放し、run() が nullptr になる
+class GhostPlayer
+{
+public:
+
+	GhostPlayer() = default;
+
+	explicit GhostPlayer(std::shared_ptr<const GhostRun> run)
+		: m_run{ std::move(run) }
+	{
+		seek(0);
+	}
+
+	[[nodiscard]]
+	const std::shared_ptr<const GhostRun>& run() const noexcept
+	{
+		return m_run;
+	}
+
+	// 時刻 time [秒] の位置を作る
+	void update(double time)
+	{
+		if ((not m_run) || (m_run->sampleCount() == 0))
+		{
+			return;
+		}
+
+		const uint32 last = (m_run->sampleCount() - 1);
+		const double position = Clamp((time / GhostRun::SampleInterval), 0.0, static_cast<double>(last));
+		const uint32 index = Min(static_cast<uint32>(position), last);
+
+		if ((index < m_index) || ((m_index + GhostRun::KeyframeInterval) < index))
+		{
+			seek(index);
+
+			if (not m_run)
+			{
+				return;
+			}
+		}
+
+		while (m_index < index)
+		{
+			m_current = m_next;
+			++m_index;
+
+			if ((m_index < last) && (not decode(m_next)))
+			{
+				drop();
+				return;
+			}
+		}
+
+		interpolate(((index == last) ? 0.0 : (position - index)));
+	}
+
+	// 補間した位置
+	[[nodiscard]]
+	const GhostFrame& frame() const noexcept
+	{
+		return m_frame;
+	}
+
+	// 最後のサンプルまで再生したか
+	[[nodiscard]]
+	bool finished() const noexcept
+	{
+		return ((not m_run) || ((m_index + 1) >= m_run->sampleCount()));
+	}
+
+private:
+
+	std::shared_ptr<const GhostRun> m_run;
+
+	// 次に読む位置と、そこがキーフレームから何番目か
+	size_t m_offset = 0;
+	uint32 m_decoded = 0;
+
+	// m_current のサンプルの番号
+	uint32 m_index = 0;
+
+	GhostState m_current;
+	GhostState m_next;
+	GhostFrame m_frame;
+
+	// サンプル index を含むキーフレームから読み直し、index と index + 1 を用意する
+	void seek(uint32 index)
+	{
+		if ((not m_run) || (m_run->sampleCount() == 0))
+		{
+			return;
+		}
+
+		index = Min(index, (m_run->sampleCount() - 1));
+		m_decoded = ((index / GhostRun::KeyframeInterval) * GhostRun::KeyframeInterval);
+		m_offset = m_run->keyframeOffset(index);
+
+		while (m_decoded <= index)
+		{
+			if (not decode(m_current))
+			{
+				drop();
+				return;
+			}
+		}
+
+		m_index = index;
+		m_next = m_current;
+
+		if (((index + 1) < m_run->sampleCount()) && (not decode(m_next)))
+		{
+			drop();
+		}
+	}
+
+	// 復号できなかった GhostRun を手放す
+	void drop()
+	{
+		m_run.reset();
+		m_frame = GhostFrame{};
+	}
+
+	// 次のサンプルを state に復号する（state には直前のサンプルが入っていること）
+	// データの終わりを越えて読もうとしたら false を返す
+	[[nodiscard]]
+	bool decode(GhostState& state)
+	{
+		const Array<uint8>& data = m_run->data();
+
+		if ((m_decoded % GhostRun::KeyframeInterval) == 0)
+		{
+			state.clear(m_run->parts().size());
+		}
+
+		if (data.size() <= m_offset)
+		{
+			return false;
+		}
+
+		const uint8 flags = data[m_offset++];
+		uint32 needleCount = 0;
+
+		// 針 1 本につき少なくとも 3 バイトある
+		if ((not readVarint(data, needleCount)) || (((data.size() - m_offset) / 3) < needleCount))
+		{
+			return false;
+		}
+
+		const size_t previousCount = state.needles.size();
+		state.needles.resize(needleCount);
+
+		for (size_t i = 0; i < needleCount; ++i)
+		{
+			GhostState::Needle& needle = state.needles[i];
+
+			if (previousCount <= i)
+			{
+				needle = GhostState::Needle{};
+			}
+
+			uint32 x = 0, y = 0, angle = 0;
+
+			if ((not readVarint(data, x)) || (not readVarint(data, y)) || (not readVarint(data, angle)))
+			{
+				return false;
+			}
+
+			needle.x += GhostRun::UnZigZag(x);
+			needle.y += GhostRun::UnZigZag(y);
+			needle.angle += GhostRun::UnZigZag(angle);
+		}
+
+		if (flags & 1)
+		{
+			if (not readVarint(data, state.placedMask))
+			{
+				return false;
+			}
+
+			for (size_t i = 0; i < state.parts.size(); ++i)
+			{
+				if (state.placedMask & (1u << i))
+				{
+					uint32 x = 0, y = 0;
+
+					if ((not readVarint(data, x)) || (not readVarint(data, y)))
+					{
+						return false;
+					}
+
+					state.parts[i].x += GhostRun::UnZigZag(x);
+					state.parts[i].y += GhostRun::UnZigZag(y);
+				}
+			}
+		}
+
+		++m_decoded;
+		return true;
+	}
+
+	// データの終わりまでに値が終わらなければ false を返す
+	[[nodiscard]]
+	bool readVarint(const Array<uint8>& data, uint32& value)
+	{
+		value = 0;
+
+		for (int32 shift = 0; ((m_offset < data.size()) && (shift < 32)); shift += 7)
+		{
+			const uint8 byte = data[m_offset++];
+			value |= (static_cast<uint32>(byte & 0x7F) << shift);
+
+			if ((byte & 0x80) == 0)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	[[nodiscard]]
+	static double Lerp(int32 a, int32 b, double t) noexcept
+	{
+		return (a + (b - a) * t);
+	}
+
+	// 前後のサンプルを t で補間する（針の数が違うときは後のサンプルに合わせる）
+	void interpolate(double t)
+	{
+		m_frame.needles.resize(m_next.needles.size());
+
+		for (size_t i = 0; i < m_next.needles.size(); ++i)
+		{
+			const GhostState::Needle& b = m_next.needles[i];
+			const GhostState::Needle& a = ((i < m_current.needles.size()) ? m_current.needles[i] : b);
+			m_frame.needles[i].pos = (Vec2{ Lerp(a.x, b.x, t), Lerp(a.y, b.y, t) } / GhostRun::PositionScale);
+			m_frame.needles[i].angle = (Lerp(a.angle, b.angle, t) / GhostRun::AngleScale);
+		}
+
+		m_frame.placedMask = m_current.placedMask;
+		m_frame.parts.resize(m_current.parts.size());
+
+		for (size_t i = 0; i < m_current.parts.size(); ++i)
+		{
+			m_frame.parts[i] = (Vec2{ static_cast<double>(m_current.parts[i].x), static_cast<double>(m_current.parts[i].y) } / GhostRun::PositionScale);
+		}
+	}
+};
@@ -0,0 +1,257 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <mutex>
+# include <thread>
+# include <atomic>
+
+# if SIV3D_PLATFORM(WINDOWS)
+#	include <Siv3D/Windows/Windows.hpp>
+#	include <timeapi.h>
+# endif
+
+// 入力イベントの種類
+enum class InputEventType : uint8
+{
+	Move,
+	LeftDown,
+	LeftUp,
+	KeyDown,
+	KeyUp,
+};
+
+// タイムスタンプ付きの入力イベント
+struct InputEvent
+{
+	InputEventType type = InputEventType::Move;
+
+	// 発生時のカーソル位置（シーン座標）
+	Vec2 pos{ 0, 0 };
+
+	// キーコード（KeyDown / KeyUp のときのみ有効）
+	uint8 key = 0;
+
+	// 発生時刻（InputQueue::now() と同じ時計の秒数）
+	double time = 0.0;
+};
+
+// 描画フレームとは独立に入力を高頻度でサンプリングし、フレーム間に起きたイベントをすべて保持するキュー
+// Windows では専用スレッドが約 1 ms 間隔で OS の入力状態を読み取る
+// それ以外の環境では毎フレーム Siv3D の入力状態からイベントを作る
+class InputQueue
+{
+public:
+
+	InputQueue()
+	{
+		watchKey(KeyR);
+		watchKey(KeyZ);
+		watchKey(KeyY);
+		watchKey(KeyControl);
+		watchKey(KeyShift);
+
+	# if SIV3D_PLATFORM(WINDOWS)
+		m_hWnd = static_cast<HWND>(Platform::Windows::Window::GetHWND());
+		m_thread = std::thread{ [this]() { run(); } };
+	# endif
+	}
+
+	~InputQueue()
+	{
+		m_quit = true;
+
+		if (m_thread.joinable())
+		{
+			m_thread.join();
+		}
+	}
+
+	InputQueue(const InputQueue&) = delete;
+	InputQueue& operator =(const InputQueue&) = delete;
+
+	// イベント列に含めるキーを追加する（サンプリング開始前に呼ぶこと）
+	void watchKey(const Input& key)
+	{
+		std::lock_guard lock{ m_mutex };
+		m_keys << key.code();
+		m_keyStates << false;
+	}
+
+	// フレームの最初に 1 回呼び、前フレーム以降に起きたイベントを取り出す
+	void beginFrame()
+	{
+		m_events.clear();
+		m_frameTime = now();
+
+	# if SIV3D_PLATFORM(WINDOWS)
+		{
+			std::lock_guard lock{ m_mutex };
+			std::swap(m_pending, m_drained);
+		}
+
+		for (const auto& raw : m_drained)
+		{
+			m_events << InputEvent{ raw.type, Scene::ClientToScene(raw.clientPos), raw.key, raw.time };
+		}
+
+		m_drained.clear();
+	# else
+		sampleFrame();
+	# endif
+
+		// テストやベンチマークから注入されたイベントはフレームの最後に起きたものとして扱う
+		for (auto event : m_injected)
+		{
+			event.time = m_frameTime;
+			m_events << event;
+		}
+
+		m_injected.clear();
+	}
+
+	// 直前の beginFrame() で取り出したイベント（発生順）
+	[[nodiscard]]
+	const Array<InputEvent>& events() const noexcept
+	{
+		return m_events;
+	}
+
+	// 直前の beginFrame() を呼んだ時刻
+	[[nodiscard]]
+	double frameTime() const noexcept
+	{
+		return m_frameTime;
+	}
+
+	// イベントの時刻と同じ基準の現在時刻 [秒]
+	[[nodiscard]]
+	double now() const
+	{
+		return m_clock.sF();
+	}
+
+	// 実際の入力の代わりにイベントを追加する（次の beginFrame() で取り出される）
+	void inject(const InputEvent& event)
+	{
+		m_injected << event;
+	}
+
+private:
+
+	struct RawEvent
+	{
+		InputEventType type;
+		Vec2 clientPos;
+		uint8 key;
+		double time;
+	};
+
+	Stopwatch m_clock{ StartImmediately::Yes };
+	double m_frameTime = 0.0;
+	Array<InputEvent> m_events;
+	Array<InputEvent> m_injected;
+
+	std::mutex m_mutex;
+	Array<uint8> m_keys;
+	Array<bool> m_keyStates;
+	Array<RawEvent> m_pending;
+	Array<RawEvent> m_drained;
+
+	std::atomic<bool> m_quit{ false };
+	std::thread m_thread;
+
+# if SIV3D_PLATFORM(WINDOWS)
+
+	HWND m_hWnd = nullptr;
+
+	// 入力スレッド：カーソル位置とボタン・キーの状態を約 1 ms ごとに読み取り、変化をイベントにする
+	void run()
+	{
+		::timeBeginPeriod(1);
+
+		POINT lastPos{ LONG_MIN, LONG_MIN };
+		bool lastLeft = false;
+
+		while (not m_quit)
+		{
+			const double time = now();
+			const bool active = (::GetForegroundWindow() == m_hWnd);
+
+			POINT pos{};
+			::GetCursorPos(&pos);
+			::ScreenToClient(m_hWnd, &pos);
+			const Vec2 clientPos{ pos.x, pos.y };
+
+			const bool left = active && (::GetAsyncKeyState(VK_LBUTTON) & 0x8000);
+
+			{
+				std::lock_guard lock{ m_mutex };
+
+				if ((pos.x != lastPos.x) || (pos.y != lastPos.y))
+				{
+					m_pending << RawEvent{ InputEventType::Move, clientPos, 0, time };
+					lastPos = pos;
+				}
+
+				if (left != lastLeft)
+				{
+					m_pending << RawEvent{ (left ? InputEventType::LeftDown : InputEventType::LeftUp), clientPos, 0, time };
+					lastLeft = left;
+				}
+
+				for (size_t i = 0; i < m_keys.size(); ++i)
+				{
+					const bool pressed = active && (::GetAsyncKeyState(m_keys[i]) & 0x8000);
+
+					if (pressed != m_keyStates[i])
+					{
+						m_pending << RawEvent{ (pressed ? InputEventType::KeyDown : InputEventType::KeyUp), clientPos, m_keys[i], time };
+						m_keyStates[i] = pressed;
+					}
+				}
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+		}
+
+		::timeEndPeriod(1);
+	}
+
+# else
+
+	Vec2 m_lastPos{ -1, -1 };
+
+	// 専用スレッドが使えない環境では、フレームごとの入力状態からイベントを作る
+	void sampleFrame()
+	{
+		const Vec2 pos = Cursor::PosF();
+
+		if (pos != m_lastPos)
+		{
+			m_events << InputEvent{ InputEventType::Move, pos, 0, m_frameTime };
+			m_lastPos = pos;
+		}
+
+		if (MouseL.down())
+		{
+			m_events << InputEvent{ InputEventType::LeftDown, pos, 0, m_frameTime };
+		}
+
+		if (MouseL.up())
+		{
+			m_events << InputEvent{ InputEventType::LeftUp, pos, 0, m_frameTime };
+		}
+
+		for (size_t i = 0; i < m_keys.size(); ++i)
+		{
+			const bool pressed = Input{ InputDeviceType::Keyboard, m_keys[i] }.pressed();
+
+			if (pressed != m_keyStates[i])
+			{
+				m_events << InputEvent{ (pressed ? InputEventType::KeyDown : InputEventType::KeyUp), pos, m_keys[i], m_frameTime };
+				m_keyStates[i] = pressed;
+			}
+		}
+	}
+
+# endif
+};
@@ -0,0 +1,834 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "PhysicsEvents.hpp"
+# include "AssetPack.hpp"
+# include "DistanceField.hpp"
+
+// レベルのデータは次のようなフォルダにまとめる
+//
+// level/<名前>/
+// ├── level.json            … チャンクの大きさ・カメラの初期位置・針の出現位置・トリガー領域・チャンクの一覧
+// └── chunk_<x>_<y>.json    … 1 チャンク分の地面（座標はワールド座標）
+//
+// ステージ全体を一度に P2World に作るのではなく、カメラの周囲のチャンクだけを読み込み、
+// 離れたチャンクは破棄することで、大きなレベルでもメモリと物理演算の負荷を一定に保つ
+
+// JSON の値を読むための補助
+// 編集途中のファイルは、文法は正しくても数の個数が足りない・数の所に文字列があるなどの状態になりうる
+// 値を取り出す前に型と大きさを確かめ、合わなければ none（false）を返して、そのファイルを読み込まない
+namespace LevelJSON
+{
+	// [a, b, ...]（N 個の数）を読む
+	template <size_t N>
+	[[nodiscard]]
+	inline Optional<std::array<double, N>> Numbers(const JSON& json)
+	{
+		if ((not json.isArray()) || (json.size() != N))
+		{
+			return none;
+		}
+
+		std::array<double, N> values{};
+
+		for (size_t i = 0; i < N; ++i)
+		{
+			if (not json[i].isNumber())
+			{
+				return none;
+			}
+
+			values[i] = json[i].get<double>();
+		}
+
+		return values;
+	}
+
+	[[nodiscard]]
+	inline Optional<Vec2> ReadVec2(const JSON& json)
+	{
+		if (const auto v = Numbers<2>(json))
+		{
+			return Vec2{ (*v)[0], (*v)[1] };
+		}
+
+		return none;
+	}
+
+	[[nodiscard]]
+	inline Optional<Line> ReadLine(const JSON& json)
+	{
+		if (const auto v = Numbers<4>(json))
+		{
+			return Line{ (*v)[0], (*v)[1], (*v)[2], (*v)[3] };
+		}
+
+		return none;
+	}
+
+	[[nodiscard]]
+	inline Optional<RectF> ReadRect(const JSON& json)
+	{
+		if (const auto v = Numbers<4>(json))
+		{
+			return RectF{ (*v)[0], (*v)[1], (*v)[2], (*v)[3] };
+		}
+
+		return none;
+	}
+
+	// json[key] の配列の要素ごとに read(要素) を呼ぶ（キーがなければ何もしない）
+	// 配列でないか、read が false を返したら false を返す
+	template <class Read>
+	[[nodiscard]]
+	inline bool ForEach(const JSON& json, StringView key, Read read)
+	{
+		if (not json.hasElement(key))
+		{
+			return true;
+		}
+
+		const JSON array = json[key];
+
+		if (not array.isArray())
+		{
+			return false;
+		}
+
+		for (const auto& element : array.arrayView())
+		{
+			if (not read(element))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+// 1 チャンク分の地面のデータ
+struct ChunkData
+{
+	Point coord{ 0, 0 };
+	Array<Line> lines;
+	Array<LineString> lineStrings;
+	Array<RectF> rects;
+
+	// このチャンクの地面までの距離場（設置物が地面に重なっていないかの判定に使う）
+	DistanceField field;
+
+	// JSON ファイルから読み込み、距離場を作る（別スレッドから呼んでもよい）
+	// 読めない・形式が合わないファイルは none を返す（ホットリロードでは以前のデータを使い続ける）
+	[[nodiscard]]
+	static Optional<ChunkData> Load(const FilePath& path, const Point& coord)
+	{
+		const JSON json = LoadJSON(path);
+
+		if ((not json) || (not json.isObject()))
+		{
+			return none;
+		}
+
+		ChunkData data;
+		data.coord = coord;
+
+		const bool valid = LevelJSON::ForEach(json, U"lines", [&](const JSON& line)
+			{
+				if (const auto value = LevelJSON::ReadLine(line))
+				{
+					data.lines << *value;
+					return true;
+				}
+
+				return false;
+			})
+			&& LevelJSON::ForEach(json, U"lineStrings", [&](const JSON& lineString)
+			{
+				if (not lineString.isArray())
+				{
+					return false;
+				}
+
+				LineString points;
+
+				for (const auto& point : lineString.arrayView())
+				{
+					const auto value = LevelJSON::ReadVec2(point);
+
+					if (not value)
+					{
+						return false;
+					}
+
+					points << *value;
+				}
+
+				data.lineStrings << points;
+				return true;
+			})
+			&& LevelJSON::ForEach(json, U"rects", [&](const JSON& rect)
+			{
+				if (const auto value = LevelJSON::ReadRect(rect))
+				{
+					data.rects << *value;
+					return true;
+				}
+
+				return false;
+			});
+
+		if (not valid)
+		{
+			return none;
+		}
+
+		data.field = DistanceField::Build(data.lines, data.lineStrings, data.rects);
+		return data;
+	}
+};
+
+// レベル全体の情報（level.json）
+struct LevelInfo
+{
+	FilePath directory;
+
+	// チャンク 1 辺の長さ
+	double chunkSize = 1024.0;
+
+	// カメラの初期位置
+	Vec2 cameraCenter{ 0, -300 };
+
+	// 針の出現位置
+	Array<Vec2> needles;
+
+	// ゴールや落下判定の領域
+	Array<TriggerRegion> triggers;
+
+	// データが存在するチャンク
+	HashSet<Point> chunks;
+
+	// 読めない・形式が合わないファイルは none を返す
+	[[nodiscard]]
+	static Optional<LevelInfo> Load(const FilePath& directory)
+	{
+		const JSON json = LoadJSON(FileSystem::PathAppend(directory, U"level.json"));
+
+		if ((not json) || (not json.isObject()))
+		{
+			return none;
+		}
+
+		LevelInfo info;
+		info.directory = directory;
+
+		if (json.hasElement(U"chunkSize"))
+		{
+			const JSON chunkSize = json[U"chunkSize"];
+
+			if ((not chunkSize.isNumber()) || (not (0.0 < chunkSize.get<double>())))
+			{
+				return none;
+			}
+
+			info.chunkSize = chunkSize.get<double>();
+		}
+
+		if (json.hasElement(U"camera"))
+		{
+			const auto camera = LevelJSON::ReadVec2(json[U"camera"]);
+
+			if (not camera)
+			{
+				return none;
+			}
+
+			info.cameraCenter = *camera;
+		}
+
+		const bool valid = LevelJSON::ForEach(json, U"needles", [&](const JSON& needle)
+			{
+				if (const auto value = LevelJSON::ReadVec2(needle))
+				{
+					info.needles << *value;
+					return true;
+				}
+
+				return false;
+			})
+			&& LevelJSON::ForEach(json, U"triggers", [&](const JSON& trigger)
+			{
+				if ((not trigger.isObject()) || (not trigger.hasElement(U"kind")) || (not trigger.hasElement(U"rect"))
+					|| (not trigger[U"kind"].isString()))
+				{
+					return false;
+				}
+
+				const auto rect = LevelJSON::ReadRect(trigger[U"rect"]);
+
+				if (not rect)
+				{
+					return false;
+				}
+
+				info.triggers << TriggerRegion{ ((trigger[U"kind"].getString() == U"kill") ? TriggerKind::Kill : TriggerKind::Goal), *rect };
+				return true;
+			})
+			&& LevelJSON::ForEach(json, U"chunks", [&](const JSON& chunk)
+			{
+				const auto value = LevelJSON::ReadVec2(chunk);
+
+				if (not value)
+				{
+					return false;
+				}
+
+				info.chunks.emplace(static_cast<int32>(value->x), static_cast<int32>(value->y));
+				return true;
+			});
+
+		if (not valid)
+		{
+			return none;
+		}
+
+		return info;
+	}
+
+	[[nodiscard]]
+	FilePath chunkPath(const Point& coord) const
+	{
+		return FileSystem::PathAppend(directory, U"chunk_{}_{}.json"_fmt(coord.x, coord.y));
+	}
+
+	// ワールド座標 pos を含むチャンク
+	[[nodiscard]]
+	Point chunkAt(const Vec2& pos) const
+	{
+		return Point{ static_cast<int32>(Floor(pos.x / chunkSize)), static_cast<int32>(Floor(pos.y / chunkSize)) };
+	}
+};
+
+// カメラの移動に合わせてチャンクを P2World に読み込み・破棄する
+class ChunkedWorld
+{
+public:
+
+	// 読み込んだまま保持するチャンクデータの最大数（P2World に入っているチャンクは除く）
+	static constexpr size_t CacheCapacity = 32;
+
+	ChunkedWorld() = default;
+
+	ChunkedWorld(P2World& world, const LevelInfo& info)
+		: m_world{ &world }
+		, m_info{ info } {}
+
+	// viewRegion: カメラに映っている範囲, focusPoints: 周囲の地面が必要な位置（動く物体など）
+	void update(const RectF& viewRegion, const Array<Vec2>& focusPoints = {})
+	{
+		const double chunkSize = m_info.chunkSize;
+
+		// 読み込みの終わった先読みを回収する
+		for (auto it = m_pending.begin(); it != m_pending.end();)
+		{
+			if (it->second.isReady())
+			{
+				if (auto data = it->second.get())
+				{
+					storeCache(std::make_shared<const ChunkData>(std::move(*data)));
+				}
+
+				m_pending.erase(it++);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		// 必要なチャンク：画面の少し外側までと、動く物体のいるチャンク
+		HashSet<Point> required;
+		addChunksIn(required, viewRegion.stretched(chunkSize * 0.25));
+
+		for (const auto& pos : focusPoints)
+		{
+			const Point coord = m_info.chunkAt(pos);
+
+			if (m_info.chunks.contains(coord))
+			{
+				required.insert(coord);
+			}
+		}
+
+		for (const auto& coord : required)
+		{
+			if (not m_loaded.contains(coord))
+			{
+				loadChunk(coord);
+			}
+		}
+
+		// 画面から十分に離れたチャンクを破棄する（境界で読み込みと破棄を繰り返さないよう余裕を持たせる）
+		HashSet<Point> keep;
+		addChunksIn(keep, viewRegion.stretched(chunkSize * 0.75));
+
+		for (auto it = m_loaded.begin(); it != m_loaded.end();)
+		{
+			if (keep.contains(it->first) || required.contains(it->first))
+			{
+				++it;
+			}
+			else
+			{
+				storeCache(it->second.data);
+				m_loaded.erase(it++);
+				++m_stats.unloads;
+				++m_revision;
+			}
+		}
+
+		// 1 チャンク先までを別スレッドで先読みする
+		HashSet<Point> prefetch;
+		addChunksIn(prefetch, viewRegion.stretched(chunkSize * 1.25));
+
+		for (const auto& coord : prefetch)
+		{
+			if (m_loaded.contains(coord) || m_cache.contains(coord) || m_pending.contains(coord))
+			{
+				continue;
+			}
+
+			m_pending.emplace(coord, Async(ChunkData::Load, m_info.chunkPath(coord), coord));
+			++m_stats.prefetches;
+		}
+	}
+
+	// 読み込まれているチャンクの地面を描く
+	void draw(const ColorF& color) const
+	{
+		for (const auto& chunk : m_loaded)
+		{
+			for (const auto& body : chunk.second.bodies)
+			{
+				body.draw(color);
+			}
+		}
+	}
+
+	struct Stats
+	{
+		// 先読みを開始した回数
+		size_t prefetches = 0;
+
+		// 先読みが間に合わず、その場で読み込んだ回数
+		size_t syncLoads = 0;
+
+		size_t loads = 0;
+		size_t unloads = 0;
+	};
+
+	[[nodiscard]]
+	const Stats& stats() const noexcept
+	{
+		return m_stats;
+	}
+
+	// 読み込まれているチャンクの地面までの符号付き距離（近くのチャンクの距離場の最小値）
+	// 設置物を置く画面の周りのチャンクは常に読み込まれているので、読み込まれていないチャンクは見ない
+	[[nodiscard]]
+	double groundDistance(const Vec2& pos) const
+	{
+		// 距離場はチャンクの外に MaxDistance まではみ出すので、その範囲にかかるチャンクを調べる
+		const int32 reach = static_cast<int32>(Ceil(DistanceField::MaxDistance / m_info.chunkSize));
+		const Point center = m_info.chunkAt(pos);
+		double distance = DistanceField::MaxDistance;
+
+		for (int32 y = (center.y - reach); y <= (center.y + reach); ++y)
+		{
+			for (int32 x = (center.x - reach); x <= (center.x + reach); ++x)
+			{
+				if (const auto it = m_loaded.find(Point{ x, y }); it != m_loaded.end())
+				{
+					distance = Min(distance, it->second.data->field.distance(pos));
+				}
+			}
+		}
+
+		return distance;
+	}
+
+	// 円・四角形が、読み込まれているチャンクの地面に重ならないか
+	[[nodiscard]]
+	bool isGroundFree(const Circle& circle) const
+	{
+		return DistanceField::IsFree(circle, [this](const Vec2& pos) { return groundDistance(pos); });
+	}
+
+	[[nodiscard]]
+	bool isGroundFree(const RectF& rect) const
+	{
+		return DistanceField::IsFree(rect, [this](const Vec2& pos) { return groundDistance(pos); });
+	}
+
+	// 保持しているチャンクの距離場のメモリ使用量 [バイト]
+	[[nodiscard]]
+	size_t fieldMemoryUsage() const
+	{
+		size_t bytes = 0;
+
+		for (const auto& [coord, chunk] : m_loaded)
+		{
+			bytes += chunk.data->field.memoryUsage();
+		}
+
+		for (const auto& [coord, data] : m_cache)
+		{
+			bytes += data->field.memoryUsage();
+		}
+
+		return bytes;
+	}
+
+	// P2World に入っているチャンクが変わるたびに増える番号
+	[[nodiscard]]
+	uint64 revision() const noexcept
+	{
+		return m_revision;
+	}
+
+	[[nodiscard]]
+	size_t loadedChunkCount() const noexcept
+	{
+		return m_loaded.size();
+	}
+
+	[[nodiscard]]
+	size_t cachedChunkCount() const noexcept
+	{
+		return m_cache.size();
+	}
+
+	// P2World に入っているチャンクのデータ（書き換えないので、別のスレッドに渡してもよい）
+	[[nodiscard]]
+	Array<std::shared_ptr<const ChunkData>> loadedChunks() const
+	{
+		Array<std::shared_ptr<const ChunkData>> chunks;
+		chunks.reserve(m_loaded.size());
+
+		for (const auto& [coord, chunk] : m_loaded)
+		{
+			chunks << chunk.data;
+		}
+
+		return chunks;
+	}
+
+	[[nodiscard]]
+	const LevelInfo& info() const noexcept
+	{
+		return m_info;
+	}
+
+	// ホットリロードの結果
+	struct ReloadReport
+	{
+		// 作り直したチャンクの数
+		size_t rebuiltChunks = 0;
+
+		// 作り直した物理ボディの数
+		size_t createdBodies = 0;
+
+		// 読み込みに失敗したファイルの数（書き込み途中など。以前のデータを使い続ける）
+		size_t failedFiles = 0;
+	};
+
+	// 変更されたチャンクのファイルを読み直し、P2World に入っているチャンクはその物理ボディだけを作り直す
+	void reloadChunks(const HashSet<Point>& coords, ReloadReport& report)
+	{
+		for (const auto& coord : coords)
+		{
+			discardCached(coord);
+
+			const FilePath path = m_info.chunkPath(coord);
+
+			if (not FileSystem::Exists(path))
+			{
+				// 削除されたチャンク
+				m_info.chunks.erase(coord);
+				m_loaded.erase(coord);
+				++m_revision;
+				continue;
+			}
+
+			auto loaded = ChunkData::Load(path, coord);
+
+			if (not loaded)
+			{
+				++report.failedFiles;
+				continue;
+			}
+
+			m_info.chunks.insert(coord);
+			const auto data = std::make_shared<const ChunkData>(std::move(*loaded));
+
+			if (auto it = m_loaded.find(coord); it != m_loaded.end())
+			{
+				// 古い物理ボディを先に破棄してから作り直す
+				it->second.bodies.clear();
+				it->second = createBodies(data);
+				report.createdBodies += it->second.bodies.size();
+				++report.rebuiltChunks;
+				++m_revision;
+			}
+			else
+			{
+				storeCache(data);
+			}
+		}
+	}
+
+	// level.json の変更を反映する（チャンクの大きさが変わったときは、すべてのチャンクを作り直す）
+	void reloadInfo(const LevelInfo& info, ReloadReport& report)
+	{
+		if (info.chunkSize != m_info.chunkSize)
+		{
+			report.rebuiltChunks += m_loaded.size();
+			m_loaded.clear();
+			++m_revision;
+			m_cache.clear();
+			m_cacheOrder.clear();
+			m_pending.clear();
+		}
+		else
+		{
+			// 一覧から消えたチャンクを破棄する
+			for (auto it = m_loaded.begin(); it != m_loaded.end();)
+			{
+				if (info.chunks.contains(it->first))
+				{
+					++it;
+				}
+				else
+				{
+					discardCached(it->first);
+					m_loaded.erase(it++);
+					++m_revision;
+				}
+			}
+		}
+
+		// 新しく必要になったチャンクは次の update() で読み込まれる
+		m_info = info;
+	}
+
+private:
+
+	struct LoadedChunk
+	{
+		std::shared_ptr<const ChunkData> data;
+		Array<P2Body> bodies;
+	};
+
+	P2World* m_world = nullptr;
+	LevelInfo m_info;
+	HashTable<Point, LoadedChunk> m_loaded;
+	uint64 m_revision = 0;
+	HashTable<Point, std::shared_ptr<const ChunkData>> m_cache;
+
+	// キャッシュに入れた順（古いものから破棄する）
+	Array<Point> m_cacheOrder;
+
+	HashTable<Point, AsyncTask<Optional<ChunkData>>> m_pending;
+	Stats m_stats;
+
+	// region と重なる、データの存在するチャンクを out に加える
+	void addChunksIn(HashSet<Point>& out, const RectF& region) const
+	{
+		const Point tl = m_info.chunkAt(region.tl());
+		const Point br = m_info.chunkAt(region.br());
+
+		for (int32 y = tl.y; y <= br.y; ++y)
+		{
+			for (int32 x = tl.x; x <= br.x; ++x)
+			{
+				if (m_info.chunks.contains(Point{ x, y }))
+				{
+					out.emplace(x, y);
+				}
+			}
+		}
+	}
+
+	void storeCache(const std::shared_ptr<const ChunkData>& data)
+	{
+		if (not m_cache.contains(data->coord))
+		{
+			m_cacheOrder << data->coord;
+		}
+
+		m_cache[data->coord] = data;
+
+		while (m_cacheOrder.size() > CacheCapacity)
+		{
+			m_cache.erase(m_cacheOrder.front());
+			m_cacheOrder.pop_front();
+		}
+	}
+
+	void loadChunk(const Point& coord)
+	{
+		std::shared_ptr<const ChunkData> data;
+
+		if (auto it = m_cache.find(coord); it != m_cache.end())
+		{
+			data = it->second;
+			m_cache.erase(it);
+			m_cacheOrder.remove(coord);
+		}
+		else
+		{
+			// 先読みが間に合わなかった：読み込み中ならその完了を、そうでなければその場で読み込む
+			Optional<ChunkData> loaded;
+
+			if (auto pending = m_pending.find(coord); pending != m_pending.end())
+			{
+				loaded = pending->second.get();
+				m_pending.erase(pending);
+			}
+			else
+			{
+				loaded = ChunkData::Load(m_info.chunkPath(coord), coord);
+			}
+
+			++m_stats.syncLoads;
+
+			if (not loaded)
+			{
+				return;
+			}
+
+			data = std::make_shared<const ChunkData>(std::move(*loaded));
+		}
+
+		LoadedChunk chunk = createBodies(data);
+
+		m_loaded.emplace(coord, std::move(chunk));
+		++m_stats.loads;
+		++m_revision;
+	}
+
+	// チャンクのデータから静的な物理ボディを作る
+	[[nodiscard]]
+	LoadedChunk createBodies(const std::shared_ptr<const ChunkData>& data)
+	{
+		LoadedChunk chunk{ data, {} };
+
+		for (const auto& line : data->lines)
+		{
+			chunk.bodies << m_world->createLine(P2Static, Vec2{ 0, 0 }, line);
+		}
+
+		for (const auto& lineString : data->lineStrings)
+		{
+			chunk.bodies << m_world->createLineString(P2Static, Vec2{ 0, 0 }, lineString);
+		}
+
+		for (const auto& rect : data->rects)
+		{
+			chunk.bodies << m_world->createRect(P2Static, rect.center(), rect.size);
+		}
+
+		return chunk;
+	}
+
+	// チャンクの古いデータ（キャッシュと読み込み中の先読み）を捨てる
+	void discardCached(const Point& coord)
+	{
+		if (m_cache.erase(coord))
+		{
+			m_cacheOrder.remove(coord);
+		}
+
+		m_pending.erase(coord);
+	}
+};
+
+// レベルデータのフォルダを監視し、変更のあったファイルをまとめて返す
+class LevelWatcher
+{
+public:
+
+	// 1 回の retrieve() で見つかった変更
+	struct Changes
+	{
+		// level.json が変更された
+		bool levelChanged = false;
+
+		// 変更・追加・削除されたチャンク
+		HashSet<Point> chunks;
+
+		[[nodiscard]]
+		explicit operator bool() const noexcept
+		{
+			return (levelChanged || (not chunks.empty()));
+		}
+	};
+
+	LevelWatcher() = default;
+
+	explicit LevelWatcher(const FilePath& directory)
+		: m_watcher{ directory } {}
+
+	[[nodiscard]]
+	Changes retrieve()
+	{
+		Changes changes;
+
+		if (not m_watcher)
+		{
+			return changes;
+		}
+
+		// 1 回の保存で複数の通知が来ることがあるため、ファイルごとにまとめる
+		for (const auto& change : m_watcher.retrieveChanges())
+		{
+			const String name = FileSystem::BaseName(change.path);
+
+			if (name == U"level")
+			{
+				changes.levelChanged = true;
+			}
+			else if (const auto coord = ParseChunkName(name))
+			{
+				changes.chunks.insert(*coord);
+			}
+		}
+
+		return changes;
+	}
+
+private:
+
+	DirectoryWatcher m_watcher;
+
+	// "chunk_<x>_<y>" からチャンクの座標を取り出す
+	[[nodiscard]]
+	static Optional<Point> ParseChunkName(const String& name)
+	{
+		const Array<String> parts = name.split(U'_');
+
+		if ((parts.size() != 3) || (parts[0] != U"chunk"))
+		{
+			return none;
+		}
+
+		const auto x = ParseOpt<int32>(parts[1]);
+		const auto y = ParseOpt<int32>(parts[2]);
+
+		if (not (x && y))
+		{
+			return none;
+		}
+
+		return Point{ *x, *y };
+	}
+};
@@ -0,0 +1,203 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "AssetPack.hpp"
+
+// 画面に出す文字列の番号（lang/<言語>.json のキーと同じ順）
+enum class TextID : uint16
+{
+	Title,
+	Credit,
+	Tutorial,
+	Stage1,
+	Stage2,
+	Stage3,
+	BackMenu,
+	ReSet,
+	Clear,
+	Failed,
+	CreditPlanner,
+	CreditProgrammer,
+	CreditAssets,
+	SampleLine,
+	Language,
+	StatsAttempts,
+	StatsClears,
+	StatsBest,
+	TutorialWatch,
+	TutorialRetry,
+	TutorialPlace,
+	TutorialGoal,
+	TutorialDone,
+	Count,
+};
+
+// 言語ごとの文字列表
+//
+// lang/<言語>.json   … キーと文字列の表（手で編集する）
+// lang/<言語>.glyphs … その言語で使う文字の一覧。--glyph-coverage で文字列表から作る
+//
+// 文字列は番号で配列を引くだけで取り出せる。言語を切り替えたら、フォントに文字の一覧を渡して
+// 使う文字のグリフをあらかじめ作っておき、描画中にグリフの生成が起きないようにする
+class Localization
+{
+public:
+
+	// 対応する言語（先頭が既定）
+	static constexpr std::array<StringView, 2> Languages{ U"ja", U"en" };
+
+	// 文字列表のキー（TextID の順）
+	static constexpr std::array<StringView, FromEnum(TextID::Count)> Keys{
+		U"title",
+		U"credit",
+		U"tutorial",
+		U"stage1",
+		U"stage2",
+		U"stage3",
+		U"back_menu",
+		U"reset",
+		U"clear",
+		U"failed",
+		U"credit_planner",
+		U"credit_programmer",
+		U"credit_assets",
+		U"sample_line",
+		U"language",
+		U"stats_attempts",
+		U"stats_clears",
+		U"stats_best",
+		U"tutorial_watch",
+		U"tutorial_retry",
+		U"tutorial_place",
+		U"tutorial_goal",
+		U"tutorial_done",
+	};
+
+	// 言語を切り替える。文字列表が読めなければ false を返し、今の言語のままにする
+	bool setLanguage(StringView language)
+	{
+		const JSON json = LoadJSON(U"lang/{}.json"_fmt(language));
+
+		if (not json)
+		{
+			return false;
+		}
+
+		// 表にないキーはキーの名前のまま表示する
+		for (size_t i = 0; i < Keys.size(); ++i)
+		{
+			m_texts[i] = (json.hasElement(Keys[i]) ? json[Keys[i]].getString() : String{ Keys[i] });
+		}
+
+		m_language = language;
+		m_glyphs = LoadGlyphs(language);
+		++m_revision;
+		return true;
+	}
+
+	// 次の言語に切り替える
+	void cycleLanguage()
+	{
+		const auto it = std::find(Languages.begin(), Languages.end(), StringView{ m_language });
+		const size_t index = ((it == Languages.end()) ? 0 : ((it - Languages.begin() + 1) % Languages.size()));
+		setLanguage(Languages[index]);
+	}
+
+	[[nodiscard]]
+	const String& operator ()(TextID id) const noexcept
+	{
+		return m_texts[FromEnum(id)];
+	}
+
+	[[nodiscard]]
+	const String& language() const noexcept
+	{
+		return m_language;
+	}
+
+	// 言語を切り替えるたびに増える番号（文字列から作ったものを作り直す判定に使う）
+	[[nodiscard]]
+	uint32 revision() const noexcept
+	{
+		return m_revision;
+	}
+
+	// 今の言語で使う文字のグリフを font にあらかじめ作らせる
+	void preload(const Font& font) const
+	{
+		font.preload(m_glyphs);
+	}
+
+	// 文字列表から文字の一覧を作って lang/<言語>.glyphs に書き出す
+	static bool BuildGlyphCoverage(StringView language)
+	{
+		const JSON json = JSON::Load(U"lang/{}.json"_fmt(language));
+
+		if (not json)
+		{
+			Console << U"glyphs: failed to load lang/{}.json"_fmt(language);
+			return false;
+		}
+
+		// 数字や記号を表示することもあるので、ASCII の表示可能な文字はすべて含める
+		String glyphs;
+
+		for (char32 ch = U'!'; ch <= U'~'; ++ch)
+		{
+			glyphs << ch;
+		}
+
+		for (const auto& key : Keys)
+		{
+			if (json.hasElement(key))
+			{
+				glyphs.append(json[key].getString());
+			}
+		}
+
+		glyphs.erase(std::remove_if(glyphs.begin(), glyphs.end(), [](char32 ch) { return IsSpace(ch); }), glyphs.end());
+		std::sort(glyphs.begin(), glyphs.end());
+		glyphs.erase(std::unique(glyphs.begin(), glyphs.end()), glyphs.end());
+
+		TextWriter writer{ U"lang/{}.glyphs"_fmt(language) };
+
+		if (not writer)
+		{
+			return false;
+		}
+
+		writer.writeln(glyphs);
+		Console << U"glyphs: {} ({} characters)"_fmt(language, glyphs.size());
+		return true;
+	}
+
+private:
+
+	std::array<String, FromEnum(TextID::Count)> m_texts;
+	String m_language;
+	String m_glyphs;
+	uint32 m_revision = 0;
+
+	[[nodiscard]]
+	static String LoadGlyphs(StringView language)
+	{
+		const FilePath path = U"lang/{}.glyphs"_fmt(language);
+
+		if (HasLooseFile(path))
+		{
+			TextReader reader{ path };
+			return reader.readAll().trimmed();
+		}
+
+		if (const auto data = GameAssets().read(path))
+		{
+			return Unicode::FromUTF8(std::string_view{ reinterpret_cast<const char*>(data->data()), data->size() }).trimmed();
+		}
+
+		if (TextReader reader{ path })
+		{
+			return reader.readAll().trimmed();
+		}
+
+		return String{};
+	}
+};
@@ -1,12 +1,71 @@
 #include <Siv3D.hpp>
+#include "StaticTextBlock.hpp"
+#include "InputQueue.hpp"
+#include "FramePacing.hpp"
+#include "LevelStreaming.hpp"
+#include "ParticleSystem.hpp"
+#include "SceneCache.hpp"
+#include "Telemetry.hpp"
+#include "PhysicsTrace.hpp"
+#include "Benchmark.hpp"
+#include "TextureAtlas.hpp"
+#include "TrajectoryPredictor.hpp"
+#include "AssetPack.hpp"
+#include "Localization.hpp"
+#include "TaskGraph.hpp"
+#include "PlacementHistory.hpp"
+#include "DistanceField.hpp"
+#include "SoundEffects.hpp"
+#include "GhostRun.hpp"
+#include "AttemptStats.hpp"
+#include "Script.hpp"
+#include "DrawList.hpp"
+#include "PhysicsIslands.hpp"
+
+# if GAME_BENCHMARK
+
+// GPU のない環境でも動くよう、描画をしない
+SIV3D_SET(EngineOption::Renderer::Headless)
+
+// メモリ確保の回数を数える
+void* operator new(size_t size)
+{
+	AllocationCounter::Add();
 
-// シーン間で共有するデータ
-struct GameData
+	if (void* p = std::malloc(size ? size : 1))
+	{
+		return p;
+	}
+
+	throw std::bad_alloc{};
+}
+
+void* operator new[](size_t size)
 {
-	bool unlockedStage1 = false;
-	bool unlockedStage2 = false;
-	bool unlockedStage3 = false;
-};
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+# endif
 
 // シーンのキー
 enum class State
@@ -19,12 +78,98 @@ enum class State
 	Stage3,
 };
 
+// シーン間で共有するデータ
+struct GameData
+{
+	bool unlockedStage1 = false;
+	bool unlockedStage2 = false;
+	bool unlockedStage3 = false;
+
+	// フレームとは独立にサンプリングした入力イベント
+	InputQueue input;
+
+	// フレームレートの制御と処理時間の計測
+	FramePacer pacer;
+
+	// 離れたシーンの中身を預かり、戻ってきたときに再利用する
+	SceneCache<State> sceneCache;
+
+	// プレイセッションの計測データ
+	TelemetryLog telemetry;
+
+	// 1 フレームの処理の区分ごとの CPU 時間
+	FrameProfiler profiler;
+
+	// シーンが描くものを記録し、並べ替えてまとめて描く
+	DrawList draw;
+
+	// 物理演算の島を並列に進めるスレッド（--physics-threads=N、0 で並列にしない）
+	std::unique_ptr<WorkStealingPool> physicsPool;
+
+	// 物理イベントから鳴らす効果音
+	SoundEffects sound;
+
+	// ステージごとの挑戦の統計
+	AttemptStats stats;
+
+	// 画面に出す文字列
+	Localization text;
+
+	// 起動時に読み込むもの
+	// タイトルなどで使う UI のフォント
+	Font font;
+
+	// ステージのスプライト
+	TextureAtlas atlas;
+
+	// 各ステージのレベルデータ（キーはレベルデータのフォルダ）
+	HashTable<FilePath, LevelInfo> levels;
+};
+
+// 進み具合の保存先
+const FilePath ProgressPath = U"save/progress.json";
+
+// 保存した進み具合を読み込む
+void LoadProgress(GameData& data)
+{
+	const JSON json = JSON::Load(ProgressPath);
+
+	if (not json)
+	{
+		return;
+	}
+
+	data.unlockedStage1 = (json.hasElement(U"unlockedStage1") && json[U"unlockedStage1"].get<bool>());
+	data.unlockedStage2 = (json.hasElement(U"unlockedStage2") && json[U"unlockedStage2"].get<bool>());
+	data.unlockedStage3 = (json.hasElement(U"unlockedStage3") && json[U"unlockedStage3"].get<bool>());
+}
+
+// 進み具合を保存する
+void SaveProgress(const GameData& data)
+{
+	JSON json;
+	json[U"unlockedStage1"] = data.unlockedStage1;
+	json[U"unlockedStage2"] = data.unlockedStage2;
+	json[U"unlockedStage3"] = data.unlockedStage3;
+	json.save(ProgressPath);
+}
+
 // 抽象的なインターフェース（ドラッグ可能なオブジェクトの共通機能）
 struct IDraggable
 {
-	virtual void update() = 0;
-	virtual void draw() const = 0;
+	// 入力イベントを 1 つ受け取って状態を更新する
+	virtual void update(const InputEvent& event) = 0;
+	virtual void draw(DrawList& list) const = 0;
 	virtual void reset() = 0;
+	// ドラッグ中か
+	virtual bool dragging() const = 0;
+	// 現在の形を加える（シーン座標）
+	virtual void addShape(PlacedShapes& shapes) const = 0;
+	// 置けない場所にあることを示す色で重ねて描く
+	virtual void drawInvalid(DrawList& list) const = 0;
+	// 中心の位置（シーン座標）
+	virtual Vec2 position() const = 0;
+	virtual void setPosition(const Vec2& center) = 0;
 	virtual ~IDraggable() = default;
 };
 
@@ -40,28 +185,28 @@ struct DraggableCircle : IDraggable
 	DraggableCircle(const Circle& c) : shape(c), initialShape(c) {}
 
 	//オブジェクトにマウスカーソルがあるか判断して動かす関数
-	void update() override
+	void update(const InputEvent& event) override
 	{
 		//マウスカーソルがオブジェクト内にありクリックされているかの判定
-		if (!isDragging && shape.contains(Cursor::Pos()) && MouseL.down())
+		if (!isDragging && (event.type == InputEventType::LeftDown) && shape.contains(event.pos))
 		{
 			isDragging = true;
-			dragOffset = Cursor::Pos() - shape.center;
+			dragOffset = event.pos - shape.center;
 		}
 		//クリック状態での処理
 		if (isDragging)
 		{
 			
 			//クリックを離した時
-			if (MouseL.up())
+			if (event.type == InputEventType::LeftUp)
 			{
 				isDragging = false;
 			}
 			
-			//クリックを押し続けている時
-			else
+			//カーソルが動いた時
+			else if (event.type == InputEventType::Move)
 			{
-				Vec2 newCenter = Cursor::Pos() - dragOffset;
+				Vec2 newCenter = event.pos - dragOffset;
 
 				// 画面内に収める制限（clamp(制限したい値、最小値の座標、最大値の座標）
 				const Rect sceneRect = Scene::Rect();
@@ -75,9 +220,9 @@ struct DraggableCircle : IDraggable
 	}
 	
 	//マウスカーソルがオブジェクト内にあるとき色をかえる関数
-	void draw() const override
+	void draw(DrawList& list) const override
 	{
-		shape.draw(shape.contains(Cursor::Pos()) ? ColorF(Palette::Skyblue, 0.5) : ColorF(Palette::Skyblue));
+		list.circle(DrawLayer::Objects, shape, (shape.contains(Cursor::Pos()) ? ColorF(Palette::Skyblue, 0.5) : ColorF(Palette::Skyblue)));
 	}
 	
 	//リセットするときの関数
@@ -85,6 +230,32 @@ struct DraggableCircle : IDraggable
 	{
 		shape = initialShape;
 	}
+
+	bool dragging() const override
+	{
+		return isDragging;
+	}
+
+	void addShape(PlacedShapes& shapes) const override
+	{
+		shapes.circles << shape;
+	}
+
+	void drawInvalid(DrawList& list) const override
+	{
+		list.circle(DrawLayer::Objects, shape, ColorF{ 1.0, 0.2, 0.2, 0.5 });
+		list.circleFrame(DrawLayer::Objects, shape, 3, ColorF{ 0.8, 0.0, 0.0 });
+	}
+
+	Vec2 position() const override
+	{
+		return shape.center;
+	}
+
+	void setPosition(const Vec2& center) override
+	{
+		shape.setCenter(center);
+	}
 };
 
 // 四角形の実装
@@ -97,23 +268,23 @@ struct DraggableRect : IDraggable
 
 	DraggableRect(const Rect& r) : shape(r), initialShape(r) {}
 
-	void update() override
+	void update(const InputEvent& event) override
 	{
-		if (!isDragging && shape.contains(Cursor::Pos()) && MouseL.down())
+		if (!isDragging && (event.type == InputEventType::LeftDown) && shape.contains(event.pos))
 		{
 			isDragging = true;
-			dragOffset = Cursor::Pos() - shape.center();
+			dragOffset = event.pos - shape.center();
 		}
 
 		if (isDragging)
 		{
-			if (MouseL.up())
+			if (event.type == InputEventType::LeftUp)
 			{
 				isDragging = false;
 			}
-			else
+			else if (event.type == InputEventType::Move)
 			{
-				Vec2 newCenter = Cursor::Pos() - dragOffset;
+				Vec2 newCenter = event.pos - dragOffset;
 				
 				// 画面内に収める制限
 				const Rect sceneRect = Scene::Rect();
@@ -126,15 +297,41 @@ struct DraggableRect : IDraggable
 		}
 	}
 	
-	void draw() const override
+	void draw(DrawList& list) const override
 	{
-		shape.draw(shape.contains(Cursor::Pos()) ? ColorF(Palette::Lightgreen, 0.5) : ColorF(Palette::Lightgreen));
+		list.rect(DrawLayer::Objects, shape, (shape.contains(Cursor::Pos()) ? ColorF(Palette::Lightgreen, 0.5) : ColorF(Palette::Lightgreen)));
 	}
 
 	void reset() override
 	{
 		shape = initialShape;
 	}
+
+	bool dragging() const override
+	{
+		return isDragging;
+	}
+
+	void addShape(PlacedShapes& shapes) const override
+	{
+		shapes.rects << RectF{ shape };
+	}
+
+	void drawInvalid(DrawList& list) const override
+	{
+		list.rect(DrawLayer::Objects, shape, ColorF{ 1.0, 0.2, 0.2, 0.5 });
+		list.rectFrame(DrawLayer::Objects, shape, 3, ColorF{ 0.8, 0.0, 0.0 });
+	}
+
+	Vec2 position() const override
+	{
+		return shape.center();
+	}
+
+	void setPosition(const Vec2& center) override
+	{
+		shape = Rect{ (center - shape.size / 2).asPoint(), shape.size };
+	}
 };
 
 // 物理エンジン
@@ -147,8 +344,8 @@ struct MyBody
 // GameManager の型エイリアス
 using App = SceneManager<State, GameData>;
 
-// カスタムボタン関数
-bool Button(const Rect& rect, const Font& font, const String& text, bool enabled)
+// カスタムボタン関数（描画は list に記録する）
+bool Button(DrawList& list, const Rect& rect, const Font& font, const String& text, bool enabled)
 {
 	// マウスカーソルがボタンの上にある場合
 	if (enabled && rect.mouseOver())
@@ -160,22 +357,20 @@ bool Button(const Rect& rect, const Font& font, const String& text, bool enabled
 	const RoundRect roundRect = rect.rounded(6);
 
 	// 影と背景を描く
-	roundRect
-		.drawShadow(Vec2{ 2, 2 }, 12, 0)
-		.draw(ColorF{ 1.0, 0.94, 0.60 });
+	list.roundRectShadow(DrawLayer::Content, roundRect, Vec2{ 2, 2 }, 12, 0);
+	list.roundRect(DrawLayer::Content, roundRect, ColorF{ 1.0, 0.94, 0.60 });
 
 	//　枠を描く
-	rect.stretched(-3).rounded(3)
-		.drawFrame(2, ColorF{ 0.4, 0.3, 0.2 });
+	list.roundRectFrame(DrawLayer::Content, rect.stretched(-3).rounded(3), 2, ColorF{ 0.4, 0.3, 0.2 });
 
-	// テキストを描く
-	font(text).drawAt(40, rect.center(), ColorF{ 0.4, 0.3, 0.2 });
+	// テキストを描く（同じ層の図形より後に描かれる）
+	list.textAt(DrawLayer::Content, font, text, 40, rect.center(), ColorF{ 0.4, 0.3, 0.2 });
 
 	// 無効の場合
 	if (!enabled)
 	{
-		// グレーの半透明を重ねる
-		roundRect.draw(ColorF{ 0.8, 0.8 });
+		// グレーの半透明を文字の上に重ねる
+		list.roundRect(DrawLayer::Overlay, roundRect, ColorF{ 0.8, 0.8 });
 		// ボタンが押せなくなる
 		return false;
 	}
@@ -198,36 +393,45 @@ public:
 
 	void update() override
 	{
+		const Localization& text = getData().text;
+
+		// 言語の切り替え
+		if (Button(getData().draw, Rect{ 590, 10, 200, 80 }, m_font, text(TextID::Language), true))
+		{
+			getData().text.cycleLanguage();
+			getData().text.preload(m_font);
+		}
+
 		// Credit
-		if (Button(Rect{ 10, 10, 150, 80 }, m_font, U"Credit", true))
+		if (Button(getData().draw, Rect{ 10, 10, 150, 80 }, m_font, text(TextID::Credit), true))
 		{
 			// Creditシーンに移動
 			changeScene(State::Credit);
 		}
 
 		// Tutorial
-		if (Button(Rect{ 270, 270, 250, 70 }, m_font, U"Tutorial", true))
+		if (Button(getData().draw, Rect{ 270, 270, 250, 70 }, m_font, text(TextID::Tutorial), true))
 		{
 			// チュートリアルのシーンに移動
 			changeScene(State::Tutorial);
 		}
 
 		// Stage1
-		if (Button(Rect{ 80, 400, 200, 80 }, m_font, U"Stage1", getData().unlockedStage1))
+		if (Button(getData().draw, Rect{ 80, 400, 200, 80 }, m_font, text(TextID::Stage1), getData().unlockedStage1))
 		{
 			// Stage1 シーンに移動
 			changeScene(State::Stage1);
 		}
 
 		// Stage2
-		if (Button(Rect{ 300, 400, 200, 80 }, m_font, U"Stage2", getData().unlockedStage2))
+		if (Button(getData().draw, Rect{ 300, 400, 200, 80 }, m_font, text(TextID::Stage2), getData().unlockedStage2))
 		{
 			// Stage2 シーンに移動
 			changeScene(State::Stage2);
 		}
 
 		// Stage3
-		if (Button(Rect{ 520, 400, 200, 80 }, m_font, U"Stage3", getData().unlockedStage3))
+		if (Button(getData().draw, Rect{ 520, 400, 200, 80 }, m_font, text(TextID::Stage3), getData().unlockedStage3))
 		{
 			// Stage3 シーンに移動
 			changeScene(State::Stage3);
@@ -236,15 +440,36 @@ public:
 
 	void draw() const override
 	{
+		const Localization& text = getData().text;
+		const AttemptStats& stats = getData().stats;
+
+		DrawList& list = getData().draw;
+
 		// タイトル
-		m_font(U"針落").draw(80, Vec2{ 320, 150 }, ColorF{ 0.2 });
+		list.text(DrawLayer::Content, m_font, text(TextID::Title), 80, Vec2{ 320, 150 }, ColorF{ 0.2 });
+
+		// 各ステージの最速クリア
+		for (const auto& [stage, x] : { std::pair{ State::Stage1, 180 }, std::pair{ State::Stage2, 400 }, std::pair{ State::Stage3, 620 } })
+		{
+			if (const double best = stats.stage(static_cast<uint8>(stage)).bestTime; 0.0 < best)
+			{
+				list.textAt(DrawLayer::Content, m_font, U"{} {:.2f}s"_fmt(text(TextID::StatsBest), best), 24, Vec2{ x, 500 }, ColorF{ 0.3 });
+			}
+		}
+
+		// これまでの挑戦の合計
+		const AttemptAggregate& total = stats.total();
+		list.textAt(DrawLayer::Content, m_font, U"{} {}   {} {}"_fmt(text(TextID::StatsAttempts), total.attempts, text(TextID::StatsClears), total.clears),
+			28, Vec2{ 400, 550 }, ColorF{ 0.3 });
 
-		// ボタンの描画は update() 内で完結しているため、ここでは何もしない
+		// update() で記録したボタンとまとめて描く
+		list.flush();
 	}
 
 private:
 
-	const Font m_font{ FontMethod::MSDF, 48, Typeface::Bold };
+	// 起動時に作ったフォント（グリフも用意済み）
+	const Font m_font = getData().font;
 };
 
 class Credit : public App::Scene
@@ -253,95 +478,282 @@ public:
 	
 	Credit(const InitData& init)
 	: IScene{ init }
+	, m_text{ m_font, {
+		{ getData().text(TextID::CreditPlanner), Vec2{ 80, 100 }, 32 },
+		{ U"Seiya", Vec2{ 100, 140 }, 32 },
+		{ getData().text(TextID::CreditProgrammer), Vec2{ 80, 200 }, 32 },
+		{ U"Seiya", Vec2{ 100, 240 }, 32 },
+		{ U"bukinyan", Vec2{ 200, 240 }, 32 },
+		{ U"kanaka", Vec2{ 350, 240 }, 32 },
+		{ getData().text(TextID::CreditAssets), Vec2{ 80, 300 }, 32 },
+		{ U"illustAC: https://www.ac-illust.com/", Vec2{ 100, 340 }, 32 },
+	} }
 	{
 		Scene::SetBackground(ColorF{ 0.7, 0.9, 1.0 });
+		getData().text.preload(m_font);
 	}
 	
 	void update() override
 	{
 		// 戻るボタン
-		if (Button(Rect{ 10, 10, 200, 70 }, m_font, U"BackMenu", true))
+		if (Button(getData().draw, Rect{ 10, 10, 200, 70 }, m_font, getData().text(TextID::BackMenu), true))
 		{
 			// タイトルシーンに戻る
 			changeScene(State::Title);
 		}
-		m_font(U"プランナー").draw(32, Vec2{ 80, 100 }, ColorF{ 0.0 });
-		m_font(U"Seiya").draw(32, Vec2{100, 140}, ColorF{ 0.0 });
-		m_font(U"プログラマー").draw(32, Vec2{ 80, 200 }, ColorF{ 0.0 });
-		m_font(U"Seiya").draw(32, Vec2{ 100, 240}, ColorF{ 0.0 });
-		m_font(U"bukinyan").draw(32, Vec2{ 200, 240 }, ColorF{ 0.0 });
-		m_font(U"kanaka").draw(32, Vec2{ 350, 240 }, ColorF{ 0.0 });
-		m_font(U"使用素材").draw(32, Vec2{ 80, 300 }, ColorF{ 0.0 });
-		m_font(U"illustAC: https://www.ac-illust.com/").draw(32, Vec2{ 100, 340 }, ColorF{ 0.0 });
+
+		// 拡大率が変わったときだけ焼き直す
+		m_text.update();
+	}
+
+	void draw() const override
+	{
+		// クレジット本文は焼き込み済みのテクスチャ 1 枚で描く
+		DrawList& list = getData().draw;
+		m_text.draw(list, DrawLayer::Content);
+		list.flush();
 	}
 private:
 	const Font m_font{ FontMethod::MSDF, 32 };
+	StaticTextBlock m_text;
 };
 
-// ステージ1
-class Tutorial : public App::Scene
+// ステージの中身（チュートリアルと各ステージで共通）
+// シーンを離れても SceneCache に預けて再利用できるよう、シーンのクラスとは分けている
+class Stage
 {
 public:
 
-	Tutorial(const InitData& init)
-		: IScene{ init }
-		, needle(U"example/needle.png")
+	// state: このステージのシーン
+	// info: レベルデータ（読み込めなかったら none）
+	// unlockTarget: 戻るボタンを押したときにアンロックするステージ（なければ nullptr）
+	// spriteAtlas: 針とパーティクルのスプライト
+	Stage(State state, const Optional<LevelInfo>& info, bool GameData::* unlockTarget, const TextureAtlas& spriteAtlas)
+		: atlas{ spriteAtlas }
+		, needle{ atlas.find(U"needle") }
 		, camera{ Vec2{0, -300 }, 1.0 }
 		, accumulatedTime(0.0)
+		, particles{ atlas(atlas.find(U"particle")) }
+		, m_state{ state }
+		, m_unlockTarget{ unlockTarget }
 	{
 		Scene::SetBackground(ColorF{ 0.7, 0.9, 1.0 });
-		// 表示するテキストの配列
-		for (int i = 0; i < 20; ++i)
-		{
-			lines << U"サンプル行 {}"_fmt(i + 1);
-		}
-		
+
 		// 円と四角形を追加
 		objects.push_back(std::make_shared<DraggableCircle>(Circle{ 105, 235, 40 }));
 		objects.push_back(std::make_shared<DraggableRect>(Rect{ 65, 340, 80, 80 }));
 		objects.push_back(std::make_shared<DraggableCircle>(Circle{ 105, 515, 60 }));
 		
-		// 物理ボディ
-		double radius = 10;
-		bodies << MyBody{
-			world.createRect(P2Dynamic, Vec2{-100, -300}, Vec2{10, 120}),
-			radius
-		};
+		// レベルデータ
+		if (info)
+		{
+			camera.jumpTo(info->cameraCenter, 1.0);
+
+			// 物理ボディ
+			spawnNeedles(info->needles);
+
+			// ゴールと落下判定の領域
+			triggers = TriggerIndex{ info->triggers };
+
+			// 地面はカメラの周囲のチャンクだけを読み込む
+			chunks = ChunkedWorld{ world, *info };
+			chunks.update(camera.getRegion(), bodyPositions());
+
+			// 実行中にレベルデータが編集されたら反映する
+			levelWatcher = LevelWatcher{ FileSystem::FullPath(info->directory) };
+
+			// これまでの速かった挑戦
+			loadGhosts();
+		}
 
-		// 地面
-		// grounds << world.createRect(P2Static, Vec2{ 0, -200 }, SizeF{ 600, 20 });
-		grounds << world.createLine(P2Static, Vec2{ 0, 0 }, Line{ -50, -150, -300, -50 });
-		grounds << world.createLineString(P2Static, Vec2{ 0, 0 },
-		LineString{ Vec2{ 100, -50 }, Vec2{ 200, -50 }, Vec2{ 600, -150 } });
+		beginRecording();
 	}
 
-	void update() override
+	// 言語に合わせて表示する文字列を作り直し、使う文字のグリフを用意する
+	void localize(const Localization& text)
+	{
+		if (m_textRevision == text.revision())
+		{
+			return;
+		}
+
+		// 表示するテキストの配列（チュートリアルは手順の字幕で説明するので、スクロールするテキストは出さない）
+		lines.clear();
+		if (m_state != State::Tutorial)
+		{
+			for (int i = 0; i < 20; ++i)
+			{
+				lines << U"{} {}"_fmt(text(TextID::SampleLine), i + 1);
+			}
+		}
+
+		text.preload(m_font);
+		text.preload(scrollFont);
+		m_textRevision = text.revision();
+	}
+
+	// キャッシュから取り出して再開するときに呼ぶ
+	void resume()
+	{
+		Scene::SetBackground(ColorF{ 0.7, 0.9, 1.0 });
+
+		// 中断していた間の時間で物理演算を進めない
+		accumulatedTime = 0.0;
+
+		m_attemptTime.restart();
+	}
+
+	// 物理演算を 1 ステップ進める
+	// 針が多いときは、触れ合わない針の集まり（島）ごとに pool のスレッドで並列に進める
+	// 島の分け方はスレッドの数によらないので、pool が nullptr でも同じ結果になる
+	void step(WorkStealingPool* pool = nullptr)
+	{
+		const auto toBody = [](const MyBody& b) -> const P2Body& { return b.body; };
+
+		if (bodies.size() < PhysicsIslands::MinBodies)
+		{
+			islands.clear();
+			world.update(StepTime);
+
+			// 新しく始まった接触と、トリガー領域への進入を集める（処理はフレームの終わりにまとめて行う）
+			events.collect(world, triggers, bodies, toBody);
+		}
+		else
+		{
+			islands.step(bodies, [](MyBody& b) -> P2Body& { return b.body; }, chunks, m_placed, NeedleSize, StepTime, pool);
+			events.collect(islands.collisions(), triggers, bodies, toBody);
+		}
+
+		// 落下判定の領域に入った物体は、次のステップより前に取り除く
+		for (const auto& trigger : events.stepTriggers())
+		{
+			if (trigger.kind == TriggerKind::Kill)
+			{
+				bodies.remove_if([&](const MyBody& b) { return (b.body.id() == trigger.body); });
+			}
+		}
+	}
+
+	// 動く物体の状態のハッシュ値（物理演算の決定性の確認用）
+	[[nodiscard]]
+	uint64 physicsHash() const
+	{
+		PhysicsHasher hasher;
+		hasher.add(bodies.size());
+
+		for (const auto& b : bodies)
+		{
+			hasher.add(b.body);
+		}
+
+		return hasher.value();
+	}
+
+	// 針の出現位置ごとに、columns x rows 本の針を格子状に並べて加える（混み合ったステージの確認用）
+	void addNeedleGrid(int32 columns, int32 rows)
+	{
+		Array<Vec2> positions;
+
+		for (const auto& origin : chunks.info().needles)
+		{
+			for (int32 y = 0; y < rows; ++y)
+			{
+				for (int32 x = 0; x < columns; ++x)
+				{
+					positions << (origin + Vec2{ ((x - columns / 2) * NeedleSize.x * 3), -(y * NeedleSize.y * 1.2) });
+				}
+			}
+		}
+
+		spawnNeedles(positions);
+	}
+
+	// 推定メモリ使用量 [バイト]（SceneCache の上限の判定に使う）
+	[[nodiscard]]
+	size_t memoryUsage() const
+	{
+		// フォントやバッファなどの固定分
+		size_t bytes = (1 << 20);
+		bytes += particles.memoryUsage();
+		bytes += atlas.memoryUsage();
+		bytes += chunks.fieldMemoryUsage();
+		bytes += history.memoryUsage();
+
+		for (const auto& ghost : m_ghosts)
+		{
+			bytes += ghost.run()->memoryUsage();
+		}
+		bytes += (bodies.size() * 1024);
+		bytes += ((chunks.loadedChunkCount() + chunks.cachedChunkCount()) * 16 * 1024);
+		return bytes;
+	}
+
+	// 手順（チュートリアルなど）を動かす。ステージの出来事を知らせる
+	[[nodiscard]]
+	ScriptRunner& scripts() noexcept
+	{
+		return m_scripts;
+	}
+
+	// 画面の上に出す案内（none で消す）
+	void setCaption(const Optional<TextID>& caption) noexcept
+	{
+		m_caption = caption;
+	}
+
+	// 強調して示す範囲（シーン座標、none で消す）
+	void setMarker(const Optional<RectF>& marker) noexcept
 	{
+		m_marker = marker;
+	}
+
+	// 設置物を置くとワールドに入る範囲（シーン座標）
+	[[nodiscard]]
+	static RectF WorldArea()
+	{
+		return RectF{ WorldAreaLeft, 0, (Scene::Width() - WorldAreaLeft), Scene::Height() };
+	}
+
+	// 1 フレーム分の更新と描画を行う。シーンを移る場合は移り先を返す
+	Optional<State> update(GameData& data)
+	{
+		Optional<State> nextScene;
+
 		// 戻るボタン
 		//　現在は戻るだけで次のボタンが押せるようになっている
-		if (Button(Rect{ 10, 10, 200, 70 }, m_font, U"BackMenu", true))
+		DrawList& list = data.draw;
+
+		if (Button(list, Rect{ 10, 10, 200, 70 }, m_font, data.text(TextID::BackMenu), true))
 		{
-			// Stage1 をアンロック
-			getData().unlockedStage1 = true;
+			// 次のステージをアンロック
+			if (m_unlockTarget)
+			{
+				data.*m_unlockTarget = true;
+			}
+			// 結果が出る前に抜けたことを記録する
+			// Stage はキャッシュに残って戻ってきたときに再開するので、同じ挑戦を二度数えないよう挑戦をやり直しておく
+			if (not m_outcome)
+			{
+				data.telemetry.push(TelemetryType::StageOutcome, FromEnum(m_state), FromEnum(TelemetryOutcome::Abandoned), m_attemptTime.sF());
+				recordAttempt(data, TelemetryOutcome::Abandoned);
+				restart();
+			}
 			// タイトルシーンに戻る
-			changeScene(State::Title);
+			nextScene = State::Title;
 		}
 		// リスタートボタン
-		if (Button(Rect{ 10, 90, 200, 70}, m_font, U"ReSet", true))
+		if (Button(list, Rect{ 10, 90, 200, 70}, m_font, data.text(TextID::ReSet), true))
 		{
-			// 処理内容
-			for (auto& obj : objects)
-			{
-				obj->reset();
-			}
+			// 設置物と針を初期状態に戻して挑戦し直す
+			restart();
 		}
 		// 設置物をおくところの背景
-		Rect{ 40, 170, 130, 130}.draw();
-		Rect{ 40, 310, 130, 130}.draw();
-		Rect{ 40, 450, 130, 130}.draw();
+		list.rect(DrawLayer::Background, Rect{ 40, 170, 130, 130});
+		list.rect(DrawLayer::Background, Rect{ 40, 310, 130, 130});
+		list.rect(DrawLayer::Background, Rect{ 40, 450, 130, 130});
 		
 		// 境界線ようの縦線
-		Rect{ 230, 0, 10, 600}.draw(ColorF{ 0 });
+		list.rect(DrawLayer::Background, Rect{ 230, 0, 10, 600}, ColorF{ 0 });
 
 		// --- スクロール関連の定数を計算 ---
 
@@ -407,805 +819,1679 @@ public:
 		// テキストを描画 (スクロール位置 scrollY を引くことで、表示位置を動かす)
 		for (int i = 0; i < lines.size(); ++i)
 		{
-			scrollFont(lines[i]).draw(250, 50 + i * 40 - scrollY);
+			list.text(DrawLayer::Content, scrollFont, lines[i], scrollFont.fontSize(), Vec2{ 250, 50 + i * 40 - scrollY });
 		}
 
 		// スクロールバーを描画 (コンテンツが画面より大きい場合のみ)
 		if (contentHeight > viewHeight)
 		{
 			// スクロールバーの背景(トラック)を灰色で描画
-			scrollbarArea.draw(ColorF(0.5));
+			list.rect(DrawLayer::Content, scrollbarArea, ColorF(0.5));
 			// つまみ(サム)を明るい灰色で描画
-			thumb.draw(ColorF(0.9));
+			list.rect(DrawLayer::Content, thumb, ColorF(0.9));
 		}
 		
-		// Rキーで初期位置に戻す
-		if (KeyR.down())
+		ClearPrint();
+
+		// 情報表示（島に分けて進めるほど多いときは、島ごとの時間を出す）
+		if (islands.isActive())
 		{
-			for (auto& obj : objects)
+			const PhysicsIslands::Stats& islandStats = islands.stats();
+			Print << U"Islands: {} ({} asleep, {} rebuilt), {:.3f} ms on {} threads (sum {:.3f} ms)"_fmt(islandStats.islands,
+				islandStats.sleeping, islandStats.rebuilt, islandStats.wallMs, islandStats.threads, islandStats.totalMs);
+
+			for (const auto& island : islandStats.slowest)
 			{
-				obj->reset();
+				Print << U"  island: {} bodies, {:.3f} ms"_fmt(island.bodies, island.ms);
 			}
 		}
-
-		// 更新と描画
-		for (auto& obj : objects)
+		else
 		{
-			obj->update();
-			obj->draw();
+			for (const auto& b : bodies)
+			{
+				Print << U"ID: {}, Pos: {:.1f}"_fmt(b.body.id(), b.body.getPos());
+			}
 		}
-		
-		ClearPrint();
 
-		// 情報表示
-		for (const auto& b : bodies)
+		// 前のフレームの描画の状態切り替えの回数（並べ替えなかった場合の回数）
+		const DrawStats& drawStats = list.lastFrame();
+		Print << U"Draw: {} commands, {} state changes ({} unsorted)"_fmt(drawStats.commands, drawStats.stateChanges, drawStats.unsortedStateChanges);
+
+		// テレメトリのリングバッファがあふれていたら知らせる
+		if (const uint64 dropped = data.telemetry.dropped())
 		{
-			Print << U"ID: {}, Pos: {:.1f}"_fmt(b.body.id(), b.body.getPos());
+			Print << U"Telemetry dropped: {}"_fmt(dropped);
 		}
 
 		// 物理更新
+		// 前フレーム以降の入力イベントは、発生時刻に対応する物理ステップの直前に順番どおり反映する
+		const InputQueue& input = data.input;
+		const Array<InputEvent>& events = input.events();
+		size_t nextEvent = 0;
+
 		accumulatedTime += Scene::DeltaTime();
-		while (accumulatedTime >= StepTime)
+
+		// 最初のステップが表す時刻（入力イベントと同じ時計）
+		double stepClock = (input.frameTime() - accumulatedTime);
+
+		uint32 steps = 0;
 		{
-			world.update(StepTime);
-			accumulatedTime -= StepTime;
+			const auto phase = data.profiler.scoped(FramePhase::Physics);
 
-			// 落下物の削除
-			for (size_t i = 0; i < bodies.size(); )
+			while (accumulatedTime >= StepTime)
 			{
-				if (bodies[i].body.getPos().y > 500)
+				stepClock += StepTime;
+				++steps;
+
+				for (; (nextEvent < events.size()) && (events[nextEvent].time <= stepClock); ++nextEvent)
 				{
-					bodies.remove_at(i);
+					handleInput(events[nextEvent]);
 				}
-				else
+
+				// 結果が決まるまで、一定のステップごとにゴーストのサンプルを記録する
+				if ((not m_outcome) && ((m_attemptSteps % GhostSampleSteps) == 0))
 				{
-					++i;
+					m_recorder.add(ghostFrame());
 				}
+
+				step(data.physicsPool.get());
+				++m_attemptSteps;
+				accumulatedTime -= StepTime;
+			}
+
+			// ゴーストを今回の挑戦と同じ時刻まで進める（復号できなかったゴーストは外す）
+			for (auto& ghost : m_ghosts)
+			{
+				ghost.update(m_attemptSteps * StepTime);
+			}
+
+			m_ghosts.remove_if([](const GhostPlayer& ghost) { return (not ghost.run()); });
+		}
+
+		data.telemetry.push(TelemetryType::PhysicsSteps, steps);
+
+		// このフレームの物理ステップで起きた接触と進入をまとめて処理する
+		handlePhysicsEvents(data);
+
+		// パーティクルの更新
+		particles.update(Scene::DeltaTime());
+
+		// 時間を待っている手順を進める
+		m_scripts.advance(Scene::DeltaTime());
+
+		// 次のステップより後に起きたイベントも、ドラッグの表示が遅れないようにこのフレームで反映する
+		for (; nextEvent < events.size(); ++nextEvent)
+		{
+			handleInput(events[nextEvent]);
+		}
+
+		// 置いた設置物をワールドに反映し、ドラッグ中は針の軌跡を予測する
+		updatePlacement();
+
+		// 設置物の描画（置けない場所にあるものは赤く示す）
+		for (size_t i = 0; i < objects.size(); ++i)
+		{
+			objects[i]->draw(list);
+
+			if (m_invalid[i])
+			{
+				objects[i]->drawInvalid(list);
 			}
 		}
 
 		// カメラ更新
 		camera.update();
-		const auto t = camera.createTransformer();
+
+		// カメラと動く物体の周囲のチャンクを読み込み、離れたチャンクを破棄する
+		chunks.update(camera.getRegion(), bodyPositions());
 
 		// テクスチャ確認
-		if (!needle)
+		if (not needle)
 		{
 			Print << U"Texture 読み込み失敗";
 		}
 
-		// --- 描画 ---
+		// レベルデータ確認
+		if (chunks.info().directory.isEmpty())
+		{
+			Print << U"Level 読み込み失敗";
+		}
 
-		// 地面
-		for (const auto& g : grounds)
+		// レベルデータが編集されたら、変更のあった部分だけを作り直す
+		if (const auto changes = levelWatcher.retrieve())
 		{
-			g.draw(Palette::Gray);
+			reloadLevel(changes);
 		}
 
-		// 動く物体
-		for (const auto& b : bodies)
+		// 直近のホットリロードの結果を数秒間表示する
+		if (m_lastReload && (m_lastReloadAge.sF() < 5.0))
 		{
-			double scale = (b.radius * 2.0) / needle.width();
-			needle.scaled(0.2).rotated(b.body.getAngle()).drawAt(b.body.getPos());
+			Print << U"Reload: {} chunks, {} bodies, {} failed, {:.2f} ms"_fmt(
+				m_lastReload->rebuiltChunks, m_lastReload->createdBodies, m_lastReload->failedFiles, m_lastReloadTime);
 		}
-	}
 
-private:
+		// --- 描画 ---
 
-	const Font m_font{ FontMethod::MSDF, 48, Typeface::Bold };
-	const Texture needle;
-	// --- スクロール関連 ---
-	double scrollY = 0.0;
-	const double scrollSpeed = 40.0;
+		// フレームの間隔が予算を超え続けていたら（GPU が間に合っていなければ）、ワールドだけを縮小して描く
+		const FramePacer& pacer = data.pacer;
+		resolution.update(pacer.frameInterval(), pacer.frameBudget());
+
+		if (resolution.scale() < 1.0)
+		{
+			Print << U"Resolution: {:.0f}%"_fmt(resolution.scale() * 100);
+		}
+
+		// ワールドは UI の設置物より上、結果や案内より下に描く
+		list.pass(DrawLayer::World, [this, &data]()
+		{
+			resolution.render([&](const Mat3x2& toTarget)
+			{
+				const auto phase = data.profiler.scoped(FramePhase::WorldDraw);
+				const Transformer2D t{ camera.getMat3x2() * toTarget, TransformCursor::Yes, Transformer2D::Target::SetCamera };
+				data.draw.addStats(drawWorld());
+			});
+		});
+
+		// 結果
+		if (m_outcome)
+		{
+			const bool cleared = (*m_outcome == TelemetryOutcome::Cleared);
+			list.textAt(DrawLayer::Overlay, m_font, data.text(cleared ? TextID::Clear : TextID::Failed), 64, Vec2{ 620, 300 }, (cleared ? ColorF{ 0.9, 0.5, 0.1 } : ColorF{ 0.3 }));
+		}
+
+		// 手順の案内
+		if (m_marker)
+		{
+			list.rectFrame(DrawLayer::Overlay, m_marker->stretched(-4), 4, ColorF{ 1.0, 0.6, 0.1, (0.5 + 0.4 * Periodic::Sine0_1(1.2s)) });
+		}
+
+		if (m_caption)
+		{
+			const RectF box{ Arg::center = Vec2{ (WorldAreaLeft + Scene::Width()) / 2.0, 40 }, 520, 50 };
+			list.roundRect(DrawLayer::Overlay, box.rounded(8), ColorF{ 1.0, 0.85 });
+			list.textAt(DrawLayer::Overlay, m_font, data.text(*m_caption), 26, box.center(), ColorF{ 0.2 });
+		}
+
+		// このフレームに記録したものをまとめて描く
+		list.flush();
+
+		return nextScene;
+	}
+
+private:
+
+	const Font m_font{ FontMethod::MSDF, 48, Typeface::Bold };
+	// ステージのスプライト（針とパーティクル）はアトラスの同じページから描く
+	const TextureAtlas atlas;
+	const SpriteHandle needle;
+	// --- スクロール関連 ---
+	double scrollY = 0.0;
+	const double scrollSpeed = 40.0;
 	const Font scrollFont{ 30 };
 	Array<String> lines;
+	// lines を作ったときの Localization::revision()
+	Optional<uint32> m_textRevision;
 	// 設置物
 	Array<std::shared_ptr<IDraggable>> objects;
+	// 手順と、その案内
+	ScriptRunner m_scripts;
+	Optional<TextID> m_caption;
+	Optional<RectF> m_marker;
+	// 設置物の操作の履歴と、ドラッグを始めたときの位置
+	PlacementHistory history;
+	Array<Vec2> m_dragFrom;
+	// Ctrl / Shift キーを押しているか（入力イベントから追う）
+	bool m_control = false;
+	bool m_shift = false;
 	// 物理関連
 	constexpr static double StepTime = 1.0 / 200.0;
 	double accumulatedTime;
 	P2World world;
 	Array<MyBody> bodies;
-	Array<P2Body> grounds;
+	// 針が多いときに、触れ合わない針の集まりごとに分けて進める
+	PhysicsIslands islands;
+	ChunkedWorld chunks;
+	LevelWatcher levelWatcher;
 	Camera2D camera;
-};
+	DynamicResolution resolution;
+	ParticleSystem particles;
+	// ワールドの描画の記録（カメラの座標変換の中で描く）
+	DrawList m_worldDraw;
+	// 描いている軌跡の予測（m_worldDraw を描き終えるまで持っておく）
+	std::shared_ptr<const TrajectoryPredictor::Result> m_drawnPrediction;
+
+	// ワールド（地面と動く物体）を描く
+	DrawStats drawWorld()
+	{
+		DrawList& list = m_worldDraw;
 
-// ステージ1
-class Stage1 : public App::Scene
-{
-public:
+		// 地面（チャンクの物体ごとに描く）
+		list.pass(DrawLayer::Background, [this]() { chunks.draw(Palette::Gray); });
 
-	Stage1(const InitData& init)
-		: IScene{ init }
-		, needle(U"example/needle.png")
-		, camera{ Vec2{0, -300 }, 1.0 }
-		, accumulatedTime(0.0)
-	{
-		Scene::SetBackground(ColorF{ 0.7, 0.9, 1.0 });
-		// 表示するテキストの配列
-		for (int i = 0; i < 20; ++i)
+		// ゴール
+		for (const auto& trigger : triggers.regions())
 		{
-			lines << U"サンプル行 {}"_fmt(i + 1);
+			if (trigger.kind == TriggerKind::Goal)
+			{
+				list.rect(DrawLayer::Content, trigger.rect, ColorF{ 1.0, 0.85, 0.2, 0.4 });
+				list.rectFrame(DrawLayer::Content, trigger.rect, 2, ColorF{ 0.9, 0.6, 0.1 });
+			}
 		}
-		
-		// 円と四角形を追加
-		objects.push_back(std::make_shared<DraggableCircle>(Circle{ 105, 235, 40 }));
-		objects.push_back(std::make_shared<DraggableRect>(Rect{ 65, 340, 80, 80 }));
-		objects.push_back(std::make_shared<DraggableCircle>(Circle{ 105, 515, 60 }));
-		// 物理ボディ
-		double radius = 10;
-		bodies << MyBody{
-			world.createRect(P2Dynamic, Vec2{-100, -300}, Vec2{10, 120}),
-			radius
-		};
 
-		// 地面
-		// grounds << world.createRect(P2Static, Vec2{ 0, -200 }, SizeF{ 600, 20 });
-		grounds << world.createLine(P2Static, Vec2{ 0, 0 }, Line{ -50, -150, -300, -50 });
-		grounds << world.createLineString(P2Static, Vec2{ 0, 0 },
-		LineString{ Vec2{ 100, -50 }, Vec2{ 200, -50 }, Vec2{ 600, -150 } });
-	}
+		// ドラッグ中の設置物で変わる針の軌跡
+		m_drawnPrediction = (m_requested ? predictor.result() : nullptr);
 
-	void update() override
-	{
-		// 戻るボタン
-		//　現在は戻るだけで次のボタンが押せるようになっている
-		if (Button(Rect{ 10, 10, 200, 70 }, m_font, U"BackMenu", true))
+		if (m_drawnPrediction)
 		{
-			// Stage2 をアンロック
-			getData().unlockedStage2 = true;
-			// タイトルシーンに戻る
-			changeScene(State::Title);
+			for (const auto& path : m_drawnPrediction->paths)
+			{
+				list.lineString(DrawLayer::Content, path, LineStyle::SquareDot, 3, ColorF{ 1.0, 0.8 });
+			}
 		}
-		// リスタートボタン
-		if (Button(Rect{ 10, 90, 200, 70}, m_font, U"ReSet", true))
+
+		// ゴースト（速かった挑戦ほど濃く描く）
+		for (size_t i = 0; i < m_ghosts.size(); ++i)
 		{
-			// 処理内容
-			for (auto& obj : objects)
+			const GhostFrame& frame = m_ghosts[i].frame();
+			const Array<GhostPart>& parts = m_ghosts[i].run()->parts();
+			const ColorF color{ 1.0, (0.45 - i * 0.1) };
+
+			for (size_t p = 0; p < parts.size(); ++p)
+			{
+				if (frame.placedMask & (1u << p))
+				{
+					if (parts[p].circle)
+					{
+						list.circleFrame(DrawLayer::Objects, Circle{ frame.parts[p], (parts[p].size.x / 2) }, 2, color);
+					}
+					else
+					{
+						list.rectFrame(DrawLayer::Objects, RectF{ Arg::center = frame.parts[p], parts[p].size }, 2, color);
+					}
+				}
+			}
+
+			for (const auto& ghostNeedle : frame.needles)
 			{
-				obj->reset();
+				list.sprite(DrawLayer::Objects, atlas(needle), 0.2, ghostNeedle.angle, ghostNeedle.pos, color);
 			}
 		}
-		// 設置物をおくところの背景
-		Rect{ 40, 170, 130, 130}.draw();
-		Rect{ 40, 310, 130, 130}.draw();
-		Rect{ 40, 450, 130, 130}.draw();
-		
-		// 境界線ようの縦線
-		Rect{ 230, 0, 10, 600}.draw(ColorF{ 0 });
 
-		// --- スクロール関連の定数を計算 ---
+		// 動く物体（ゴーストの針と同じテクスチャなので、続けて描かれる）
+		for (const auto& b : bodies)
+		{
+			list.sprite(DrawLayer::Objects, atlas(needle), 0.2, b.body.getAngle(), b.body.getPos());
+		}
 
-		// 全コンテンツの高さを計算 (行数 × 1行の高さ)
-		const double contentHeight = lines.size() * 40.0;
+		// エフェクト（1 つの頂点バッファにまとめて描く）
+		list.pass(DrawLayer::Overlay, [this]() { particles.draw(); });
 
-		// 画面（表示領域）の高さを取得
-		const double viewHeight = Scene::Height();
+		return list.flush();
+	}
 
-		// テキストの上側の余白
-		const double topMargin = 50.0;
+	State m_state;
 
-		// スクロール可能な最大量を計算
-		// (コンテンツが画面より大きい場合のみ、スクロール量が発生)
-		const double maxScroll = (contentHeight > viewHeight) ? (contentHeight - viewHeight + topMargin) : 0.0;
+	bool GameData::* m_unlockTarget = nullptr;
 
-		// --- 入力処理 ---
+	// 今回の挑戦を始めてからの時間
+	Stopwatch m_attemptTime{ StartImmediately::Yes };
 
-		// マウスホイールの移動量に応じてスクロール位置を更新
-		scrollY += Mouse::Wheel() * scrollSpeed;
+	// ゴールと落下判定の領域
+	TriggerIndex triggers;
 
-		// --- スクロールバーの計算 ---
+	// 設置物ごとの、置けない場所にあるか（refreshPlacement() で毎フレーム判定する）
+	Array<bool> m_invalid;
 
-		// スクロールバーの領域を定義 (画面右端、幅 20px)
-		const RectF scrollbarArea(Scene::Width() - 20, 0, 20, Scene::Height());
+	// ワールドに置いた設置物と、その物理ボディ
+	PlacedShapes m_placed;
+	Array<P2Body> m_partBodies;
 
-		// スクロールバーのつまみ(サム)の Rect を用意
-		RectF thumb(scrollbarArea.x, 0, scrollbarArea.w, 0);
+	// 針の軌跡の予測（ドラッグ中に最後に予測を頼んだ設置物の形）
+	TrajectoryPredictor predictor;
+	Optional<PlacedShapes> m_requested;
 
-		// コンテンツが画面より大きい場合のみ、つまみを計算して表示
-		if (contentHeight > viewHeight)
+	// 設置物はこの x 座標（シーン座標）より右に置くとワールドに入る
+	static constexpr double WorldAreaLeft = 240.0;
+
+	// 設置物 index の形（ワールド座標）。ワールドに入っていなければ空
+	[[nodiscard]]
+	PlacedShapes worldShape(size_t index, const Mat3x2& toWorld, double scale) const
+	{
+		PlacedShapes onScreen, result;
+		objects[index]->addShape(onScreen);
+
+		for (const auto& circle : onScreen.circles)
 		{
-			// つまみの高さを 200px に固定
-			thumb.h = 200;
-			// 現在のスクロール位置(scrollY)を、つまみのY座標に変換
-			thumb.y = scrollbarArea.y + scrollY / maxScroll * (scrollbarArea.h - thumb.h);
+			if (WorldAreaLeft <= (circle.x - circle.r))
+			{
+				result.circles << Circle{ toWorld.transformPoint(circle.center), (circle.r * scale) };
+			}
 		}
 
-		// スクロールバーに対するマウス操作
-		if (scrollbarArea.leftClicked())
+		for (const auto& rect : onScreen.rects)
 		{
-			// スクロールバーの領域をクリックしたら、その位置につまみが移動するようにスクロール量を逆算
-			const double newThumbY = Clamp(Cursor::Pos().y - thumb.h / 2, scrollbarArea.y, scrollbarArea.y + scrollbarArea.h - thumb.h);
-			scrollY = (newThumbY - scrollbarArea.y) / (scrollbarArea.h - thumb.h) * maxScroll;
+			if (WorldAreaLeft <= rect.x)
+			{
+				const Vec2 tl = toWorld.transformPoint(rect.tl());
+				result.rects << RectF{ tl, (toWorld.transformPoint(rect.br()) - tl) };
+			}
 		}
-		else if (thumb.leftPressed())
+
+		return result;
+	}
+
+	// 設置物ごとの形（ワールド座標）。ワールドに入っていなければ空
+	[[nodiscard]]
+	Array<PlacedShapes> worldShapes() const
+	{
+		const Mat3x2 toWorld = camera.getMat3x2().inverse();
+		const double scale = (1.0 / camera.getScale());
+		Array<PlacedShapes> result(objects.size());
+
+		for (size_t i = 0; i < objects.size(); ++i)
 		{
-			// つまみをドラッグしている間の処理
-			const double mouseY = Cursor::Pos().y;
-			// マウスのY座標に合わせてつまみを移動
-			const double newThumbY = Clamp(mouseY - (mouseY - thumb.y), scrollbarArea.y, scrollbarArea.y + scrollbarArea.h - thumb.h);
-			// つまみの位置からスクロール量を逆算
-			scrollY = (newThumbY - scrollbarArea.y) / (scrollbarArea.h - thumb.h) * maxScroll;
+			result[i] = worldShape(i, toWorld, scale);
 		}
 
-		// --- スクロール位置の最終調整 ---
+		return result;
+	}
 
-		// スクロール量が 0.0 ～ maxScroll の範囲に収まるように制限
-		scrollY = Clamp(scrollY, 0.0, maxScroll);
+	// 設置物どうしの重なりを調べる格子の 1 マスの大きさ（ワールド座標）
+	static constexpr double PartCellSize = 128.0;
 
-		// --- 描画処理 ---
+	// 設置物ごとの形（ワールド座標）と外接矩形、それを求めたときの位置とカメラ
+	Array<PlacedShapes> m_partShapes;
+	Array<RectF> m_partBounds;
+	Array<Vec2> m_partPositions;
+	Vec2 m_partCameraCenter{ 0, 0 };
+	double m_partCameraScale = 0.0;
 
-		// テキストを描画 (スクロール位置 scrollY を引くことで、表示位置を動かす)
-		for (int i = 0; i < lines.size(); ++i)
-		{
-			scrollFont(lines[i]).draw(250, 50 + i * 40 - scrollY);
-		}
+	// 外接矩形がかかるマス → 設置物の番号
+	HashTable<Point, Array<size_t>> m_partGrid;
 
-		// スクロールバーを描画 (コンテンツが画面より大きい場合のみ)
-		if (contentHeight > viewHeight)
-		{
-			// スクロールバーの背景(トラック)を灰色で描画
-			scrollbarArea.draw(ColorF(0.5));
-			// つまみ(サム)を明るい灰色で描画
-			thumb.draw(ColorF(0.9));
-		}
-		
-		
-		// Rキーで初期位置に戻す
-		if (KeyR.down())
+	// 設置物ごとの、地面に重なっているか
+	// 読み込まれているチャンクが変わったら（ストリーミングやホットリロード）、すべて調べ直す
+	Array<bool> m_partHitsGround;
+	Optional<uint64> m_groundRevision;
+
+	// ワールドに入っていて置ける場所にある設置物の形（ワールド座標）と、調べ直す設置物の印
+	PlacedShapes m_validShapes;
+	Array<bool> m_recheck;
+
+	[[nodiscard]]
+	static RectF BoundsOf(const PlacedShapes& shapes)
+	{
+		Optional<RectF> bounds;
+
+		const auto add = [&](const RectF& r)
 		{
-			for (auto& obj : objects)
+			if (not bounds)
 			{
-				obj->reset();
+				bounds = r;
+				return;
 			}
-		}
 
-		// 更新と描画
-		for (auto& obj : objects)
+			const Vec2 tl{ Min(bounds->x, r.x), Min(bounds->y, r.y) };
+			const Vec2 br{ Max(bounds->br().x, r.br().x), Max(bounds->br().y, r.br().y) };
+			bounds = RectF{ tl, (br - tl) };
+		};
+
+		for (const auto& circle : shapes.circles)
 		{
-			obj->update();
-			obj->draw();
+			add(circle.boundingRect());
 		}
-		
-		ClearPrint();
 
-		// 情報表示
-		for (const auto& b : bodies)
+		for (const auto& rect : shapes.rects)
 		{
-			Print << U"ID: {}, Pos: {:.1f}"_fmt(b.body.id(), b.body.getPos());
+			add(rect);
 		}
 
-		// 物理更新
-		accumulatedTime += Scene::DeltaTime();
-		while (accumulatedTime >= StepTime)
+		return bounds.value_or(RectF{ 0, 0, 0, 0 });
+	}
+
+	// rect がかかる格子のマスごとに f(マス) を呼ぶ
+	template <class Function>
+	static void ForEachPartCell(const RectF& rect, Function f)
+	{
+		const Point begin{ static_cast<int32>(Math::Floor(rect.x / PartCellSize)), static_cast<int32>(Math::Floor(rect.y / PartCellSize)) };
+		const Point end{ static_cast<int32>(Math::Floor(rect.br().x / PartCellSize)), static_cast<int32>(Math::Floor(rect.br().y / PartCellSize)) };
+
+		for (int32 y = begin.y; y <= end.y; ++y)
 		{
-			world.update(StepTime);
-			accumulatedTime -= StepTime;
+			for (int32 x = begin.x; x <= end.x; ++x)
+			{
+				f(Point{ x, y });
+			}
+		}
+	}
 
-			// 落下物の削除
-			for (size_t i = 0; i < bodies.size(); )
+	// 設置物 index の外接矩形にかかる、格子のマスにいる設置物に印をつける
+	void markPartNeighbors(size_t index)
+	{
+		ForEachPartCell(m_partBounds[index], [this](const Point& cell)
+		{
+			if (const auto it = m_partGrid.find(cell); it != m_partGrid.end())
 			{
-				if (bodies[i].body.getPos().y > 500)
+				for (const size_t other : it->second)
 				{
-					bodies.remove_at(i);
+					m_recheck[other] = true;
 				}
-				else
+			}
+		});
+	}
+
+	// 形が地面に重なるか（地面との判定はチャンクごとの距離場を数回引くだけで、線分との交差は調べない）
+	[[nodiscard]]
+	bool hitsGround(const PlacedShapes& shapes) const
+	{
+		return (not (shapes.circles.all([this](const Circle& c) { return chunks.isGroundFree(c); })
+			&& shapes.rects.all([this](const RectF& r) { return chunks.isGroundFree(r); })));
+	}
+
+	// 設置物 index がほかの設置物に重なるか（同じマスにいる設置物とだけ比べる）
+	[[nodiscard]]
+	bool overlapsOtherPart(size_t index) const
+	{
+		bool overlaps = false;
+
+		ForEachPartCell(m_partBounds[index], [&](const Point& cell)
+		{
+			if (overlaps)
+			{
+				return;
+			}
+
+			if (const auto it = m_partGrid.find(cell); it != m_partGrid.end())
+			{
+				for (const size_t other : it->second)
 				{
-					++i;
+					if ((other != index) && m_partBounds[index].intersects(m_partBounds[other])
+						&& m_partShapes[index].intersects(m_partShapes[other]))
+					{
+						overlaps = true;
+						return;
+					}
 				}
 			}
-		}
+		});
 
-		// カメラ更新
-		camera.update();
-		const auto t = camera.createTransformer();
+		return overlaps;
+	}
 
-		// テクスチャ確認
-		if (!needle)
+	// 設置物を置ける場所にあるか（地面にもほかの設置物にも重ならない）を m_invalid に求める
+	// 毎フレーム呼ぶが、調べ直すのは動いた設置物と、動く前と後にその近くにあった設置物だけで、ほかは前の結果を使う
+	// 地面との判定は距離場を数回引くだけで、線分との交差は調べない。変わったら true を返す
+	bool refreshPlacement()
+	{
+		const size_t count = objects.size();
+		const bool all = ((m_partShapes.size() != count) || (camera.getCenter() != m_partCameraCenter) || (camera.getScale() != m_partCameraScale));
+
+		if (all)
 		{
-			Print << U"Texture 読み込み失敗";
+			m_partShapes.assign(count, PlacedShapes{});
+			m_partBounds.assign(count, RectF{ 0, 0, 0, 0 });
+			m_partPositions.resize(count);
+			m_partHitsGround.assign(count, false);
+			m_invalid.assign(count, false);
+			m_partGrid.clear();
+			m_partCameraCenter = camera.getCenter();
+			m_partCameraScale = camera.getScale();
 		}
 
-		// --- 描画 ---
+		m_recheck.assign(count, all);
+		const bool groundChanged = (m_groundRevision != chunks.revision());
+		bool changed = (all || groundChanged);
+
+		const Mat3x2 toWorld = camera.getMat3x2().inverse();
+		const double scale = (1.0 / camera.getScale());
 
-		// 地面
-		for (const auto& g : grounds)
+		for (size_t i = 0; i < count; ++i)
 		{
-			g.draw(Palette::Gray);
+			const Vec2 position = objects[i]->position();
+
+			if ((not all) && (position == m_partPositions[i]))
+			{
+				continue;
+			}
+
+			changed = true;
+
+			// 動く前に近くにあった設置物を調べ直し、格子から外す
+			if (not m_partShapes[i].isEmpty())
+			{
+				markPartNeighbors(i);
+				ForEachPartCell(m_partBounds[i], [&](const Point& cell) { m_partGrid[cell].remove(i); });
+			}
+
+			m_partPositions[i] = position;
+			m_partShapes[i] = worldShape(i, toWorld, scale);
+			m_partBounds[i] = BoundsOf(m_partShapes[i]);
+			m_partHitsGround[i] = hitsGround(m_partShapes[i]);
+			m_recheck[i] = true;
+
+			// 動いた後に近くにある設置物を調べ直し、格子に入れる
+			if (not m_partShapes[i].isEmpty())
+			{
+				markPartNeighbors(i);
+				ForEachPartCell(m_partBounds[i], [&](const Point& cell) { m_partGrid[cell] << i; });
+			}
 		}
 
-		// 動く物体
-		for (const auto& b : bodies)
+		if (not changed)
 		{
-			double scale = (b.radius * 2.0) / needle.width();
-			needle.scaled(0.2).rotated(b.body.getAngle()).drawAt(b.body.getPos());
+			return false;
 		}
-	}
 
-private:
+		if (groundChanged)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				m_partHitsGround[i] = hitsGround(m_partShapes[i]);
+				m_recheck[i] = true;
+			}
 
-	const Font m_font{ FontMethod::MSDF, 48, Typeface::Bold };
-	const Texture needle;
-	// --- スクロール関連 ---
-	double scrollY = 0.0;
-	const double scrollSpeed = 40.0;
-	const Font scrollFont{ 30 };
-	Array<String> lines;
-	// 設置物
-	Array<std::shared_ptr<IDraggable>> objects;
-	// 物理関連
-	constexpr static double StepTime = 1.0 / 200.0;
-	double accumulatedTime;
-	P2World world;
-	Array<MyBody> bodies;
-	Array<P2Body> grounds;
-	Camera2D camera;
-};
+			m_groundRevision = chunks.revision();
+		}
 
-// ステージ2
-class Stage2 : public App::Scene
-{
-public:
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (m_recheck[i])
+			{
+				m_invalid[i] = ((not m_partShapes[i].isEmpty()) && (m_partHitsGround[i] || overlapsOtherPart(i)));
+			}
+		}
 
-	Stage2(const InitData& init)
-		: IScene{ init }
-		, needle(U"example/needle.png")
-		, camera{ Vec2{0, -300 }, 1.0 }
-		, accumulatedTime(0.0)
-	{
-		Scene::SetBackground(ColorF{ 0.7, 0.9, 1.0 });
-		// 表示するテキストの配列
-		for (int i = 0; i < 20; ++i)
+		m_validShapes.circles.clear();
+		m_validShapes.rects.clear();
+
+		for (size_t i = 0; i < count; ++i)
 		{
-			lines << U"サンプル行 {}"_fmt(i + 1);
+			if (not m_invalid[i])
+			{
+				m_validShapes.circles.append(m_partShapes[i].circles);
+				m_validShapes.rects.append(m_partShapes[i].rects);
+			}
 		}
-		
-		// 円と四角形を追加
-		objects.push_back(std::make_shared<DraggableCircle>(Circle{ 105, 235, 40 }));
-		objects.push_back(std::make_shared<DraggableRect>(Rect{ 65, 340, 80, 80 }));
-		objects.push_back(std::make_shared<DraggableCircle>(Circle{ 105, 515, 60 }));
-		// 物理ボディ
-		double radius = 10;
-		bodies << MyBody{
-			world.createRect(P2Dynamic, Vec2{-100, -300}, Vec2{10, 120}),
-			radius
-		};
 
-		// 地面
-		// grounds << world.createRect(P2Static, Vec2{ 0, -200 }, SizeF{ 600, 20 });
-		grounds << world.createLine(P2Static, Vec2{ 0, 0 }, Line{ -50, -150, -300, -50 });
-		grounds << world.createLineString(P2Static, Vec2{ 0, 0 },
-		LineString{ Vec2{ 100, -50 }, Vec2{ 200, -50 }, Vec2{ 600, -150 } });
+		return true;
 	}
 
-	void update() override
+	// 置けない場所にある設置物を調べ、ドラッグ中は予測を頼み、離したら設置物の物理ボディを作り直す
+	void updatePlacement()
 	{
-		// 戻るボタン
-		//　現在は戻るだけで次のボタンが押せるようになっている
-		if (Button(Rect{ 10, 10, 200, 70 }, m_font, U"BackMenu", true))
-		{
-			// Stage2 をアンロック
-			getData().unlockedStage3 = true;
-			// タイトルシーンに戻る
-			changeScene(State::Title);
-		}
-		// リスタートボタン
-		if (Button(Rect{ 10, 90, 200, 70}, m_font, U"ReSet", true))
+		refreshPlacement();
+
+		const PlacedShapes& shapes = m_validShapes;
+
+		if (objects.any([](const auto& obj) { return obj->dragging(); }))
 		{
-			// 処理内容
-			for (auto& obj : objects)
+			if (m_requested != shapes)
 			{
-				obj->reset();
+				predictor.request(makeSnapshot(shapes));
+				m_requested = shapes;
 			}
+
+			return;
 		}
-		// 設置物をおくところの背景
-		Rect{ 40, 170, 130, 130}.draw();
-		Rect{ 40, 310, 130, 130}.draw();
-		Rect{ 40, 450, 130, 130}.draw();
-		
-		// 境界線ようの縦線
-		Rect{ 230, 0, 10, 600}.draw(ColorF{ 0 });
 
-		// --- スクロール関連の定数を計算 ---
+		if (m_requested)
+		{
+			predictor.cancel();
+			m_requested.reset();
+		}
 
-		// 全コンテンツの高さを計算 (行数 × 1行の高さ)
-		const double contentHeight = lines.size() * 40.0;
+		if (shapes != m_placed)
+		{
+			m_partBodies.clear();
 
-		// 画面（表示領域）の高さを取得
-		const double viewHeight = Scene::Height();
+			for (const auto& circle : shapes.circles)
+			{
+				m_partBodies << world.createCircle(P2Static, circle.center, circle.r);
+			}
 
-		// テキストの上側の余白
-		const double topMargin = 50.0;
+			for (const auto& rect : shapes.rects)
+			{
+				m_partBodies << world.createRect(P2Static, rect.center(), rect.size);
+			}
 
-		// スクロール可能な最大量を計算
-		// (コンテンツが画面より大きい場合のみ、スクロール量が発生)
-		const double maxScroll = (contentHeight > viewHeight) ? (contentHeight - viewHeight + topMargin) : 0.0;
+			m_placed = shapes;
+		}
+	}
 
-		// --- 入力処理 ---
+	// 予測用のワールドの写し
+	[[nodiscard]]
+	PredictionSnapshot makeSnapshot(const PlacedShapes& shapes) const
+	{
+		PredictionSnapshot snapshot;
+		snapshot.chunks = chunks.loadedChunks();
+		snapshot.placed = shapes;
+		snapshot.needleSize = NeedleSize;
+		snapshot.stepTime = StepTime;
 
-		// マウスホイールの移動量に応じてスクロール位置を更新
-		scrollY += Mouse::Wheel() * scrollSpeed;
+		for (const auto& b : bodies)
+		{
+			snapshot.needles << PredictionSnapshot::Needle{ b.body.getPos(), b.body.getAngle(), b.body.getVelocity(), b.body.getAngularVelocity() };
+		}
 
-		// --- スクロールバーの計算 ---
+		for (const auto& trigger : triggers.regions())
+		{
+			if (trigger.kind == TriggerKind::Kill)
+			{
+				snapshot.killRegions << trigger.rect;
+			}
+		}
 
-		// スクロールバーの領域を定義 (画面右端、幅 20px)
-		const RectF scrollbarArea(Scene::Width() - 20, 0, 20, Scene::Height());
+		return snapshot;
+	}
 
-		// スクロールバーのつまみ(サム)の Rect を用意
-		RectF thumb(scrollbarArea.x, 0, scrollbarArea.w, 0);
+	// 物理ステップで集めた接触と進入（フレームごとにまとめて処理する）
+	PhysicsEvents events;
 
-		// コンテンツが画面より大きい場合のみ、つまみを計算して表示
-		if (contentHeight > viewHeight)
+	// 今回の挑戦の結果（まだ決まっていなければ none）
+	Optional<TelemetryOutcome> m_outcome;
+
+	// このフレームのイベントを処理する
+	void handlePhysicsEvents(GameData& data)
+	{
+		// 効果音は聞き手（カメラの中心）からの距離で音量と定位を決める
+		data.sound.setListener(camera.getCenter());
+
+		// 新しく接触した所から火花を出し、音を鳴らす
+		for (const auto& contact : events.contacts())
 		{
-			// つまみの高さを 200px に固定
-			thumb.h = 200;
-			// 現在のスクロール位置(scrollY)を、つまみのY座標に変換
-			thumb.y = scrollbarArea.y + scrollY / maxScroll * (scrollbarArea.h - thumb.h);
+			// 上向き（画面の上方向）に飛び散らせる
+			const Vec2 normal = (contact.normal.y > 0) ? -contact.normal : contact.normal;
+			particles.emit(ParticleKind::Spark, contact.point, normal, 260, 16);
+			data.sound.play(SoundID::Impact, contact.point);
+			m_scripts.signal(ScriptEvent::Contact, 0, contact.point);
 		}
 
-		// スクロールバーに対するマウス操作
-		if (scrollbarArea.leftClicked())
+		for (const auto& trigger : events.triggers())
 		{
-			// スクロールバーの領域をクリックしたら、その位置につまみが移動するようにスクロール量を逆算
-			const double newThumbY = Clamp(Cursor::Pos().y - thumb.h / 2, scrollbarArea.y, scrollbarArea.y + scrollbarArea.h - thumb.h);
-			scrollY = (newThumbY - scrollbarArea.y) / (scrollbarArea.h - thumb.h) * maxScroll;
+			if (trigger.kind == TriggerKind::Kill)
+			{
+				// 画面の下端から土ぼこりを出す
+				particles.emit(ParticleKind::Dust, Vec2{ trigger.pos.x, camera.getRegion().bottomY() }, Vec2{ 0, -1 }, 120, 24);
+				data.sound.play(SoundID::Fall, trigger.pos);
+			}
+			else
+			{
+				data.sound.play(SoundID::Goal, trigger.pos);
+
+				if (not m_outcome)
+				{
+					finishAttempt(data, TelemetryOutcome::Cleared);
+				}
+			}
 		}
-		else if (thumb.leftPressed())
+
+		events.clear();
+
+		// ゴールする前に針がすべて落ちたら失敗
+		if ((not m_outcome) && bodies.isEmpty() && (not chunks.info().needles.isEmpty()))
 		{
-			// つまみをドラッグしている間の処理
-			const double mouseY = Cursor::Pos().y;
-			// マウスのY座標に合わせてつまみを移動
-			const double newThumbY = Clamp(mouseY - (mouseY - thumb.y), scrollbarArea.y, scrollbarArea.y + scrollbarArea.h - thumb.h);
-			// つまみの位置からスクロール量を逆算
-			scrollY = (newThumbY - scrollbarArea.y) / (scrollbarArea.h - thumb.h) * maxScroll;
+			finishAttempt(data, TelemetryOutcome::Failed);
+		}
+	}
+
+	void finishAttempt(GameData& data, TelemetryOutcome outcome)
+	{
+		m_outcome = outcome;
+
+		// クリアしたら次のステージをアンロック
+		if ((outcome == TelemetryOutcome::Cleared) && m_unlockTarget)
+		{
+			data.*m_unlockTarget = true;
+		}
+
+		// 速かった挑戦に入ればゴーストとして残す
+		if (outcome == TelemetryOutcome::Cleared)
+		{
+			storeGhost(m_recorder.finish(m_attemptSteps * StepTime));
+		}
+
+		data.telemetry.push(TelemetryType::StageOutcome, FromEnum(m_state), FromEnum(outcome), m_attemptTime.sF());
+		recordAttempt(data, outcome);
+		m_scripts.signal(ScriptEvent::Outcome, FromEnum(outcome));
+	}
+
+	// 挑戦の統計に加える（時間は物理演算のステップ数から求め、ゴーストの時間とそろえる）
+	void recordAttempt(GameData& data, TelemetryOutcome outcome)
+	{
+		data.stats.record(static_cast<uint8>(m_state), outcome, (m_attemptSteps * StepTime), (m_placed.circles.size() + m_placed.rects.size()));
+	}
+
+	// 今回の挑戦の記録と、挑戦を始めてからのステップ数
+	GhostRecorder m_recorder;
+	uint32 m_attemptSteps = 0;
+
+	// 速かった挑戦のゴースト（速い順）
+	Array<GhostPlayer> m_ghosts;
+
+	// 残すゴーストの数と、サンプルを記録するステップの間隔
+	static constexpr size_t MaxGhosts = 3;
+	static constexpr uint32 GhostSampleSteps = static_cast<uint32>((GhostRun::SampleInterval / StepTime) + 0.5);
+
+	// ゴーストの保存先
+	[[nodiscard]]
+	FilePath ghostPath() const
+	{
+		return U"save/ghosts/{}.ghost"_fmt(FileSystem::FileName(chunks.info().directory));
+	}
+
+	// 設置物の形（ワールド座標の大きさ、先頭から GhostRun::MaxParts 個まで）
+	[[nodiscard]]
+	Array<GhostPart> ghostParts() const
+	{
+		const double scale = (1.0 / camera.getScale());
+		Array<GhostPart> parts;
+
+		for (size_t i = 0; i < Min(objects.size(), GhostRun::MaxParts); ++i)
+		{
+			PlacedShapes shape;
+			objects[i]->addShape(shape);
+
+			if (shape.circles)
+			{
+				parts << GhostPart{ true, (Vec2::All(shape.circles.front().r * 2) * scale) };
+			}
+			else
+			{
+				parts << GhostPart{ false, (shape.rects.front().size * scale) };
+			}
+		}
+
+		return parts;
+	}
+
+	// 今の針と、ワールドに置いた設置物の位置
+	[[nodiscard]]
+	GhostFrame ghostFrame() const
+	{
+		GhostFrame frame;
+
+		for (const auto& b : bodies)
+		{
+			frame.needles << GhostFrame::Needle{ b.body.getPos(), b.body.getAngle() };
+		}
+
+		const Array<PlacedShapes> shapes = worldShapes();
+		frame.parts.resize(Min(shapes.size(), GhostRun::MaxParts));
+
+		for (size_t i = 0; i < frame.parts.size(); ++i)
+		{
+			if (shapes[i].isEmpty() || ((i < m_invalid.size()) && m_invalid[i]))
+			{
+				continue;
+			}
+
+			frame.placedMask |= (1u << i);
+			frame.parts[i] = (shapes[i].circles ? shapes[i].circles.front().center : shapes[i].rects.front().center());
+		}
+
+		return frame;
+	}
+
+	void beginRecording()
+	{
+		m_recorder.begin(ghostParts());
+		m_attemptSteps = 0;
+	}
+
+	// ゴーストのファイルの形式: "NGST" (4 バイト), バージョン (uint32), 挑戦の数 (uint32), GhostRun::write() の列
+	static constexpr uint32 GhostVersion = 1;
+
+	void loadGhosts()
+	{
+		BinaryReader reader{ ghostPath() };
+
+		if (not reader)
+		{
+			return;
+		}
+
+		char magic[4];
+		uint32 version = 0, count = 0;
+
+		if ((not reader.read(magic, 4)) || (std::memcmp(magic, "NGST", 4) != 0)
+			|| (not reader.read(version)) || (version != GhostVersion) || (not reader.read(count)))
+		{
+			return;
+		}
+
+		for (uint32 i = 0; (i < count) && (m_ghosts.size() < MaxGhosts); ++i)
+		{
+			if (auto run = GhostRun::Read(reader))
+			{
+				GhostPlayer ghost{ std::make_shared<const GhostRun>(std::move(*run)) };
+
+				if (ghost.run())
+				{
+					m_ghosts << std::move(ghost);
+				}
+			}
+			else
+			{
+				break;
+			}
+		}
+	}
+
+	// run が速かった挑戦に入れば加えて保存する
+	void storeGhost(GhostRun&& run)
+	{
+		if (run.sampleCount() == 0)
+		{
+			return;
+		}
+
+		const auto it = std::find_if(m_ghosts.begin(), m_ghosts.end(),
+			[&](const GhostPlayer& ghost) { return (run.time() < ghost.run()->time()); });
+
+		if ((it == m_ghosts.end()) && (MaxGhosts <= m_ghosts.size()))
+		{
+			return;
+		}
+
+		m_ghosts.insert(it, GhostPlayer{ std::make_shared<const GhostRun>(std::move(run)) });
+
+		if (MaxGhosts < m_ghosts.size())
+		{
+			m_ghosts.pop_back();
+		}
+
+		BinaryWriter writer{ ghostPath() };
+
+		if (not writer)
+		{
+			return;
+		}
+
+		writer.write("NGST", 4);
+		writer.write(GhostVersion);
+		writer.write(static_cast<uint32>(m_ghosts.size()));
+
+		for (const auto& ghost : m_ghosts)
+		{
+			ghost.run()->write(writer);
+		}
+	}
+
+	// 直近のホットリロードの結果
+	Optional<ChunkedWorld::ReloadReport> m_lastReload;
+	double m_lastReloadTime = 0.0;
+	Stopwatch m_lastReloadAge;
+
+	// 針の大きさ
+	static constexpr Vec2 NeedleSize{ 10, 120 };
+
+	// 針を出現させる
+	void spawnNeedles(const Array<Vec2>& positions)
+	{
+		double radius = 10;
+		for (const auto& pos : positions)
+		{
+			bodies << MyBody{
+				world.createRect(P2Dynamic, pos, NeedleSize),
+				radius
+			};
+		}
+	}
+
+	// 変更のあったレベルデータだけを読み直し、P2World の該当する物理ボディを作り直す
+	void reloadLevel(const LevelWatcher::Changes& changes)
+	{
+		const Stopwatch stopwatch{ StartImmediately::Yes };
+		ChunkedWorld::ReloadReport report;
+
+		if (changes.levelChanged)
+		{
+			if (const auto info = LevelInfo::Load(chunks.info().directory))
+			{
+				// 針の出現位置が変わったときだけ針を出し直す
+				if (info->needles != chunks.info().needles)
+				{
+					bodies.clear();
+					spawnNeedles(info->needles);
+					report.createdBodies += info->needles.size();
+				}
+
+				if (info->triggers != chunks.info().triggers)
+				{
+					triggers = TriggerIndex{ info->triggers };
+					events.reset();
+				}
+
+				chunks.reloadInfo(*info, report);
+			}
+			else
+			{
+				++report.failedFiles;
+			}
+		}
+
+		chunks.reloadChunks(changes.chunks, report);
+
+		// 新しく必要になったチャンクをすぐに読み込む
+		chunks.update(camera.getRegion(), bodyPositions());
+
+		m_lastReload = report;
+		m_lastReloadTime = stopwatch.msF();
+		m_lastReloadAge.restart();
+	}
+
+	// 動く物体の位置（周囲のチャンクを読み込んでおくため）
+	[[nodiscard]]
+	Array<Vec2> bodyPositions() const
+	{
+		return bodies.map([](const MyBody& b) { return b.body.getPos(); });
+	}
+
+	// 入力イベントを 1 つ処理する
+	void handleInput(const InputEvent& event)
+	{
+		if ((event.type == InputEventType::KeyDown) || (event.type == InputEventType::KeyUp))
+		{
+			const bool down = (event.type == InputEventType::KeyDown);
+
+			if (event.key == KeyControl.code())
+			{
+				m_control = down;
+			}
+			else if (event.key == KeyShift.code())
+			{
+				m_shift = down;
+			}
+		}
+
+		if (event.type == InputEventType::KeyDown)
+		{
+			m_scripts.signal(ScriptEvent::KeyDown, event.key);
+
+			// Rキーで初期位置に戻す
+			if (event.key == KeyR.code())
+			{
+				restart();
+				return;
+			}
+
+			// Ctrl + Z で元に戻す、Ctrl + Y か Ctrl + Shift + Z でやり直す（ドラッグ中は受け付けない）
+			if (m_control && objects.none([](const auto& obj) { return obj->dragging(); }))
+			{
+				if ((event.key == KeyZ.code()) && (not m_shift))
+				{
+					if (const auto command = history.undo())
+					{
+						objects[command->object]->setPosition(command->from);
+					}
+
+					return;
+				}
+
+				if ((event.key == KeyY.code()) || (event.key == KeyZ.code()))
+				{
+					if (const auto command = history.redo())
+					{
+						objects[command->object]->setPosition(command->to);
+					}
+
+					return;
+				}
+			}
+		}
+
+		m_dragFrom.resize(objects.size());
+
+		for (size_t i = 0; i < objects.size(); ++i)
+		{
+			auto& obj = objects[i];
+			const bool wasDragging = obj->dragging();
+
+			if (not wasDragging)
+			{
+				m_dragFrom[i] = obj->position();
+			}
+
+			obj->update(event);
+
+			// 離したときに、ドラッグ全体を 1 件の操作として記録する
+			// 置けない場所で離したら、ドラッグを始めた場所に戻す
+			if (wasDragging && (not obj->dragging()) && (obj->position() != m_dragFrom[i]))
+			{
+				refreshPlacement();
+
+				if (not m_invalid[i])
+				{
+					history.record(PlacementCommand{ static_cast<uint16>(i), Float2{ m_dragFrom[i] }, Float2{ obj->position() } });
+					m_scripts.signal(ScriptEvent::Placement, static_cast<uint32>(i), obj->position());
+				}
+				else
+				{
+					obj->setPosition(m_dragFrom[i]);
+				}
+			}
+		}
+	}
+
+	void resetObjects()
+	{
+		for (auto& obj : objects)
+		{
+			obj->reset();
+		}
+	}
+
+	// 設置物と針を初期状態に戻し、挑戦をやり直す
+	void restart()
+	{
+		resetObjects();
+		history.clear();
+
+		bodies.clear();
+		spawnNeedles(chunks.info().needles);
+
+		events.reset();
+		m_outcome.reset();
+		m_attemptTime.restart();
+		beginRecording();
+		m_scripts.signal(ScriptEvent::Restart);
+	}
+};
+
+// ステージのシーン（チュートリアルと各ステージはこのクラスを継承する）
+// 中身の Stage は SceneCache から取り出し、シーンを離れるときに預ける
+class StageScene : public App::Scene
+{
+public:
+
+	StageScene(const InitData& init, const FilePath& levelDirectory, bool GameData::* unlockTarget)
+		: IScene{ init }
+		, m_stage{ getData().sceneCache.acquire<Stage>(getState()) }
+	{
+		const Stopwatch stopwatch{ StartImmediately::Yes };
+		const bool resumed = static_cast<bool>(m_stage);
+
+		if (m_stage)
+		{
+			// 前回の続きから再開する
+			m_stage->resume();
+		}
+		else
+		{
+			// 起動時に読み込んだレベルデータがあればそれを使う
+			const auto it = getData().levels.find(levelDirectory);
+			const Optional<LevelInfo> info = ((it != getData().levels.end()) ? Optional<LevelInfo>{ it->second } : LevelInfo::Load(levelDirectory));
+			m_stage = std::make_shared<Stage>(getState(), info, unlockTarget, getData().atlas);
+		}
+
+		// 離れている間に言語が切り替わっていたら、文字列を作り直す
+		m_stage->localize(getData().text);
+
+		getData().telemetry.push(TelemetryType::SceneTransition, FromEnum(getState()), resumed, stopwatch.sF());
+	}
+
+	~StageScene() override
+	{
+		getData().sceneCache.store(getState(), m_stage, m_stage->memoryUsage());
+	}
+
+	void update() override
+	{
+		if (const auto nextScene = m_stage->update(getData()))
+		{
+			changeScene(*nextScene);
+		}
+	}
+
+protected:
+
+	[[nodiscard]]
+	Stage& stage() noexcept
+	{
+		return *m_stage;
+	}
+
+private:
+
+	std::shared_ptr<Stage> m_stage;
+};
+
+// チュートリアルの手順
+// 針の行方を見る → R キーでやり直す → 設置物をワールドに置く → ゴールに入るまで繰り返す
+Script TutorialScript(Stage& stage)
+{
+	ScriptRunner& runner = stage.scripts();
+
+	stage.setCaption(TextID::TutorialWatch);
+	co_await runner.wait(ScriptEvent::Outcome);
+
+	for (;;)
+	{
+		stage.setCaption(TextID::TutorialRetry);
+		co_await runner.wait(ScriptEvent::Restart);
+
+		// 設置物をワールドに置くまで、置ける範囲を示す
+		stage.setCaption(TextID::TutorialPlace);
+		stage.setMarker(Stage::WorldArea());
+
+		while (not Stage::WorldArea().contains((co_await runner.wait(ScriptEvent::Placement)).pos))
+		{
+		}
+
+		stage.setMarker(none);
+		stage.setCaption(TextID::TutorialGoal);
+
+		if ((co_await runner.wait(ScriptEvent::Outcome)).arg == FromEnum(TelemetryOutcome::Cleared))
+		{
+			break;
 		}
+	}
+
+	stage.setCaption(TextID::TutorialDone);
+	co_await runner.seconds(3.0);
+	stage.setCaption(none);
+}
+
+// チュートリアル
+class Tutorial : public StageScene
+{
+public:
+
+	Tutorial(const InitData& init)
+		: StageScene{ init, U"level/tutorial", &GameData::unlockedStage1 }
+	{
+		// 手順が終わっていれば（初めて入ったときも）最初から始める
+		if (not stage().scripts().isRunning())
+		{
+			stage().scripts().start(TutorialScript(stage()));
+		}
+	}
+};
+
+// ステージ1
+class Stage1 : public StageScene
+{
+public:
+
+	Stage1(const InitData& init)
+		: StageScene{ init, U"level/stage1", &GameData::unlockedStage2 } {}
+};
+
+// ステージ2
+class Stage2 : public StageScene
+{
+public:
+
+	Stage2(const InitData& init)
+		: StageScene{ init, U"level/stage2", &GameData::unlockedStage3 } {}
+};
+
+//　ステージ3
+class Stage3 : public StageScene
+{
+public:
+
+	Stage3(const InitData& init)
+		: StageScene{ init, U"level/stage3", nullptr } {}
+};
+
+// 各ステージを初期状態から決まったステップ数だけ進め、一定間隔のハッシュ値を記録済みの結果（golden/<ステージ>.trace）と比べる
+// 物理演算の処理を変えても、挙動が変わっていないことを確かめるために使う
+// record が true なら、比較せずに記録し直す。すべて一致（または記録）できたら true を返す
+// 記録済みの結果がないステージは比べずに飛ばす（記録は record が true のときだけ行う）
+bool RunPhysicsTraces(bool record)
+{
+	// 総ステップ数（200 ステップで 1 秒）と、ハッシュを取る間隔
+	constexpr uint32 Steps = 2000;
+	constexpr uint32 Interval = 50;
+
+	const Array<std::tuple<State, String>> stages = {
+		{ State::Tutorial, U"tutorial" },
+		{ State::Stage1, U"stage1" },
+		{ State::Stage2, U"stage2" },
+		{ State::Stage3, U"stage3" },
+	};
+
+	bool passed = true;
+
+	for (const auto& [state, name] : stages)
+	{
+		Stage stage{ state, LevelInfo::Load(U"level/" + name), nullptr, TextureAtlas{} };
+
+		PhysicsTrace trace;
+		trace.steps = Steps;
+		trace.interval = Interval;
+
+		for (uint32 i = 1; i <= Steps; ++i)
+		{
+			stage.step();
+
+			if ((i % Interval) == 0)
+			{
+				trace.hashes << stage.physicsHash();
+			}
+		}
+
+		const FilePath goldenPath = U"golden/{}.trace"_fmt(name);
+		const auto golden = PhysicsTrace::Load(goldenPath);
+
+		if (record)
+		{
+			if (trace.save(goldenPath))
+			{
+				Console << U"{}: recorded {}"_fmt(name, goldenPath);
+			}
+			else
+			{
+				Console << U"{}: FAILED to write {}"_fmt(name, goldenPath);
+				passed = false;
+			}
+		}
+		else if (not golden)
+		{
+			Console << U"{}: SKIPPED, no {} (record it with --physics-trace-record)"_fmt(name, goldenPath);
+		}
+		else if (const auto mismatch = trace.firstMismatch(*golden))
+		{
+			Console << U"{}: MISMATCH at step {}"_fmt(name, *mismatch);
+			passed = false;
+		}
+		else
+		{
+			Console << U"{}: OK"_fmt(name);
+		}
+	}
+
+	// 針の多いステージを島に分けて進め、1 スレッドと複数スレッドで結果が一致することを確かめる
+	{
+		constexpr uint32 CrowdSteps = 400;
+
+		WorkStealingPool pool{ Max<size_t>(3, WorkStealingPool::DefaultWorkerCount()) };
+		Stage serial{ State::Stage1, LevelInfo::Load(U"level/stage1"), nullptr, TextureAtlas{} };
+		Stage parallel{ State::Stage1, LevelInfo::Load(U"level/stage1"), nullptr, TextureAtlas{} };
+		serial.addNeedleGrid(16, 12);
+		parallel.addNeedleGrid(16, 12);
+
+		Optional<uint32> mismatch;
+
+		for (uint32 i = 1; i <= CrowdSteps; ++i)
+		{
+			serial.step();
+			parallel.step(&pool);
+
+			if (((i % Interval) == 0) && (serial.physicsHash() != parallel.physicsHash()))
+			{
+				mismatch = i;
+				break;
+			}
+		}
+
+		if (mismatch)
+		{
+			Console << U"crowd: MISMATCH at step {} ({} threads)"_fmt(*mismatch, pool.threadCount());
+			passed = false;
+		}
+		else
+		{
+			Console << U"crowd: OK ({} threads)"_fmt(pool.threadCount());
+		}
+	}
+
+	return passed;
+}
+
+// ベンチマーク中に各シーンへ与える決まった操作（frame: 計測を始めてからのフレーム数）
+void InjectBenchmarkInput(InputQueue& input, State state, int32 frame)
+{
+	if ((state == State::Title) || (state == State::Credit))
+	{
+		// ボタンの上をなぞるようにカーソルを動かす
+		input.inject(InputEvent{ InputEventType::Move, OffsetCircular{ Vec2{ 400, 300 }, 200, (frame * 0.05) }.toVec2() });
+		return;
+	}
+
+	// 240 フレームごとに、円を掴んでワールドの上を動かし、離してから R キーで戻す
+	const int32 t = (frame % 240);
+	const Vec2 from{ 105, 235 };
+	const Vec2 to{ 600, 250 };
+
+	if (t == 0)
+	{
+		input.inject(InputEvent{ InputEventType::Move, from });
+		input.inject(InputEvent{ InputEventType::LeftDown, from });
+	}
+	else if (t <= 120)
+	{
+		input.inject(InputEvent{ InputEventType::Move, from.lerp(to, (t / 120.0)) });
+	}
+	else if (t == 121)
+	{
+		input.inject(InputEvent{ InputEventType::LeftUp, to });
+	}
+	else if (t == 200)
+	{
+		input.inject(InputEvent{ InputEventType::KeyDown, to, KeyR.code() });
+	}
+	else if (t == 201)
+	{
+		input.inject(InputEvent{ InputEventType::KeyUp, to, KeyR.code() });
+	}
+}
 
-		// --- スクロール位置の最終調整 ---
+// 各シーンを決まった操作で一定フレーム数だけ動かし、処理の区分ごとの CPU 時間とメモリ確保回数を
+// 予算（bench/budget.toml）と比べる。結果は bench/report.csv に書き出す
+// すべてのシーンが予算内なら true を返す
+bool RunBenchmark(App& manager)
+{
+	// シーンの準備が落ち着くまでのフレーム数と、計測するフレーム数
+	constexpr int32 WarmupFrames = 30;
+	constexpr int32 MeasuredFrames = 600;
 
-		// スクロール量が 0.0 ～ maxScroll の範囲に収まるように制限
-		scrollY = Clamp(scrollY, 0.0, maxScroll);
+	const Array<std::tuple<State, String>> scenes = {
+		{ State::Title, U"Title" },
+		{ State::Credit, U"Credit" },
+		{ State::Tutorial, U"Tutorial" },
+		{ State::Stage1, U"Stage1" },
+		{ State::Stage2, U"Stage2" },
+		{ State::Stage3, U"Stage3" },
+	};
 
-		// --- 描画処理 ---
+	const auto budgets = BenchmarkBudget::Load(U"bench/budget.toml");
 
-		// テキストを描画 (スクロール位置 scrollY を引くことで、表示位置を動かす)
-		for (int i = 0; i < lines.size(); ++i)
-		{
-			scrollFont(lines[i]).draw(250, 50 + i * 40 - scrollY);
-		}
+	GameData& data = *manager.get();
+	data.pacer.setMode(FramePacingMode::Uncapped);
 
-		// スクロールバーを描画 (コンテンツが画面より大きい場合のみ)
-		if (contentHeight > viewHeight)
-		{
-			// スクロールバーの背景(トラック)を灰色で描画
-			scrollbarArea.draw(ColorF(0.5));
-			// つまみ(サム)を明るい灰色で描画
-			thumb.draw(ColorF(0.9));
-		}
-		
-		// Rキーで初期位置に戻す
-		if (KeyR.down())
-		{
-			for (auto& obj : objects)
-			{
-				obj->reset();
-			}
-		}
+	// 毎回同じ状態から始めるよう、シーンを預からない
+	data.sceneCache.setCapacity(0);
 
-		// 更新と描画
-		for (auto& obj : objects)
-		{
-			obj->update();
-			obj->draw();
-		}
-		
-		ClearPrint();
+	Array<BenchmarkResult> results;
 
-		// 情報表示
-		for (const auto& b : bodies)
-		{
-			Print << U"ID: {}, Pos: {:.1f}"_fmt(b.body.id(), b.body.getPos());
-		}
+	for (const auto& [state, name] : scenes)
+	{
+		manager.changeScene(state, 0s);
 
-		// 物理更新
-		accumulatedTime += Scene::DeltaTime();
-		while (accumulatedTime >= StepTime)
+		uint64 allocations = 0;
+		size_t stateChanges = 0;
+
+		for (int32 frame = -WarmupFrames; frame < MeasuredFrames; ++frame)
 		{
-			world.update(StepTime);
-			accumulatedTime -= StepTime;
+			if (frame == 0)
+			{
+				data.profiler.reset();
+				allocations = AllocationCounter::Get();
+			}
+
+			if (0 <= frame)
+			{
+				InjectBenchmarkInput(data.input, state, frame);
+			}
 
-			// 落下物の削除
-			for (size_t i = 0; i < bodies.size(); )
 			{
-				if (bodies[i].body.getPos().y > 500)
+				const auto phase = data.profiler.scoped(FramePhase::Present);
+
+				if (not System::Update())
 				{
-					bodies.remove_at(i);
+					return false;
 				}
-				else
+			}
+
+			data.input.beginFrame();
+
+			{
+				const auto phase = data.profiler.scoped(FramePhase::Scene);
+
+				if (not manager.update())
 				{
-					++i;
+					return false;
 				}
 			}
-		}
 
-		// カメラ更新
-		camera.update();
-		const auto t = camera.createTransformer();
+			data.profiler.endFrame();
+			data.draw.endFrame();
 
-		// テクスチャ確認
-		if (!needle)
-		{
-			Print << U"Texture 読み込み失敗";
+			if (0 <= frame)
+			{
+				stateChanges += data.draw.lastFrame().stateChanges;
+			}
 		}
 
-		// --- 描画 ---
+		const FrameProfiler& profiler = data.profiler;
 
-		// 地面
-		for (const auto& g : grounds)
+		BenchmarkResult result;
+		result.name = name;
+		result.frames = profiler.frames();
+		result.sceneMs = profiler.averageMs(FramePhase::Scene);
+		result.sceneMaxMs = profiler.maxMs(FramePhase::Scene);
+		result.physicsMs = profiler.averageMs(FramePhase::Physics);
+		result.worldDrawMs = profiler.averageMs(FramePhase::WorldDraw);
+		result.presentMs = profiler.averageMs(FramePhase::Present);
+		result.stateChangesPerFrame = (static_cast<double>(stateChanges) / MeasuredFrames);
+
+		if constexpr (AllocationCounter::Enabled)
 		{
-			g.draw(Palette::Gray);
+			result.allocationsPerFrame = (static_cast<double>(AllocationCounter::Get() - allocations) / MeasuredFrames);
 		}
 
-		// 動く物体
-		for (const auto& b : bodies)
+		if (const auto it = budgets.find(name); it != budgets.end())
 		{
-			double scale = (b.radius * 2.0) / needle.width();
-			needle.scaled(0.2).rotated(b.body.getAngle()).drawAt(b.body.getPos());
+			result.check(it->second);
 		}
-	}
 
-private:
+		results << result;
+	}
 
-	const Font m_font{ FontMethod::MSDF, 48, Typeface::Bold };
-	const Texture needle;
-	// --- スクロール関連 ---
-	double scrollY = 0.0;
-	const double scrollSpeed = 40.0;
-	const Font scrollFont{ 30 };
-	Array<String> lines;
-	// 設置物
-	Array<std::shared_ptr<IDraggable>> objects;
-	// 物理関連
-	constexpr static double StepTime = 1.0 / 200.0;
-	double accumulatedTime;
-	P2World world;
-	Array<MyBody> bodies;
-	Array<P2Body> grounds;
-	Camera2D camera;
-};
+	TextWriter writer{ U"bench/report.csv" };
+	writer.writeln(U"scene,frames,sceneMs,sceneMaxMs,physicsMs,worldDrawMs,presentMs,stateChangesPerFrame,allocationsPerFrame,result");
 
-//　ステージ3
-class Stage3 : public App::Scene
-{
-public:
+	bool passed = true;
 
-	Stage3(const InitData& init)
-		: IScene{ init }
-		, needle(U"example/needle.png")
-		, camera{ Vec2{0, -300 }, 1.0 }
-		, accumulatedTime(0.0)
+	for (const auto& result : results)
 	{
-		Scene::SetBackground(ColorF{ 0.7, 0.9, 1.0 });
-		// 表示するテキストの配列
-		for (int i = 0; i < 20; ++i)
+		const String allocations = (result.allocationsPerFrame ? U"{:.1f}"_fmt(*result.allocationsPerFrame) : U"");
+		const bool ok = result.failures.isEmpty();
+		passed &= ok;
+
+		writer.writeln(U"{},{},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},{:.1f},{},{}"_fmt(result.name, result.frames,
+			result.sceneMs, result.sceneMaxMs, result.physicsMs, result.worldDrawMs, result.presentMs, result.stateChangesPerFrame, allocations, (ok ? U"OK" : U"FAILED")));
+
+		Console << U"{}: scene {:.3f} ms (max {:.3f}), physics {:.3f} ms, world draw {:.3f} ms, state changes/frame {:.1f}, allocations/frame {} -> {}"_fmt(
+			result.name, result.sceneMs, result.sceneMaxMs, result.physicsMs, result.worldDrawMs, result.stateChangesPerFrame,
+			(allocations.isEmpty() ? String{ U"-" } : allocations), (ok ? U"OK" : U"FAILED"));
+
+		for (const auto& failure : result.failures)
 		{
-			lines << U"サンプル行 {}"_fmt(i + 1);
+			Console << U"  over budget: {}"_fmt(failure);
 		}
-		// 円と四角形を追加
-		objects.push_back(std::make_shared<DraggableCircle>(Circle{ 105, 235, 40 }));
-		objects.push_back(std::make_shared<DraggableRect>(Rect{ 65, 340, 80, 80 }));
-		objects.push_back(std::make_shared<DraggableCircle>(Circle{ 105, 515, 60 }));
-		// 物理ボディ
-		double radius = 10;
-		bodies << MyBody{
-			world.createRect(P2Dynamic, Vec2{-100, -300}, Vec2{10, 120}),
-			radius
-		};
+	}
+
+	return passed;
+}
 
-		// 地面
-		// grounds << world.createRect(P2Static, Vec2{ 0, -200 }, SizeF{ 600, 20 });
-		grounds << world.createLine(P2Static, Vec2{ 0, 0 }, Line{ -50, -150, -300, -50 });
-		grounds << world.createLineString(P2Static, Vec2{ 0, 0 },
-		LineString{ Vec2{ 100, -50 }, Vec2{ 200, -50 }, Vec2{ 600, -150 } });
+// コマンドラインのツール（--pack-assets, --physics-trace, --benchmark など）の結果をプロセスの終了コードにする
+// Siv3D の Main() は終了コードを返せないため、呼んだ後は Main() から戻り、エンジンの終了処理と
+// ローカル変数の破棄（ミキサーなどのスレッドの終了）が済んでから、atexit で終了コードを付けて終える
+// std::_Exit() は標準出力を書き出さずに終えるので、パイプに渡した Console の出力が失われないよう先に書き出す
+void SetExitCode(bool succeeded)
+{
+	static int exitCode = 0;
+	static const bool registered = (std::atexit([]()
+	{
+		std::cout.flush();
+		std::wcout.flush();
+		std::fflush(nullptr);
+		std::_Exit(exitCode);
+	}) == 0);
+	exitCode = (succeeded ? 0 : 1);
+	(void)registered;
+}
+
+void Main()
+{
+	// アセットパックを作る（--pack-assets で level, atlas, lang の中身を assets.pak にまとめる）
+	if (System::GetCommandLineArgs().contains(U"--pack-assets"))
+	{
+		Console.open();
+		const bool packed = AssetPack::Build({ U"level", U"atlas", U"lang" }, U"assets.pak");
+		SetExitCode(packed);
+		return;
 	}
 
-	void update() override
+	// スプライトのアトラスを作る（--pack-atlas=<名前> で atlas/<名前>.json から atlas/<名前>.atlas を書き出す）
+	for (const auto& arg : System::GetCommandLineArgs())
 	{
-		// 戻るボタン
-		if (Button(Rect{ 10, 10, 200, 70 }, m_font, U"BackMenu", true))
-		{
-			// タイトルシーンに戻る
-			changeScene(State::Title);
-		}
-		// リスタートボタン
-		if (Button(Rect{ 10, 90, 200, 70}, m_font, U"ReSet", true))
+		if (arg.starts_with(U"--pack-atlas="))
 		{
-			// 処理内容
-			for (auto& obj : objects)
-			{
-				obj->reset();
-			}
+			Console.open();
+			const String name = arg.substr(13);
+			const bool packed = TextureAtlas::Pack(U"atlas/{}.json"_fmt(name), U"atlas/{}.atlas"_fmt(name));
+			SetExitCode(packed);
+			return;
 		}
-		// 設置物をおくところの背景
-		Rect{ 40, 170, 130, 130}.draw();
-		Rect{ 40, 310, 130, 130}.draw();
-		Rect{ 40, 450, 130, 130}.draw();
-		
-		// 境界線ようの縦線
-		Rect{ 230, 0, 10, 600}.draw(ColorF{ 0 });
-
-		// --- スクロール関連の定数を計算 ---
-
-		// 全コンテンツの高さを計算 (行数 × 1行の高さ)
-		const double contentHeight = lines.size() * 40.0;
+	}
 
-		// 画面（表示領域）の高さを取得
-		const double viewHeight = Scene::Height();
+	// アセットパックがあれば、レベルデータやアトラスはそこから読む
+	GameAssets().open(U"assets.pak");
 
-		// テキストの上側の余白
-		const double topMargin = 50.0;
+	// 言語ごとの文字の一覧を作る（--glyph-coverage）
+	if (System::GetCommandLineArgs().contains(U"--glyph-coverage"))
+	{
+		Console.open();
+		bool built = true;
 
-		// スクロール可能な最大量を計算
-		// (コンテンツが画面より大きい場合のみ、スクロール量が発生)
-		const double maxScroll = (contentHeight > viewHeight) ? (contentHeight - viewHeight + topMargin) : 0.0;
+		for (const auto& language : Localization::Languages)
+		{
+			built &= Localization::BuildGlyphCoverage(language);
+		}
 
-		// --- 入力処理 ---
+		SetExitCode(built);
+		return;
+	}
 
-		// マウスホイールの移動量に応じてスクロール位置を更新
-		scrollY += Mouse::Wheel() * scrollSpeed;
+	// 物理演算の決定性の確認（--physics-trace で比較、--physics-trace-record で記録し直す）
+	if (const auto args = System::GetCommandLineArgs();
+		args.contains(U"--physics-trace") || args.contains(U"--physics-trace-record"))
+	{
+		Console.open();
+		const bool passed = RunPhysicsTraces(args.contains(U"--physics-trace-record"));
+		Console << (passed ? U"physics trace: PASSED" : U"physics trace: FAILED");
+		SetExitCode(passed);
+		return;
+	}
 
-		// --- スクロールバーの計算 ---
+	// シーンごとの処理時間の計測（--benchmark）
+	const bool benchmark = System::GetCommandLineArgs().contains(U"--benchmark");
 
-		// スクロールバーの領域を定義 (画面右端、幅 20px)
-		const RectF scrollbarArea(Scene::Width() - 20, 0, 20, Scene::Height());
+	// シーンマネージャーを作成
+	App manager;
 
-		// スクロールバーのつまみ(サム)の Rect を用意
-		RectF thumb(scrollbarArea.x, 0, scrollbarArea.w, 0);
+	// 表示する言語（--lang=<言語>、既定は日本語）
+	String language{ Localization::Languages.front() };
 
-		// コンテンツが画面より大きい場合のみ、つまみを計算して表示
-		if (contentHeight > viewHeight)
+	for (const auto& arg : System::GetCommandLineArgs())
+	{
+		if (arg.starts_with(U"--lang="))
 		{
-			// つまみの高さを 200px に固定
-			thumb.h = 200;
-			// 現在のスクロール位置(scrollY)を、つまみのY座標に変換
-			thumb.y = scrollbarArea.y + scrollY / maxScroll * (scrollbarArea.h - thumb.h);
+			language = arg.substr(7);
 		}
+	}
 
-		// スクロールバーに対するマウス操作
-		if (scrollbarArea.leftClicked())
-		{
-			// スクロールバーの領域をクリックしたら、その位置につまみが移動するようにスクロール量を逆算
-			const double newThumbY = Clamp(Cursor::Pos().y - thumb.h / 2, scrollbarArea.y, scrollbarArea.y + scrollbarArea.h - thumb.h);
-			scrollY = (newThumbY - scrollbarArea.y) / (scrollbarArea.h - thumb.h) * maxScroll;
-		}
-		else if (thumb.leftPressed())
-		{
-			// つまみをドラッグしている間の処理
-			const double mouseY = Cursor::Pos().y;
-			// マウスのY座標に合わせてつまみを移動
-			const double newThumbY = Clamp(mouseY - (mouseY - thumb.y), scrollbarArea.y, scrollbarArea.y + scrollbarArea.h - thumb.h);
-			// つまみの位置からスクロール量を逆算
-			scrollY = (newThumbY - scrollbarArea.y) / (scrollbarArea.h - thumb.h) * maxScroll;
-		}
+	// 起動時の読み込み
+	// 依存関係に従ってワーカースレッドで並列に行い、テクスチャやフォントを作る作業だけをメインスレッドで行う
+	// 作業ごとの時間とクリティカルパスはログに出す
+	{
+		GameData& data = *manager.get();
+		Optional<TextureAtlas::Decoded> decodedAtlas;
 
-		// --- スクロール位置の最終調整 ---
+		TaskGraph startup;
 
-		// スクロール量が 0.0 ～ maxScroll の範囲に収まるように制限
-		scrollY = Clamp(scrollY, 0.0, maxScroll);
+		startup.add(U"save data", [&]() { LoadProgress(data); });
 
-		// --- 描画処理 ---
+		// アセットパックの圧縮した項目を 1 つずつ並列に展開し、それを読む作業はその後に行う
+		Array<TaskGraph::TaskID> unpacked;
 
-		// テキストを描画 (スクロール位置 scrollY を引くことで、表示位置を動かす)
-		for (int i = 0; i < lines.size(); ++i)
+		for (const size_t index : GameAssets().compressedEntries())
 		{
-			scrollFont(lines[i]).draw(250, 50 + i * 40 - scrollY);
+			unpacked << startup.add(U"unpack {}"_fmt(GameAssets().entries()[index].path), [index]() { GameAssets().unpack(index); });
 		}
 
-		// スクロールバーを描画 (コンテンツが画面より大きい場合のみ)
-		if (contentHeight > viewHeight)
-		{
-			// スクロールバーの背景(トラック)を灰色で描画
-			scrollbarArea.draw(ColorF(0.5));
-			// つまみ(サム)を明るい灰色で描画
-			thumb.draw(ColorF(0.9));
-		}
-		
-		
-		// Rキーで初期位置に戻す
-		if (KeyR.down())
+		const auto strings = startup.add(U"string table", [&]()
 		{
-			for (auto& obj : objects)
+			if (not data.text.setLanguage(language))
 			{
-				obj->reset();
+				data.text.setLanguage(Localization::Languages.front());
 			}
-		}
+		}, unpacked);
 
-		// 更新と描画
-		for (auto& obj : objects)
+		startup.add(U"fonts", [&]()
 		{
-			obj->update();
-			obj->draw();
-		}
-		
-		ClearPrint();
+			data.font = Font{ FontMethod::MSDF, 48, Typeface::Bold };
+			data.text.preload(data.font);
+		}, { strings }, TaskGraph::Affinity::MainThread);
 
-		// 情報表示
-		for (const auto& b : bodies)
-		{
-			Print << U"ID: {}, Pos: {:.1f}"_fmt(b.body.id(), b.body.getPos());
-		}
+		const auto atlasDecode = startup.add(U"atlas decode", [&]() { decodedAtlas = TextureAtlas::Decode(U"stage"); }, unpacked);
 
-		// 物理更新
-		accumulatedTime += Scene::DeltaTime();
-		while (accumulatedTime >= StepTime)
+		startup.add(U"atlas upload", [&]()
 		{
-			world.update(StepTime);
-			accumulatedTime -= StepTime;
+			if (decodedAtlas)
+			{
+				data.atlas = TextureAtlas{ std::move(*decodedAtlas) };
+			}
+		}, { atlasDecode }, TaskGraph::Affinity::MainThread);
 
-			// 落下物の削除
-			for (size_t i = 0; i < bodies.size(); )
+		startup.add(U"sound bank", [&]() { data.sound.load(); });
+
+		startup.add(U"attempt stats", [&]() { data.stats.open(U"save/stats"); });
+
+		startup.add(U"level data", [&]()
+		{
+			for (const FilePath directory : { U"level/tutorial", U"level/stage1", U"level/stage2", U"level/stage3" })
 			{
-				if (bodies[i].body.getPos().y > 500)
-				{
-					bodies.remove_at(i);
-				}
-				else
+				if (auto info = LevelInfo::Load(directory))
 				{
-					++i;
+					data.levels.emplace(directory, std::move(*info));
 				}
 			}
-		}
+		}, unpacked);
 
-		// カメラ更新
-		camera.update();
-		const auto t = camera.createTransformer();
+		startup.run();
+		Logger << startup.report();
+	}
 
-		// テクスチャ確認
-		if (!needle)
-		{
-			Print << U"Texture 読み込み失敗";
-		}
+	// 効果音のミキサー（ベンチマークと --no-audio では何も鳴らさない出力を使う）
+	manager.get()->sound.start((benchmark || System::GetCommandLineArgs().contains(U"--no-audio")) ? AudioDevice::Null : AudioDevice::Default);
 
-		// --- 描画 ---
+	// フレームレートの設定（--fps=N, --uncapped, --low-power）
+	manager.get()->pacer.setModeFromCommandLine();
+
+	// シーンキャッシュの上限（--scene-cache-mb=N、0 で無効）
+	// 物理演算の島を進めるスレッドの数（--physics-threads=N、メインスレッドを含む。0 か 1 で並列にしない）
+	size_t physicsWorkers = WorkStealingPool::DefaultWorkerCount();
 
-		// 地面
-		for (const auto& g : grounds)
+	for (const auto& arg : System::GetCommandLineArgs())
+	{
+		if (arg.starts_with(U"--scene-cache-mb="))
 		{
-			g.draw(Palette::Gray);
+			if (const auto megabytes = ParseOpt<size_t>(arg.substr(17)))
+			{
+				manager.get()->sceneCache.setCapacity(*megabytes << 20);
+			}
 		}
-
-		// 動く物体
-		for (const auto& b : bodies)
+		else if (arg.starts_with(U"--physics-threads="))
 		{
-			double scale = (b.radius * 2.0) / needle.width();
-			needle.scaled(0.2).rotated(b.body.getAngle()).drawAt(b.body.getPos());
+			if (const auto threads = ParseOpt<size_t>(arg.substr(18)))
+			{
+				physicsWorkers = ((*threads <= 1) ? 0 : (*threads - 1));
+			}
 		}
 	}
 
-private:
-
-	const Font m_font{ FontMethod::MSDF, 48, Typeface::Bold };
-	const Texture needle;
-	// --- スクロール関連 ---
-	double scrollY = 0.0;
-	const double scrollSpeed = 40.0;
-	const Font scrollFont{ 30 };
-	Array<String> lines;
-	// 設置物
-	Array<std::shared_ptr<IDraggable>> objects;
-	// 物理関連
-	constexpr static double StepTime = 1.0 / 200.0;
-	double accumulatedTime;
-	P2World world;
-	Array<MyBody> bodies;
-	Array<P2Body> grounds;
-	Camera2D camera;
-};
-
+	manager.get()->physicsPool = std::make_unique<WorkStealingPool>(physicsWorkers);
 
-void Main()
-{
-	// シーンマネージャーを作成
-	App manager;
+	// テレメトリの記録（--no-telemetry で無効）
+	if ((not benchmark) && (not System::GetCommandLineArgs().contains(U"--no-telemetry")))
+	{
+		manager.get()->telemetry.open(U"telemetry/session_{}.ntlm"_fmt(DateTime::Now().format(U"yyyyMMdd_HHmmss")));
+	}
 
 	// 各シーンを登録
 	manager.add<Title>(State::Title);
@@ -1218,11 +2504,39 @@ void Main()
 	// タイトルシーンから開始
 	manager.init(State::Title);
 
+	if (benchmark)
+	{
+		Console.open();
+		const bool passed = RunBenchmark(manager);
+		Console << (passed ? U"benchmark: PASSED" : U"benchmark: FAILED");
+		SetExitCode(passed);
+		return;
+	}
+
 	while (System::Update())
 	{
-		if (not manager.update())
+		manager.get()->pacer.beginFrame();
+
+		// 前フレーム以降の入力イベントを取り出す
+		manager.get()->input.beginFrame();
+
+		manager.get()->telemetry.push(TelemetryType::FrameTime, 0, 0, Scene::DeltaTime());
+
 		{
-			break;
+			const auto phase = manager.get()->profiler.scoped(FramePhase::Scene);
+
+			if (not manager.update())
+			{
+				break;
+			}
 		}
+
+		manager.get()->profiler.endFrame();
+		manager.get()->draw.endFrame();
+
+		// 次のフレームまで待機する
+		manager.get()->pacer.wait();
 	}
+
+	SaveProgress(*manager.get());
 }
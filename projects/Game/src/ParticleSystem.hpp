@@ -0,0 +1,257 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+# if defined(__AVX__)
+#	include <immintrin.h>
+#	define GAME_PARTICLE_AVX 1
+# elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#	include <emmintrin.h>
+#	define GAME_PARTICLE_SSE2 1
+# endif
+
+// パーティクルの種類
+enum class ParticleKind : uint8
+{
+	// 針が地面に当たったときの火花
+	Spark,
+
+	// 針が画面外へ落ちたときの土ぼこり
+	Dust,
+};
+
+// 容量に上限のあるパーティクルシステム
+// 各要素を別々の配列に持ち（Structure of Arrays）、位置と速度の更新を SIMD でまとめて行う
+// 配列は放出した数に合わせて倍々に広げるので、パーティクルを使わないステージではほとんどメモリを使わない
+// 描画は Buffer2D に頂点を詰めて、数回の描画呼び出しで済ませる
+class ParticleSystem
+{
+public:
+
+	// 同時に存在できるパーティクルの最大数
+	static constexpr size_t Capacity = 131072;
+
+	// 最初に確保するパーティクルの数
+	static constexpr size_t InitialCapacity = 1024;
+
+	// sprite: パーティクルの画像（アトラスの一部でもよい）
+	explicit ParticleSystem(const TextureRegion& sprite)
+		: m_sprite{ sprite } {}
+
+	// pos から count 個のパーティクルを放出する（容量を超えた分は捨てる）
+	// normal: 放出の中心方向, speed: 初速の目安
+	void emit(ParticleKind kind, const Vec2& pos, const Vec2& normal, double speed, size_t count)
+	{
+		const double baseAngle = Math::Atan2(normal.y, normal.x);
+		reserve(m_count + count);
+
+		for (size_t i = 0; (i < count) && (m_count < Capacity); ++i)
+		{
+			const size_t index = m_count++;
+			const double angle = baseAngle + Random(-0.9, 0.9);
+			const double v = speed * Random(0.3, 1.0);
+
+			m_x[index] = static_cast<float>(pos.x);
+			m_y[index] = static_cast<float>(pos.y);
+			m_vx[index] = static_cast<float>(Math::Cos(angle) * v);
+			m_vy[index] = static_cast<float>(Math::Sin(angle) * v);
+
+			if (kind == ParticleKind::Spark)
+			{
+				m_life[index] = static_cast<float>(Random(0.2, 0.5));
+				m_size[index] = static_cast<float>(Random(2.0, 5.0));
+				m_color[index] = ColorF{ 1.0, Random(0.5, 0.9), 0.2 }.toColor();
+			}
+			else
+			{
+				m_life[index] = static_cast<float>(Random(0.6, 1.2));
+				m_size[index] = static_cast<float>(Random(6.0, 14.0));
+				m_color[index] = ColorF{ 0.55, 0.5, 0.45, 0.6 }.toColor();
+			}
+		}
+	}
+
+	// 重力と空気抵抗をかけて deltaTime 秒進め、寿命の尽きたパーティクルを取り除く
+	void update(double deltaTime)
+	{
+		Integrate(m_x.data(), m_y.data(), m_vx.data(), m_vy.data(), m_life.data(), m_count,
+			static_cast<float>(deltaTime), Gravity, Drag);
+
+		// 寿命の尽きたものを末尾の要素で埋める
+		for (size_t i = 0; i < m_count;)
+		{
+			if (m_life[i] <= 0.0f)
+			{
+				const size_t last = --m_count;
+				m_x[i] = m_x[last];
+				m_y[i] = m_y[last];
+				m_vx[i] = m_vx[last];
+				m_vy[i] = m_vy[last];
+				m_life[i] = m_life[last];
+				m_size[i] = m_size[last];
+				m_color[i] = m_color[last];
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+
+	// すべてのパーティクルを描く
+	void draw() const
+	{
+		if (m_count == 0)
+		{
+			return;
+		}
+
+		const FloatRect& uv = m_sprite.uvRect;
+
+		// 1 つの Buffer2D のインデックスは 16 bit なので、QuadsPerBuffer 個ずつに分けて描く
+		for (size_t begin = 0; begin < m_count; begin += QuadsPerBuffer)
+		{
+			const size_t quads = Min(QuadsPerBuffer, (m_count - begin));
+			Buffer2D& buffer = m_buffer;
+
+			buffer.vertices.resize(quads * 4);
+			buffer.indices.resize(quads * 2);
+
+			for (size_t i = 0; i < quads; ++i)
+			{
+				const size_t p = (begin + i);
+				const float x = m_x[p];
+				const float y = m_y[p];
+				const float h = (m_size[p] * 0.5f);
+
+				// 寿命の終わりに向けてフェードアウトする
+				Float4 color = m_color[p].toFloat4();
+				color.w *= Min(m_life[p] * 4.0f, 1.0f);
+
+				Vertex2D* v = &buffer.vertices[i * 4];
+				v[0] = Vertex2D{ Float2{ x - h, y - h }, Float2{ uv.left, uv.top }, color };
+				v[1] = Vertex2D{ Float2{ x + h, y - h }, Float2{ uv.right, uv.top }, color };
+				v[2] = Vertex2D{ Float2{ x - h, y + h }, Float2{ uv.left, uv.bottom }, color };
+				v[3] = Vertex2D{ Float2{ x + h, y + h }, Float2{ uv.right, uv.bottom }, color };
+
+				const Vertex2D::IndexType base = static_cast<Vertex2D::IndexType>(i * 4);
+				buffer.indices[i * 2 + 0] = TriangleIndex{ base, static_cast<Vertex2D::IndexType>(base + 1), static_cast<Vertex2D::IndexType>(base + 2) };
+				buffer.indices[i * 2 + 1] = TriangleIndex{ static_cast<Vertex2D::IndexType>(base + 2), static_cast<Vertex2D::IndexType>(base + 1), static_cast<Vertex2D::IndexType>(base + 3) };
+			}
+
+			buffer.draw(m_sprite.texture);
+		}
+	}
+
+	// 現在のパーティクルの数
+	[[nodiscard]]
+	size_t size() const noexcept
+	{
+		return m_count;
+	}
+
+	// 確保している配列と頂点バッファの大きさ [バイト]
+	[[nodiscard]]
+	size_t memoryUsage() const noexcept
+	{
+		return ((m_x.size() * (sizeof(float) * 6 + sizeof(Color)))
+			+ (m_buffer.vertices.capacity() * sizeof(Vertex2D)) + (m_buffer.indices.capacity() * sizeof(TriangleIndex)));
+	}
+
+	// 位置と速度を更新し、寿命を減らす
+	// SIMD で一度に処理できない端数はスカラーで処理する
+	static void Integrate(float* x, float* y, float* vx, float* vy, float* life, size_t count, float dt, float gravity, float drag)
+	{
+		// dt が大きい（フレームが詰まった）ときも速度の向きが反転しないよう、指数で減衰させる
+		const float damping = std::exp(-drag * dt);
+		const float gdt = (gravity * dt);
+		size_t i = 0;
+
+	# if defined(GAME_PARTICLE_AVX)
+
+		const __m256 vdt = _mm256_set1_ps(dt);
+		const __m256 vdamping = _mm256_set1_ps(damping);
+		const __m256 vgdt = _mm256_set1_ps(gdt);
+
+		for (; (i + 8) <= count; i += 8)
+		{
+			const __m256 nvx = _mm256_mul_ps(_mm256_loadu_ps(vx + i), vdamping);
+			const __m256 nvy = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(vy + i), vdamping), vgdt);
+			_mm256_storeu_ps(vx + i, nvx);
+			_mm256_storeu_ps(vy + i, nvy);
+			_mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_mul_ps(nvx, vdt)));
+			_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(nvy, vdt)));
+			_mm256_storeu_ps(life + i, _mm256_sub_ps(_mm256_loadu_ps(life + i), vdt));
+		}
+
+	# elif defined(GAME_PARTICLE_SSE2)
+
+		const __m128 vdt = _mm_set1_ps(dt);
+		const __m128 vdamping = _mm_set1_ps(damping);
+		const __m128 vgdt = _mm_set1_ps(gdt);
+
+		for (; (i + 4) <= count; i += 4)
+		{
+			const __m128 nvx = _mm_mul_ps(_mm_loadu_ps(vx + i), vdamping);
+			const __m128 nvy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(vy + i), vdamping), vgdt);
+			_mm_storeu_ps(vx + i, nvx);
+			_mm_storeu_ps(vy + i, nvy);
+			_mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(nvx, vdt)));
+			_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(nvy, vdt)));
+			_mm_storeu_ps(life + i, _mm_sub_ps(_mm_loadu_ps(life + i), vdt));
+		}
+
+	# endif
+
+		for (; i < count; ++i)
+		{
+			vx[i] = (vx[i] * damping);
+			vy[i] = (vy[i] * damping + gdt);
+			x[i] += (vx[i] * dt);
+			y[i] += (vy[i] * dt);
+			life[i] -= dt;
+		}
+	}
+
+private:
+
+	// 重力加速度 [px/s^2]
+	static constexpr float Gravity = 980.0f;
+
+	// 空気抵抗の係数 [1/s]
+	static constexpr float Drag = 1.5f;
+
+	// 1 つの Buffer2D に入れる四角形の数（頂点番号が 16 bit に収まる数）
+	static constexpr size_t QuadsPerBuffer = 16384;
+
+	Array<float> m_x;
+	Array<float> m_y;
+	Array<float> m_vx;
+	Array<float> m_vy;
+	Array<float> m_life;
+	Array<float> m_size;
+	Array<Color> m_color;
+	size_t m_count = 0;
+
+	TextureRegion m_sprite;
+
+	// 描画のたびに確保し直さないよう使い回す頂点バッファ
+	mutable Buffer2D m_buffer;
+
+	// 配列を count 個以上（Capacity まで）に広げる
+	void reserve(size_t count)
+	{
+		if (count <= m_x.size())
+		{
+			return;
+		}
+
+		const size_t size = Min(Max({ count, (m_x.size() * 2), InitialCapacity }), Capacity);
+		m_x.resize(size);
+		m_y.resize(size);
+		m_vx.resize(size);
+		m_vy.resize(size);
+		m_life.resize(size);
+		m_size.resize(size);
+		m_color.resize(size);
+	}
+};
@@ -0,0 +1,271 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <span>
+
+// トリガー領域の種類
+enum class TriggerKind : uint8
+{
+	// 針が入るとクリア
+	Goal,
+
+	// 針が入ると消える（画面外への落下）
+	Kill,
+};
+
+// 物体が入ったことを検出する矩形の領域（level.json の "triggers"）
+struct TriggerRegion
+{
+	TriggerKind kind = TriggerKind::Goal;
+
+	RectF rect{ 0, 0, 0, 0 };
+
+	[[nodiscard]]
+	friend bool operator ==(const TriggerRegion& a, const TriggerRegion& b) noexcept
+	{
+		return ((a.kind == b.kind) && (a.rect == b.rect));
+	}
+};
+
+// トリガー領域を一様なグリッドに登録し、位置を含む領域を少ないセルの探索で見つける
+// 多くのセルにまたがる大きな領域（画面下の落下判定など）は別に持ち、常に調べる
+class TriggerIndex
+{
+public:
+
+	// 1 つの領域を登録するセル数の上限（これを超える領域は大きな領域として扱う）
+	static constexpr int32 MaxCellsPerRegion = 64;
+
+	TriggerIndex() = default;
+
+	explicit TriggerIndex(const Array<TriggerRegion>& regions, double cellSize = 256.0)
+		: m_regions{ regions }
+		, m_cellSize{ cellSize }
+	{
+		for (uint32 i = 0; i < m_regions.size(); ++i)
+		{
+			const RectF& rect = m_regions[i].rect;
+			const Point first = cellAt(rect.tl());
+			const Point last = cellAt(rect.br());
+
+			if (MaxCellsPerRegion < ((last.x - first.x + 1) * (last.y - first.y + 1)))
+			{
+				m_large << i;
+				continue;
+			}
+
+			for (int32 y = first.y; y <= last.y; ++y)
+			{
+				for (int32 x = first.x; x <= last.x; ++x)
+				{
+					m_cells[Point{ x, y }] << i;
+				}
+			}
+		}
+	}
+
+	// pos を含む領域の番号ごとに f(index) を呼ぶ
+	template <class Fty>
+	void query(const Vec2& pos, Fty f) const
+	{
+		if (const auto it = m_cells.find(cellAt(pos)); it != m_cells.end())
+		{
+			for (const uint32 index : it->second)
+			{
+				if (m_regions[index].rect.intersects(pos))
+				{
+					f(index);
+				}
+			}
+		}
+
+		for (const uint32 index : m_large)
+		{
+			if (m_regions[index].rect.intersects(pos))
+			{
+				f(index);
+			}
+		}
+	}
+
+	[[nodiscard]]
+	const Array<TriggerRegion>& regions() const noexcept
+	{
+		return m_regions;
+	}
+
+private:
+
+	Array<TriggerRegion> m_regions;
+	double m_cellSize = 256.0;
+	HashTable<Point, Array<uint32>> m_cells;
+	Array<uint32> m_large;
+
+	[[nodiscard]]
+	Point cellAt(const Vec2& pos) const
+	{
+		return Point{ static_cast<int32>(Floor(pos.x / m_cellSize)), static_cast<int32>(Floor(pos.y / m_cellSize)) };
+	}
+};
+
+// 新しく始まった接触
+struct ContactEvent
+{
+	P2BodyID a = 0;
+
+	P2BodyID b = 0;
+
+	// 接触点（ワールド座標）
+	Vec2 point{ 0, 0 };
+
+	// 接触面の法線
+	Vec2 normal{ 0, 0 };
+};
+
+// 物体がトリガー領域に入った
+struct TriggerEvent
+{
+	TriggerKind kind = TriggerKind::Goal;
+
+	// TriggerIndex::regions() の番号
+	uint32 trigger = 0;
+
+	P2BodyID body = 0;
+
+	// 入ったときの物体の位置
+	Vec2 pos{ 0, 0 };
+};
+
+// 物理ステップごとに、新しく始まった接触とトリガー領域への進入を集めるバッファ
+// ステップのたびに getCollisions() や位置を各所で調べ直すのではなく、
+// 1 フレーム分のイベントをここに溜めておき、ゲーム側はフレームの終わりにまとめて処理して clear() する
+// 配列は使い回すので、容量に達した後はステップごとのメモリ確保が起きない
+class PhysicsEvents
+{
+public:
+
+	// あらかじめ確保しておくイベントの数
+	static constexpr size_t InitialCapacity = 256;
+
+	PhysicsEvents()
+	{
+		m_contacts.reserve(InitialCapacity);
+		m_triggers.reserve(InitialCapacity);
+		m_touching.reserve(InitialCapacity);
+		m_previousTouching.reserve(InitialCapacity);
+		m_inside.reserve(InitialCapacity);
+		m_previousInside.reserve(InitialCapacity);
+	}
+
+	// 1 ステップ分のイベントを集める（P2World::update() の直後に呼ぶ）
+	// bodies: トリガー領域を調べる物体
+	template <class Bodies, class Projection>
+	void collect(const P2World& world, const TriggerIndex& triggers, const Bodies& bodies, Projection toBody)
+	{
+		collect(world.getCollisions(), triggers, bodies, toBody);
+	}
+
+	// collisions: (P2ContactPair, P2Collision) の組の並び（島ごとに進めたワールドの接触など）
+	template <class Collisions, class Bodies, class Projection>
+	void collect(const Collisions& collisions, const TriggerIndex& triggers, const Bodies& bodies, Projection toBody)
+	{
+		m_stepBegin = m_triggers.size();
+
+		// 前のステップでは接触していなかった組
+		std::swap(m_touching, m_previousTouching);
+		m_touching.clear();
+
+		for (auto&& [pair, collision] : collisions)
+		{
+			const Pair key{ pair.a, pair.b };
+			m_touching << key;
+
+			if (std::binary_search(m_previousTouching.begin(), m_previousTouching.end(), key))
+			{
+				continue;
+			}
+
+			for (const auto& contact : collision)
+			{
+				m_contacts << ContactEvent{ pair.a, pair.b, contact.point, collision.normal };
+			}
+		}
+
+		std::sort(m_touching.begin(), m_touching.end());
+
+		// 前のステップでは外にいた領域
+		std::swap(m_inside, m_previousInside);
+		m_inside.clear();
+
+		for (const auto& element : bodies)
+		{
+			const P2Body& body = toBody(element);
+			const Vec2 pos = body.getPos();
+
+			triggers.query(pos, [&](uint32 index)
+			{
+				const Pair key{ index, body.id() };
+				m_inside << key;
+
+				if (not std::binary_search(m_previousInside.begin(), m_previousInside.end(), key))
+				{
+					m_triggers << TriggerEvent{ triggers.regions()[index].kind, index, body.id(), pos };
+				}
+			});
+		}
+
+		std::sort(m_inside.begin(), m_inside.end());
+	}
+
+	// このフレームで新しく始まった接触
+	[[nodiscard]]
+	const Array<ContactEvent>& contacts() const noexcept
+	{
+		return m_contacts;
+	}
+
+	// このフレームで起きたトリガー領域への進入
+	[[nodiscard]]
+	const Array<TriggerEvent>& triggers() const noexcept
+	{
+		return m_triggers;
+	}
+
+	// 直前の collect() で起きたトリガー領域への進入
+	[[nodiscard]]
+	std::span<const TriggerEvent> stepTriggers() const noexcept
+	{
+		return std::span<const TriggerEvent>{ (m_triggers.data() + m_stepBegin), (m_triggers.size() - m_stepBegin) };
+	}
+
+	// フレームのイベントを処理し終えたら呼ぶ（接触・進入中の状態は残す）
+	void clear() noexcept
+	{
+		m_contacts.clear();
+		m_triggers.clear();
+		m_stepBegin = 0;
+	}
+
+	// 接触・進入中の状態も含めてすべて消す
+	void reset() noexcept
+	{
+		clear();
+		m_touching.clear();
+		m_previousTouching.clear();
+		m_inside.clear();
+		m_previousInside.clear();
+	}
+
+private:
+
+	using Pair = std::pair<uint64, uint64>;
+
+	Array<ContactEvent> m_contacts;
+	Array<TriggerEvent> m_triggers;
+	size_t m_stepBegin = 0;
+
+	// 接触している組と、領域の中にいる（領域, 物体）の組。二分探索できるよう整列しておく
+	Array<Pair> m_touching;
+	Array<Pair> m_previousTouching;
+	Array<Pair> m_inside;
+	Array<Pair> m_previousInside;
+};
@@ -0,0 +1,512 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "LevelStreaming.hpp"
+# include "TrajectoryPredictor.hpp"
+# include "WorkStealingPool.hpp"
+
+// 島ごとに進めたワールドの接触（物体の ID は元のワールドのものに置き換えてある）
+using IslandCollision = std::pair<P2ContactPair, P2Collision>;
+
+// 動く物体の多いステージで、物理演算を互いに触れ合わない物体の集まり（島）に分けて並列に進める
+//
+// 1 つの P2World の update() は 1 つのスレッドでしか進められないので、島ごとに別の P2World を持つ
+// 島のワールドには、島の物体と、島の周りの地面と設置物の写しだけを入れる
+// 元のワールドの物体は、島のワールドで進めた結果を写す「影」として残すので、
+// 位置の参照やトリガーの判定、描画はこれまでどおり元の物体に対して行える
+//
+// ・島の分け方は物体の並び順だけで決まり、島どうしは互いに影響しないので、
+//   何スレッドで進めても（スレッドプールがなくても）結果は同じになる
+// ・島の顔ぶれが変わらない間は同じワールドを使い続ける（接触の解決の続きから進める）
+//   島がつながったり分かれたり、地面や設置物が変わったりしたときだけ、島のワールドを作り直す
+// ・島の物体がすべて眠っていたら、その島は進めない
+class PhysicsIslands
+{
+public:
+
+	// これ以上の動く物体があるときに島に分けて進める（少ないときは 1 つのワールドのほうが速い）
+	static constexpr size_t MinBodies = 128;
+
+	// 1 ステップで近づける距離に加える余裕
+	static constexpr double ContactMargin = 4.0;
+
+	// 島のワールドに地面と設置物を写す範囲（島の範囲からの余白）
+	// 島がこの範囲から出そうになったら作り直す
+	static constexpr double StaticMargin = 160.0;
+
+	// 時間のかかった島の記録
+	struct IslandTime
+	{
+		size_t bodies = 0;
+
+		double ms = 0.0;
+	};
+
+	// 直前のステップの統計
+	struct Stats
+	{
+		size_t islands = 0;
+
+		// 眠っていて進めなかった島
+		size_t sleeping = 0;
+
+		// 作り直した島
+		size_t rebuilt = 0;
+
+		// 島を進めたスレッドの数
+		size_t threads = 1;
+
+		// 島ごとの時間の合計 [ミリ秒]
+		double totalMs = 0.0;
+
+		// 島をすべて進め終わるまでの時間 [ミリ秒]
+		double wallMs = 0.0;
+
+		// 時間のかかった順の島（最大 SlowestCount 個）
+		Array<IslandTime> slowest;
+	};
+
+	static constexpr size_t SlowestCount = 3;
+
+	PhysicsIslands() = default;
+
+	PhysicsIslands(const PhysicsIslands&) = delete;
+	PhysicsIslands& operator =(const PhysicsIslands&) = delete;
+
+	// 島をすべて捨てる（元のワールドで進めるときに呼ぶ）
+	void clear()
+	{
+		m_islands.clear();
+		m_collisions.clear();
+		m_stats = Stats{};
+	}
+
+	[[nodiscard]]
+	bool isActive() const noexcept
+	{
+		return (not m_islands.isEmpty());
+	}
+
+	// 1 ステップ進め、結果を元の物体に写す
+	// bodies: 動く物体, toBody: 要素から元のワールドの P2Body& を得る関数
+	// chunks: 地面, placed: 設置物（ワールド座標）, bodySize: 動く物体（長方形）の大きさ
+	// pool: 島を進めるスレッド（nullptr なら呼んだスレッドだけで進める）
+	template <class Bodies, class Projection>
+	void step(Bodies& bodies, Projection toBody, const ChunkedWorld& chunks, const PlacedShapes& placed, const Vec2& bodySize, double stepTime, WorkStealingPool* pool)
+	{
+		// 地面か設置物が変わったら、すべての島を作り直す
+		const bool staticsChanged = ((chunks.revision() != m_chunksRevision) || (placed != m_placed));
+
+		if (staticsChanged)
+		{
+			m_chunksRevision = chunks.revision();
+			m_placed = placed;
+		}
+
+		partition(bodies, toBody, (bodySize.length() / 2.0), stepTime);
+		rebuild(bodies, toBody, chunks, bodySize, staticsChanged);
+
+		// 起きている島を、物体の多い順にスレッドに配る
+		m_awake.clear();
+		m_stats.sleeping = 0;
+
+		for (size_t i = 0; i < m_islands.size(); ++i)
+		{
+			Island& island = m_islands[i];
+			island.asleep = island.bodies.none([](const P2Body& body) { return body.isAwake(); });
+
+			if (island.asleep)
+			{
+				++m_stats.sleeping;
+			}
+			else
+			{
+				m_awake << i;
+			}
+		}
+
+		std::stable_sort(m_awake.begin(), m_awake.end(), [this](size_t a, size_t b) { return (m_islands[b].bodies.size() < m_islands[a].bodies.size()); });
+
+		const auto stepIsland = [this, stepTime](size_t n)
+		{
+			Island& island = m_islands[m_awake[n]];
+			const auto start = std::chrono::steady_clock::now();
+			island.world.update(stepTime);
+			island.stepMs = (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		};
+
+		const auto start = std::chrono::steady_clock::now();
+
+		if (pool)
+		{
+			pool->parallelFor(m_awake.size(), stepIsland);
+		}
+		else
+		{
+			for (size_t n = 0; n < m_awake.size(); ++n)
+			{
+				stepIsland(n);
+			}
+		}
+
+		m_stats.wallMs = (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		m_stats.threads = (pool ? pool->threadCount() : 1);
+
+		// 島の順に、結果を元の物体に写し、接触を集める
+		m_collisions.clear();
+		m_stats.islands = m_islands.size();
+		m_stats.totalMs = 0.0;
+		m_stats.slowest.clear();
+
+		for (const auto& island : m_islands)
+		{
+			if (not island.asleep)
+			{
+				for (size_t k = 0; k < island.bodies.size(); ++k)
+				{
+					const P2Body& from = island.bodies[k];
+					P2Body& to = toBody(bodies[island.members[k]]);
+					to.setPos(from.getPos());
+					to.setAngle(from.getAngle());
+					to.setVelocity(from.getVelocity());
+					to.setAngularVelocity(from.getAngularVelocity());
+				}
+
+				m_stats.totalMs += island.stepMs;
+				addSlowest(IslandTime{ island.bodies.size(), island.stepMs });
+			}
+
+			// 眠っている島の接触も含める（起きたときに、続いている接触を新しい接触と取り違えないように）
+			for (auto&& [pair, collision] : island.world.getCollisions())
+			{
+				m_collisions << IslandCollision{ P2ContactPair{ island.outer(pair.a), island.outer(pair.b) }, collision };
+			}
+		}
+	}
+
+	// 直前の step() で島のワールドに起きている接触
+	[[nodiscard]]
+	const Array<IslandCollision>& collisions() const noexcept
+	{
+		return m_collisions;
+	}
+
+	[[nodiscard]]
+	const Stats& stats() const noexcept
+	{
+		return m_stats;
+	}
+
+private:
+
+	// 島のワールドの地面と設置物に付ける ID の目印（元のワールドの ID と重ならないよう最上位ビットを立てる）
+	static constexpr P2BodyID StaticID = (P2BodyID{ 1 } << (sizeof(P2BodyID) * 8 - 1));
+
+	struct Island
+	{
+		P2World world;
+
+		// 島の物体の、bodies での番号（並び順）と、元のワールドの ID
+		Array<size_t> members;
+		Array<P2BodyID> keys;
+
+		// 島のワールドの物体（members と同じ順）
+		Array<P2Body> bodies;
+
+		// 地面と設置物の写し
+		Array<P2Body> statics;
+
+		// 島のワールドの ID → 元のワールドの ID（地面と設置物には StaticID の付いた ID）
+		HashTable<P2BodyID, P2BodyID> outerIDs;
+
+		// 地面と設置物を写した範囲
+		RectF covered{ 0, 0, 0, 0 };
+
+		// 物体がすべて眠っていて、直前のステップで進めなかったか
+		bool asleep = false;
+
+		double stepMs = 0.0;
+
+		[[nodiscard]]
+		P2BodyID outer(P2BodyID id) const
+		{
+			const auto it = outerIDs.find(id);
+			return ((it != outerIDs.end()) ? it->second : (StaticID | id));
+		}
+	};
+
+	// 物体の範囲と、つながっている物体の代表（union-find）
+	struct Entry
+	{
+		RectF bounds;
+
+		P2BodyID key = 0;
+
+		size_t parent = 0;
+	};
+
+	// 島の候補（物体がつながっている集まり）
+	struct Group
+	{
+		Array<size_t> members;
+
+		RectF bounds;
+	};
+
+	Array<Island> m_islands;
+	Array<Entry> m_entries;
+	Array<size_t> m_sweep;
+	Array<size_t> m_active;
+	Array<Group> m_groups;
+	HashTable<size_t, size_t> m_groupOf;
+	HashTable<P2BodyID, size_t> m_previousByKey;
+	Array<size_t> m_awake;
+	Array<IslandCollision> m_collisions;
+
+	uint64 m_chunksRevision = ~0ull;
+	PlacedShapes m_placed;
+
+	Stats m_stats;
+
+	[[nodiscard]]
+	size_t find(size_t i)
+	{
+		while (m_entries[i].parent != i)
+		{
+			m_entries[i].parent = m_entries[m_entries[i].parent].parent;
+			i = m_entries[i].parent;
+		}
+
+		return i;
+	}
+
+	// 番号の小さいほうを代表にする（並び順だけで結果が決まるように）
+	void unite(size_t a, size_t b)
+	{
+		a = find(a);
+		b = find(b);
+
+		if (a != b)
+		{
+			m_entries[Max(a, b)].parent = Min(a, b);
+		}
+	}
+
+	// 範囲が重なる物体をつなぎ、島の候補に分ける（x 方向に並べて、重なりうる組だけを調べる）
+	template <class Bodies, class Projection>
+	void partition(Bodies& bodies, Projection toBody, double radius, double stepTime)
+	{
+		m_entries.clear();
+		m_sweep.clear();
+
+		for (size_t i = 0; i < bodies.size(); ++i)
+		{
+			const P2Body& body = toBody(bodies[i]);
+			const double r = (radius + ContactMargin + body.getVelocity().length() * stepTime);
+			m_entries << Entry{ RectF{ Arg::center = body.getPos(), (r * 2), (r * 2) }, body.id(), i };
+			m_sweep << i;
+		}
+
+		std::sort(m_sweep.begin(), m_sweep.end(), [this](size_t a, size_t b)
+		{
+			return ((m_entries[a].bounds.x != m_entries[b].bounds.x) ? (m_entries[a].bounds.x < m_entries[b].bounds.x) : (a < b));
+		});
+
+		m_active.clear();
+
+		for (const size_t i : m_sweep)
+		{
+			const RectF& bounds = m_entries[i].bounds;
+			m_active.remove_if([&](size_t a) { return (m_entries[a].bounds.rightX() < bounds.x); });
+
+			for (const size_t a : m_active)
+			{
+				if (m_entries[a].bounds.intersects(bounds))
+				{
+					unite(a, i);
+				}
+			}
+
+			m_active << i;
+		}
+
+		// 代表の番号の順に集める（島の順番も物体の並び順だけで決まる）
+		m_groups.clear();
+		m_groupOf.clear();
+
+		for (size_t i = 0; i < m_entries.size(); ++i)
+		{
+			const size_t root = find(i);
+			auto [it, inserted] = m_groupOf.try_emplace(root, m_groups.size());
+
+			if (inserted)
+			{
+				m_groups << Group{ {}, m_entries[i].bounds };
+			}
+
+			Group& group = m_groups[it->second];
+			group.members << i;
+			const RectF& bounds = m_entries[i].bounds;
+			const Vec2 tl{ Min(group.bounds.x, bounds.x), Min(group.bounds.y, bounds.y) };
+			const Vec2 br{ Max(group.bounds.br().x, bounds.br().x), Max(group.bounds.br().y, bounds.br().y) };
+			group.bounds = RectF{ tl, (br - tl) };
+		}
+	}
+
+	// 顔ぶれが同じで、地面を写した範囲に収まっている島はそのまま使い、ほかは作り直す
+	template <class Bodies, class Projection>
+	void rebuild(Bodies& bodies, Projection toBody, const ChunkedWorld& chunks, const Vec2& bodySize, bool staticsChanged)
+	{
+		m_previousByKey.clear();
+
+		if (not staticsChanged)
+		{
+			for (size_t i = 0; i < m_islands.size(); ++i)
+			{
+				m_previousByKey.emplace(m_islands[i].keys.front(), i);
+			}
+		}
+
+		Array<Island> previous = std::move(m_islands);
+		m_islands.clear();
+		m_stats.rebuilt = 0;
+
+		Array<std::shared_ptr<const ChunkData>> loaded;
+		bool loadedChunks = false;
+
+		for (const auto& group : m_groups)
+		{
+			const P2BodyID firstKey = m_entries[group.members.front()].key;
+
+			if (const auto it = m_previousByKey.find(firstKey); it != m_previousByKey.end())
+			{
+				Island& island = previous[it->second];
+
+				if ((island.members.size() == group.members.size())
+					&& std::equal(group.members.begin(), group.members.end(), island.keys.begin(), [this](size_t i, P2BodyID key) { return (m_entries[i].key == key); })
+					&& island.covered.contains(group.bounds))
+				{
+					// 物体が消えると bodies での番号がずれるので、番号だけは付け直す
+					island.members = group.members;
+					m_islands << std::move(island);
+					continue;
+				}
+			}
+
+			if (not loadedChunks)
+			{
+				// 地面を写す順番を決めておく（島のワールドの中身が読み込みの順に左右されないように）
+				loaded = chunks.loadedChunks();
+				std::sort(loaded.begin(), loaded.end(), [](const auto& a, const auto& b)
+				{
+					return ((a->coord.y != b->coord.y) ? (a->coord.y < b->coord.y) : (a->coord.x < b->coord.x));
+				});
+				loadedChunks = true;
+			}
+
+			m_islands << build(bodies, toBody, group, loaded, bodySize);
+			++m_stats.rebuilt;
+		}
+	}
+
+	template <class Bodies, class Projection>
+	[[nodiscard]]
+	Island build(Bodies& bodies, Projection toBody, const Group& group, const Array<std::shared_ptr<const ChunkData>>& loaded, const Vec2& bodySize) const
+	{
+		Island island;
+		island.covered = group.bounds.stretched(StaticMargin);
+
+		const auto addStatic = [&](P2Body&& body, uint64 source, uint64 index)
+		{
+			// 同じ地面・設置物には、島を作り直しても同じ ID を付ける
+			island.outerIDs.emplace(body.id(), (StaticID | (((source * 0x9E37'79B9'7F4A'7C15ull) ^ index) & ~StaticID)));
+			island.statics << std::move(body);
+		};
+
+		for (const auto& chunk : loaded)
+		{
+			const uint64 source = ((static_cast<uint64>(static_cast<uint32>(chunk->coord.x)) << 32) | static_cast<uint32>(chunk->coord.y));
+			uint64 index = 0;
+
+			for (const auto& line : chunk->lines)
+			{
+				if (island.covered.intersects(line))
+				{
+					addStatic(island.world.createLine(P2Static, Vec2{ 0, 0 }, line), source, index);
+				}
+
+				++index;
+			}
+
+			for (const auto& lineString : chunk->lineStrings)
+			{
+				if (island.covered.intersects(lineString.calculateBoundingRect()))
+				{
+					addStatic(island.world.createLineString(P2Static, Vec2{ 0, 0 }, lineString), source, index);
+				}
+
+				++index;
+			}
+
+			for (const auto& rect : chunk->rects)
+			{
+				if (island.covered.intersects(rect))
+				{
+					addStatic(island.world.createRect(P2Static, rect.center(), rect.size), source, index);
+				}
+
+				++index;
+			}
+		}
+
+		// 設置物（地面とは別の目印を付ける）
+		uint64 part = 0;
+
+		for (const auto& circle : m_placed.circles)
+		{
+			if (island.covered.intersects(circle))
+			{
+				addStatic(island.world.createCircle(P2Static, circle.center, circle.r), ~0ull, part);
+			}
+
+			++part;
+		}
+
+		for (const auto& rect : m_placed.rects)
+		{
+			if (island.covered.intersects(rect))
+			{
+				addStatic(island.world.createRect(P2Static, rect.center(), rect.size), ~0ull, part);
+			}
+
+			++part;
+		}
+
+		// 島の物体は、元の物体の今の状態から作る
+		for (const size_t i : group.members)
+		{
+			const P2Body& from = toBody(bodies[i]);
+			P2Body body = island.world.createRect(P2Dynamic, from.getPos(), bodySize);
+			body.setAngle(from.getAngle());
+			body.setVelocity(from.getVelocity());
+			body.setAngularVelocity(from.getAngularVelocity());
+
+			island.outerIDs.emplace(body.id(), from.id());
+			island.members << i;
+			island.keys << from.id();
+			island.bodies << std::move(body);
+		}
+
+		return island;
+	}
+
+	void addSlowest(const IslandTime& time)
+	{
+		m_stats.slowest << time;
+		std::sort(m_stats.slowest.begin(), m_stats.slowest.end(), [](const IslandTime& a, const IslandTime& b) { return (b.ms < a.ms); });
+
+		if (SlowestCount < m_stats.slowest.size())
+		{
+			m_stats.slowest.pop_back();
+		}
+	}
+};
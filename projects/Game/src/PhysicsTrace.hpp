@@ -0,0 +1,145 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// 物理演算の結果が変わっていないことを確かめるための、一定ステップごとのハッシュ値の列
+//
+// ファイルの形式（テキスト）:
+//   1 行目: 総ステップ数 ハッシュを取る間隔
+//   2 行目以降: 各時点のハッシュ値（16 進数）
+struct PhysicsTrace
+{
+	uint32 steps = 0;
+
+	uint32 interval = 0;
+
+	Array<uint64> hashes;
+
+	[[nodiscard]]
+	static Optional<PhysicsTrace> Load(const FilePath& path)
+	{
+		TextReader reader{ path };
+
+		if (not reader)
+		{
+			return none;
+		}
+
+		PhysicsTrace trace;
+		String line;
+
+		if (not reader.readLine(line))
+		{
+			return none;
+		}
+
+		const Array<String> header = line.split(U' ');
+
+		if (header.size() != 2)
+		{
+			return none;
+		}
+
+		trace.steps = ParseOr<uint32>(header[0], 0);
+		trace.interval = ParseOr<uint32>(header[1], 0);
+
+		while (reader.readLine(line))
+		{
+			if (const auto hash = ParseIntOpt<uint64>(line, Arg::radix = 16))
+			{
+				trace.hashes << *hash;
+			}
+		}
+
+		return trace;
+	}
+
+	bool save(const FilePath& path) const
+	{
+		TextWriter writer{ path };
+
+		if (not writer)
+		{
+			return false;
+		}
+
+		writer.writeln(U"{} {}"_fmt(steps, interval));
+
+		for (const auto& hash : hashes)
+		{
+			writer.writeln(U"{:016X}"_fmt(hash));
+		}
+
+		return true;
+	}
+
+	// 最初に食い違った時点のステップ数（一致すれば none）
+	[[nodiscard]]
+	Optional<uint32> firstMismatch(const PhysicsTrace& other) const
+	{
+		if ((steps != other.steps) || (interval != other.interval))
+		{
+			return 0;
+		}
+
+		const size_t count = Min(hashes.size(), other.hashes.size());
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (hashes[i] != other.hashes[i])
+			{
+				return static_cast<uint32>((i + 1) * interval);
+			}
+		}
+
+		if (hashes.size() != other.hashes.size())
+		{
+			return static_cast<uint32>((count + 1) * interval);
+		}
+
+		return none;
+	}
+};
+
+// 物理ボディの状態を少しずつ混ぜ込んでハッシュ値を作る（FNV-1a）
+class PhysicsHasher
+{
+public:
+
+	void add(const P2Body& body)
+	{
+		add(body.id());
+		add(body.getPos().x);
+		add(body.getPos().y);
+		add(body.getAngle());
+		add(body.getVelocity().x);
+		add(body.getVelocity().y);
+		add(body.getAngularVelocity());
+	}
+
+	template <class Type>
+	void add(const Type& value)
+	{
+		static_assert(std::is_trivially_copyable_v<Type>);
+
+		const auto* bytes = reinterpret_cast<const uint8*>(&value);
+
+		for (size_t i = 0; i < sizeof(Type); ++i)
+		{
+			m_hash = ((m_hash ^ bytes[i]) * Prime);
+		}
+	}
+
+	[[nodiscard]]
+	uint64 value() const noexcept
+	{
+		return m_hash;
+	}
+
+private:
+
+	static constexpr uint64 OffsetBasis = 14695981039346656037ULL;
+
+	static constexpr uint64 Prime = 1099511628211ULL;
+
+	uint64 m_hash = OffsetBasis;
+};
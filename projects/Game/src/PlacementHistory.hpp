@@ -0,0 +1,245 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// 設置物を動かした操作の 1 件（どの設置物を、どこからどこへ動かしたか）
+// 1 回のドラッグ（押してから離すまで）を 1 件にまとめる
+struct PlacementCommand
+{
+	// 設置物の番号
+	uint16 object = 0;
+
+	// 動かす前と後の中心（シーン座標）
+	Float2 from{ 0, 0 };
+
+	Float2 to{ 0, 0 };
+};
+
+// 設置物の操作の履歴（元に戻す・やり直す）
+// 新しい操作は決まった件数の環状バッファに、そのまま記録する
+// あふれた古い操作は、量子化して可変長で符号化し、バイト列（退避領域）の末尾に積む（1 件 10 ～ 15 バイトほどで、そのままの半分あまり）
+// 退避領域の各件は先頭と末尾に長さを持つので、どちらの向きにも 1 件ずつ一定の時間で読める
+// 退避領域も SpillCapacity バイトを超えたら、古いものから捨てる（環状バッファと合わせて、千数百件までさかのぼれる）
+// 元に戻す・やり直すは 1 件の位置を書き戻すだけなので、履歴の長さによらず一定の時間で済む
+class PlacementHistory
+{
+public:
+
+	// 環状バッファに記録できる操作の数
+	static constexpr size_t Capacity = 256;
+
+	// 退避領域の大きさの上限 [バイト]
+	static constexpr size_t SpillCapacity = (16 * 1024);
+
+	// 退避した操作の座標の量子化の細かさ（1/16 ピクセル）
+	static constexpr double PositionScale = 16.0;
+
+	// 操作を記録する（元に戻した操作があれば、やり直せなくなる）
+	void record(const PlacementCommand& command)
+	{
+		if (m_spillCursor < m_spill.size())
+		{
+			// 退避領域の途中まで戻していたら、環状バッファの操作もすべてやり直せなくなる
+			m_spill.resize(m_spillCursor);
+			m_begin = m_size = m_cursor = 0;
+		}
+
+		m_size = m_cursor;
+
+		if (m_size == Capacity)
+		{
+			spill(m_commands[m_begin]);
+			m_begin = ((m_begin + 1) % Capacity);
+			--m_size;
+		}
+
+		m_commands[(m_begin + m_size) % Capacity] = command;
+		m_cursor = ++m_size;
+	}
+
+	// 直前の操作を取り出す（なければ none）。from の位置に戻す
+	[[nodiscard]]
+	Optional<PlacementCommand> undo()
+	{
+		if (m_cursor != 0)
+		{
+			--m_cursor;
+			return m_commands[(m_begin + m_cursor) % Capacity];
+		}
+
+		if (m_spillCursor != 0)
+		{
+			m_spillCursor -= m_spill[m_spillCursor - 1];
+			return decode(m_spillCursor);
+		}
+
+		return none;
+	}
+
+	// 元に戻した操作を取り出す（なければ none）。to の位置に動かす
+	[[nodiscard]]
+	Optional<PlacementCommand> redo()
+	{
+		if (m_spillCursor < m_spill.size())
+		{
+			const size_t offset = m_spillCursor;
+			m_spillCursor += m_spill[offset];
+			return decode(offset);
+		}
+
+		if (m_cursor != m_size)
+		{
+			return m_commands[(m_begin + m_cursor++) % Capacity];
+		}
+
+		return none;
+	}
+
+	[[nodiscard]]
+	bool canUndo() const noexcept
+	{
+		return ((m_cursor != 0) || (m_spillCursor != 0));
+	}
+
+	[[nodiscard]]
+	bool canRedo() const noexcept
+	{
+		return ((m_spillCursor != m_spill.size()) || (m_cursor != m_size));
+	}
+
+	void clear() noexcept
+	{
+		m_begin = m_size = m_cursor = 0;
+		m_spill.clear();
+		m_spillCursor = 0;
+	}
+
+	// 推定メモリ使用量 [バイト]
+	[[nodiscard]]
+	size_t memoryUsage() const noexcept
+	{
+		return (sizeof(m_commands) + m_spill.capacity());
+	}
+
+private:
+
+	std::array<PlacementCommand, Capacity> m_commands{};
+
+	// 最も古い操作の位置
+	size_t m_begin = 0;
+
+	// 記録している操作の数
+	size_t m_size = 0;
+
+	// 適用済みの操作の数（これより後はやり直せる操作）
+	size_t m_cursor = 0;
+
+	// 退避した操作（古い順）
+	// 1 件の形式: 長さ (uint8), 設置物の番号 (varint), from の x, y (zigzag varint), to - from の x, y (zigzag varint), 長さ (uint8)
+	Array<uint8> m_spill;
+
+	// 退避した操作のうち、適用済みのものの終わりの位置（m_cursor が 0 でなければ、m_spill の終わり）
+	size_t m_spillCursor = 0;
+
+	// 環状バッファからあふれた操作を退避領域の末尾に積む（退避領域はすべて適用済み）
+	void spill(const PlacementCommand& command)
+	{
+		const Point from = Quantize(command.from);
+		const Point delta = (Quantize(command.to) - from);
+		const size_t offset = m_spill.size();
+
+		// 1 件は 32 バイト未満なので、上限を超えた分を書いても確保し直さない
+		m_spill.reserve(SpillCapacity + 32);
+		m_spill << uint8{ 0 };
+		WriteVarint(m_spill, command.object);
+		WriteVarint(m_spill, ZigZag(from.x));
+		WriteVarint(m_spill, ZigZag(from.y));
+		WriteVarint(m_spill, ZigZag(delta.x));
+		WriteVarint(m_spill, ZigZag(delta.y));
+		m_spill << uint8{ 0 };
+
+		const uint8 length = static_cast<uint8>(m_spill.size() - offset);
+		m_spill[offset] = length;
+		m_spill.back() = length;
+
+		if (SpillCapacity < m_spill.size())
+		{
+			// 上限を超えたら、古いものから 1/4 を捨てる（捨てるたびに詰め直さずに済むよう、まとめて捨てる）
+			size_t dropped = 0;
+
+			while ((m_spill.size() - dropped) > (SpillCapacity / 4 * 3))
+			{
+				dropped += m_spill[dropped];
+			}
+
+			m_spill.erase(m_spill.begin(), (m_spill.begin() + dropped));
+		}
+
+		m_spillCursor = m_spill.size();
+	}
+
+	// offset から始まる 1 件を読む
+	[[nodiscard]]
+	PlacementCommand decode(size_t offset) const
+	{
+		size_t pos = (offset + 1);
+		const uint32 object = ReadVarint(m_spill, pos);
+		const Point from{ UnZigZag(ReadVarint(m_spill, pos)), UnZigZag(ReadVarint(m_spill, pos)) };
+		const Point delta{ UnZigZag(ReadVarint(m_spill, pos)), UnZigZag(ReadVarint(m_spill, pos)) };
+		return PlacementCommand{ static_cast<uint16>(object), Dequantize(from), Dequantize(from + delta) };
+	}
+
+	[[nodiscard]]
+	static Point Quantize(const Float2& pos) noexcept
+	{
+		return Point{ static_cast<int32>(Math::Round(pos.x * PositionScale)), static_cast<int32>(Math::Round(pos.y * PositionScale)) };
+	}
+
+	[[nodiscard]]
+	static Float2 Dequantize(const Point& pos) noexcept
+	{
+		return Float2{ static_cast<float>(pos.x / PositionScale), static_cast<float>(pos.y / PositionScale) };
+	}
+
+	[[nodiscard]]
+	static uint32 ZigZag(int32 value) noexcept
+	{
+		return ((static_cast<uint32>(value) << 1) ^ static_cast<uint32>(value >> 31));
+	}
+
+	[[nodiscard]]
+	static int32 UnZigZag(uint32 value) noexcept
+	{
+		return static_cast<int32>((value >> 1) ^ (~(value & 1) + 1));
+	}
+
+	static void WriteVarint(Array<uint8>& data, uint32 value)
+	{
+		while (0x80 <= value)
+		{
+			data << static_cast<uint8>((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+
+		data << static_cast<uint8>(value);
+	}
+
+	// 自分で書いたデータだけを読むので、終わりの確認はしない
+	[[nodiscard]]
+	static uint32 ReadVarint(const Array<uint8>& data, size_t& pos) noexcept
+	{
+		uint32 value = 0;
+
+		for (int32 shift = 0; shift < 32; shift += 7)
+		{
+			const uint8 byte = data[pos++];
+			value |= (static_cast<uint32>(byte & 0x7F) << shift);
+
+			if ((byte & 0x80) == 0)
+			{
+				break;
+			}
+		}
+
+		return value;
+	}
+};
@@ -0,0 +1,131 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+// シーンを離れるときに中身（物理ワールドやテクスチャなど）を預かり、同じシーンに戻ってきたときに再利用するキャッシュ
+// SceneManager はシーンを切り替えるたびにシーンを破棄・生成するため、
+// キャッシュを使うシーンは中身を別のオブジェクトに分け、生成時に acquire()、破棄時に store() する
+// 預かっている中身の推定メモリ使用量が上限を超えたら、最も長く使われていないものから破棄する
+template <class Key>
+class SceneCache
+{
+public:
+
+	// 既定のメモリ使用量の上限 [バイト]
+	static constexpr size_t DefaultCapacity = (64 << 20);
+
+	// メモリ使用量の上限を設定する（0 でキャッシュを無効にする）
+	void setCapacity(size_t bytes)
+	{
+		m_capacity = bytes;
+		trim();
+	}
+
+	[[nodiscard]]
+	size_t capacity() const noexcept
+	{
+		return m_capacity;
+	}
+
+	// key の中身を取り出す（なければ nullptr）。取り出した中身はキャッシュから外れる
+	template <class Type>
+	[[nodiscard]]
+	std::shared_ptr<Type> acquire(const Key& key)
+	{
+		for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+		{
+			if (it->key == key)
+			{
+				auto content = std::static_pointer_cast<Type>(it->content);
+				m_usage -= it->bytes;
+				m_entries.erase(it);
+				++m_hits;
+				return content;
+			}
+		}
+
+		++m_misses;
+		return nullptr;
+	}
+
+	// key の中身を預ける（bytes: 推定メモリ使用量）
+	void store(const Key& key, std::shared_ptr<void> content, size_t bytes)
+	{
+		evict(key);
+
+		if (m_capacity == 0)
+		{
+			return;
+		}
+
+		// 末尾ほど最近使われたもの
+		m_entries << Entry{ key, std::move(content), bytes };
+		m_usage += bytes;
+		trim();
+	}
+
+	// key の中身を破棄する
+	void evict(const Key& key)
+	{
+		m_entries.remove_if([&](const Entry& entry)
+		{
+			if (entry.key != key)
+			{
+				return false;
+			}
+
+			m_usage -= entry.bytes;
+			return true;
+		});
+	}
+
+	// すべての中身を破棄する
+	void clear()
+	{
+		m_entries.clear();
+		m_usage = 0;
+	}
+
+	// 預かっている中身の推定メモリ使用量の合計 [バイト]
+	[[nodiscard]]
+	size_t usage() const noexcept
+	{
+		return m_usage;
+	}
+
+	[[nodiscard]]
+	size_t hits() const noexcept
+	{
+		return m_hits;
+	}
+
+	[[nodiscard]]
+	size_t misses() const noexcept
+	{
+		return m_misses;
+	}
+
+private:
+
+	struct Entry
+	{
+		Key key;
+		std::shared_ptr<void> content;
+		size_t bytes = 0;
+	};
+
+	Array<Entry> m_entries;
+	size_t m_capacity = DefaultCapacity;
+	size_t m_usage = 0;
+	size_t m_hits = 0;
+	size_t m_misses = 0;
+
+	// 上限を超えている間、最も長く使われていないものから破棄する
+	void trim()
+	{
+		while ((m_usage > m_capacity) && (not m_entries.isEmpty()))
+		{
+			m_usage -= m_entries.front().bytes;
+			m_entries.pop_front();
+		}
+	}
+};
@@ -0,0 +1,329 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <coroutine>
+# include <queue>
+
+// スクリプトが待つ出来事
+enum class ScriptEvent : uint8
+{
+	// キーを押した（arg: キーコード）
+	KeyDown,
+
+	// 設置物を置いた（arg: 設置物の番号, pos: 置いた中心（シーン座標））
+	Placement,
+
+	// 針が何かにぶつかった（pos: 接触点（ワールド座標））
+	Contact,
+
+	// 挑戦の結果が決まった（arg: TelemetryOutcome の値）
+	Outcome,
+
+	// 挑戦をやり直した
+	Restart,
+
+	Count,
+};
+
+// 出来事の内容
+struct ScriptSignal
+{
+	ScriptEvent event = ScriptEvent::KeyDown;
+
+	uint32 arg = 0;
+
+	Vec2 pos{ 0, 0 };
+};
+
+// 出来事を待ちながら進む手順（C++20 のコルーチン）
+//
+// Script Tutorial(ScriptRunner& runner)
+// {
+//     co_await runner.seconds(1.0);
+//     const ScriptSignal signal = co_await runner.wait(ScriptEvent::Placement);
+// }
+//
+// 作った時点では動かず、ScriptRunner::start() に渡すと最初の co_await まで進む
+class Script
+{
+public:
+
+	struct promise_type
+	{
+		Script get_return_object() noexcept
+		{
+			return Script{ std::coroutine_handle<promise_type>::from_promise(*this) };
+		}
+
+		std::suspend_always initial_suspend() noexcept { return{}; }
+
+		// 終わった手順は ScriptRunner が破棄する
+		std::suspend_always final_suspend() noexcept { return{}; }
+
+		void return_void() noexcept {}
+
+		void unhandled_exception() noexcept
+		{
+			std::terminate();
+		}
+	};
+
+	using Handle = std::coroutine_handle<promise_type>;
+
+	Script() = default;
+
+	Script(Script&& other) noexcept
+		: m_handle{ std::exchange(other.m_handle, nullptr) } {}
+
+	Script& operator =(Script&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+
+		return *this;
+	}
+
+	~Script()
+	{
+		reset();
+	}
+
+	// 手順の持ち主を ScriptRunner に移す
+	[[nodiscard]]
+	Handle release() noexcept
+	{
+		return std::exchange(m_handle, nullptr);
+	}
+
+private:
+
+	explicit Script(Handle handle) noexcept
+		: m_handle{ handle } {}
+
+	Handle m_handle = nullptr;
+
+	void reset() noexcept
+	{
+		if (m_handle)
+		{
+			m_handle.destroy();
+			m_handle = nullptr;
+		}
+	}
+};
+
+// 手順を動かす
+//
+// 待っている手順は、時間なら起きる時刻の順のヒープに、出来事なら出来事の種類ごとの一覧に入れておく
+// 毎フレームの手間はヒープの先頭を見るのと、起きた出来事の一覧を見るだけなので、
+// 待っているだけの手順はいくつあってもフレームの処理を増やさない
+class ScriptRunner
+{
+public:
+
+	ScriptRunner() = default;
+
+	~ScriptRunner()
+	{
+		clear();
+	}
+
+	ScriptRunner(const ScriptRunner&) = delete;
+	ScriptRunner& operator =(const ScriptRunner&) = delete;
+
+	// 手順を始める（最初の co_await まで進める）
+	void start(Script&& script)
+	{
+		const Script::Handle handle = script.release();
+
+		if (not handle)
+		{
+			return;
+		}
+
+		m_scripts << handle;
+		resume(handle);
+	}
+
+	// すべての手順を破棄する
+	void clear()
+	{
+		m_timers = {};
+
+		for (auto& waiters : m_waiters)
+		{
+			waiters.clear();
+		}
+
+		for (const auto handle : m_scripts)
+		{
+			handle.destroy();
+		}
+
+		m_scripts.clear();
+	}
+
+	// 動いている（終わっていない）手順があるか
+	[[nodiscard]]
+	bool isRunning() const noexcept
+	{
+		return (not m_scripts.isEmpty());
+	}
+
+	// 時間を進め、起きる時刻になった手順を進める
+	void advance(double deltaTime)
+	{
+		m_time += deltaTime;
+
+		while ((not m_timers.empty()) && (m_timers.top().time <= m_time))
+		{
+			const Script::Handle handle = m_timers.top().handle;
+			m_timers.pop();
+			resume(handle);
+		}
+	}
+
+	// 出来事を知らせ、それを待っている手順を進める（待っている手順がなければ何もしない）
+	void signal(const ScriptSignal& signal)
+	{
+		Array<Waiter>& waiters = m_waiters[FromEnum(signal.event)];
+
+		if (waiters.isEmpty())
+		{
+			return;
+		}
+
+		// 進めた手順が同じ出来事をまた待つことがあるので、一覧を入れ替えてから進める
+		Array<Waiter> pending;
+		pending.swap(waiters);
+
+		for (const auto& waiter : pending)
+		{
+			if (waiter.arg && (*waiter.arg != signal.arg))
+			{
+				waiters << waiter;
+				continue;
+			}
+
+			*waiter.result = signal;
+			resume(waiter.handle);
+		}
+	}
+
+	void signal(ScriptEvent event, uint32 arg = 0, const Vec2& pos = Vec2{ 0, 0 })
+	{
+		signal(ScriptSignal{ event, arg, pos });
+	}
+
+	// seconds 秒待つ
+	[[nodiscard]]
+	auto seconds(double seconds) noexcept
+	{
+		struct Awaiter
+		{
+			ScriptRunner& runner;
+
+			double seconds;
+
+			bool await_ready() const noexcept
+			{
+				return (seconds <= 0.0);
+			}
+
+			void await_suspend(Script::Handle handle)
+			{
+				runner.m_timers.push(Timer{ (runner.m_time + seconds), runner.m_timerSequence++, handle });
+			}
+
+			void await_resume() const noexcept {}
+		};
+
+		return Awaiter{ *this, seconds };
+	}
+
+	// 出来事を待つ（arg を指定すると、arg が一致する出来事だけを待つ）
+	[[nodiscard]]
+	auto wait(ScriptEvent event, const Optional<uint32>& arg = none) noexcept
+	{
+		struct Awaiter
+		{
+			ScriptRunner& runner;
+
+			ScriptEvent event;
+
+			Optional<uint32> arg;
+
+			ScriptSignal result;
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			void await_suspend(Script::Handle handle)
+			{
+				runner.m_waiters[FromEnum(event)] << Waiter{ handle, arg, &result };
+			}
+
+			ScriptSignal await_resume() const noexcept
+			{
+				return result;
+			}
+		};
+
+		return Awaiter{ *this, event, arg, ScriptSignal{ event } };
+	}
+
+private:
+
+	struct Timer
+	{
+		double time;
+
+		// 同じ時刻なら待ち始めた順に進める
+		uint64 sequence;
+
+		Script::Handle handle;
+
+		[[nodiscard]]
+		friend bool operator >(const Timer& a, const Timer& b) noexcept
+		{
+			return ((a.time != b.time) ? (a.time > b.time) : (a.sequence > b.sequence));
+		}
+	};
+
+	struct Waiter
+	{
+		Script::Handle handle;
+
+		Optional<uint32> arg;
+
+		// 出来事の内容を書き込む先（待っている手順のコルーチンフレームの中）
+		ScriptSignal* result;
+	};
+
+	double m_time = 0.0;
+
+	uint64 m_timerSequence = 0;
+
+	std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> m_timers;
+
+	std::array<Array<Waiter>, FromEnum(ScriptEvent::Count)> m_waiters;
+
+	// 持っている手順
+	Array<Script::Handle> m_scripts;
+
+	// 手順を次の co_await まで進め、終わったら破棄する
+	void resume(Script::Handle handle)
+	{
+		handle.resume();
+
+		if (handle.done())
+		{
+			m_scripts.remove(handle);
+			handle.destroy();
+		}
+	}
+};
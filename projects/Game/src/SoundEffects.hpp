@@ -0,0 +1,528 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <atomic>
+# include <thread>
+# include "Telemetry.hpp"
+
+// 効果音の種類
+enum class SoundID : uint8
+{
+	// 針が地面や設置物にぶつかった
+	Impact,
+
+	// 針がゴールに入った
+	Goal,
+
+	// 針が落ちた
+	Fall,
+
+	Count,
+};
+
+// 効果音の出力先
+enum class AudioDevice : uint8
+{
+	// Siv3D のオーディオ出力
+	Default,
+
+	// 何も鳴らさない（ミキサーは実時間の速さで動き続ける。ヘッドレスでの計測用）
+	Null,
+};
+
+// 物理イベントから鳴らす効果音
+//
+// ゲームのスレッドは再生の要求（音の種類・位置・音量）をリングバッファに積むだけで、
+// ミキサー用のスレッドが一定の間隔で要求を取り出し、次の順で発音を決めて波形を混ぜる
+//   1. 聞き手（カメラの中心）から遠く小さな音は捨てる
+//   2. 同じ音で近い位置の要求は 1 つにまとめる
+//   3. 音ごとの同時発音数を超えたら、小さい音から捨てる（鳴っている音より大きければ置き換える）
+// 混ぜた波形は PCM のリングバッファを通して Siv3D のオーディオ出力に渡す
+class SoundEffects
+{
+public:
+
+	static constexpr uint32 SampleRate = Wave::DefaultSampleRate;
+
+	// 1 回に混ぜるサンプル数
+	static constexpr size_t BlockSize = 256;
+
+	// 出力に渡すまでにためておくサンプル数（遅延の上限）
+	static constexpr size_t BufferedFrames = 1024;
+
+	// 再生の要求を積めるリングバッファの大きさ
+	static constexpr size_t RequestCapacity = 4096;
+
+	// 全体の同時発音数
+	static constexpr size_t MaxVoices = 24;
+
+	// これより小さく聞こえる音は鳴らさない
+	static constexpr float MinAudibility = 0.02f;
+
+	// この距離より近い同じ音の要求は 1 つにまとめる（ワールド座標）
+	static constexpr float CoalesceDistance = 64.0f;
+
+	// 音量が半分になる聞き手からの距離と、左右の定位が振り切れる距離（ワールド座標）
+	static constexpr float RolloffDistance = 600.0f;
+	static constexpr float PanDistance = 800.0f;
+
+	// 効果音ごとの設定
+	struct SoundDesc
+	{
+		GMInstrument instrument;
+
+		uint8 key;
+
+		double seconds;
+
+		// 同時発音数
+		uint8 maxVoices;
+
+		float gain;
+	};
+
+	static constexpr std::array<SoundDesc, FromEnum(SoundID::Count)> Sounds{ {
+		{ GMInstrument::Woodblock, PianoKey::E5, 0.12, 6, 0.5f },
+		{ GMInstrument::Glockenspiel, PianoKey::C6, 0.8, 1, 0.8f },
+		{ GMInstrument::Timpani, PianoKey::C3, 0.6, 2, 0.7f },
+	} };
+
+	// 動作の記録
+	struct Stats
+	{
+		// 受け付けた要求
+		uint64 requested = 0;
+
+		// リングバッファが満杯で捨てた要求
+		uint64 dropped = 0;
+
+		// ほかの要求にまとめた要求
+		uint64 coalesced = 0;
+
+		// 小さすぎる・同時発音数を超えたので鳴らさなかった要求
+		uint64 culled = 0;
+
+		// 鳴らし始めた音
+		uint64 started = 0;
+
+		// 出力に渡す波形が間に合わなかった回数
+		uint64 underruns = 0;
+
+		// 鳴っている音の数
+		size_t voices = 0;
+	};
+
+	SoundEffects() = default;
+
+	~SoundEffects()
+	{
+		stop();
+	}
+
+	SoundEffects(const SoundEffects&) = delete;
+	SoundEffects& operator =(const SoundEffects&) = delete;
+
+	// 効果音の波形を作る（start() の前に 1 回呼ぶ。別のスレッドから呼んでもよい）
+	void load()
+	{
+		for (size_t i = 0; i < Sounds.size(); ++i)
+		{
+			const Wave wave{ Sounds[i].instrument, Sounds[i].key, SecondsF{ Sounds[i].seconds } };
+			m_samples[i] = Array<float>(wave.size());
+
+			for (size_t n = 0; n < wave.size(); ++n)
+			{
+				m_samples[i][n] = ((wave[n].left + wave[n].right) * 0.5f * Sounds[i].gain);
+			}
+		}
+	}
+
+	// ミキサーを動かし始める（メインスレッドから呼ぶ）
+	void start(AudioDevice device)
+	{
+		stop();
+
+		m_device = device;
+		m_quit = false;
+		m_thread = std::thread{ [this]() { run(); } };
+
+		if (device == AudioDevice::Default)
+		{
+			m_audio = Audio{ std::make_shared<Stream>(*this) };
+			m_audio.play();
+		}
+	}
+
+	void stop()
+	{
+		if (m_audio)
+		{
+			m_audio.stop();
+			m_audio.release();
+		}
+
+		if (m_thread.joinable())
+		{
+			m_quit = true;
+			m_thread.join();
+		}
+	}
+
+	// ゲームのスレッドから呼ぶ。要求をリングバッファに積むだけで、すぐに戻る
+	void play(SoundID sound, const Vec2& pos, double volume = 1.0) noexcept
+	{
+		if (not m_thread.joinable())
+		{
+			return;
+		}
+
+		m_requested.fetch_add(1, std::memory_order_relaxed);
+
+		if (not m_requests.push(Request{ sound, Float2{ pos }, static_cast<float>(volume) }))
+		{
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// 聞き手の位置（ワールド座標）
+	void setListener(const Vec2& pos) noexcept
+	{
+		m_listenerX.store(static_cast<float>(pos.x), std::memory_order_relaxed);
+		m_listenerY.store(static_cast<float>(pos.y), std::memory_order_relaxed);
+	}
+
+	[[nodiscard]]
+	Stats stats() const noexcept
+	{
+		return Stats{
+			m_requested.load(std::memory_order_relaxed),
+			m_dropped.load(std::memory_order_relaxed),
+			m_coalesced.load(std::memory_order_relaxed),
+			m_culled.load(std::memory_order_relaxed),
+			m_started.load(std::memory_order_relaxed),
+			m_underruns.load(std::memory_order_relaxed),
+			m_voiceCount.load(std::memory_order_relaxed),
+		};
+	}
+
+private:
+
+	struct Request
+	{
+		SoundID sound = SoundID::Impact;
+
+		Float2 pos{ 0, 0 };
+
+		float volume = 1.0f;
+	};
+
+	// 聞き手からの距離と音量から決めた、鳴らす候補
+	struct Candidate
+	{
+		SoundID sound = SoundID::Impact;
+
+		Float2 pos{ 0, 0 };
+
+		float audibility = 0.0f;
+	};
+
+	struct Voice
+	{
+		SoundID sound = SoundID::Impact;
+
+		// 次に混ぜるサンプルの位置
+		uint32 position = 0;
+
+		float left = 0.0f;
+
+		float right = 0.0f;
+
+		float audibility = 0.0f;
+	};
+
+	struct StereoFrame
+	{
+		float left = 0.0f;
+
+		float right = 0.0f;
+	};
+
+	// ミキサーが混ぜた波形を、Siv3D のオーディオのスレッドに渡す
+	class Stream : public IAudioStream
+	{
+	public:
+
+		explicit Stream(SoundEffects& owner)
+			: m_owner{ owner } {}
+
+		void getAudio(float* left, float* right, size_t samplesToWrite) override
+		{
+			std::array<StereoFrame, BlockSize> frames;
+
+			while (samplesToWrite)
+			{
+				const size_t count = m_owner.m_pcm.pop(frames.data(), Min(samplesToWrite, frames.size()));
+
+				if (count == 0)
+				{
+					std::fill_n(left, samplesToWrite, 0.0f);
+					std::fill_n(right, samplesToWrite, 0.0f);
+					m_owner.m_underruns.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+
+				for (size_t i = 0; i < count; ++i)
+				{
+					*left++ = frames[i].left;
+					*right++ = frames[i].right;
+				}
+
+				samplesToWrite -= count;
+			}
+		}
+
+		bool hasEnded() override
+		{
+			return false;
+		}
+
+		void rewind() override {}
+
+	private:
+
+		SoundEffects& m_owner;
+	};
+
+	std::array<Array<float>, FromEnum(SoundID::Count)> m_samples;
+
+	SPSCRing<Request, RequestCapacity> m_requests;
+	SPSCRing<StereoFrame, (BufferedFrames * 2)> m_pcm;
+
+	std::atomic<float> m_listenerX{ 0.0f };
+	std::atomic<float> m_listenerY{ 0.0f };
+
+	std::atomic<uint64> m_requested{ 0 };
+	std::atomic<uint64> m_dropped{ 0 };
+	std::atomic<uint64> m_coalesced{ 0 };
+	std::atomic<uint64> m_culled{ 0 };
+	std::atomic<uint64> m_started{ 0 };
+	std::atomic<uint64> m_underruns{ 0 };
+	std::atomic<size_t> m_voiceCount{ 0 };
+
+	AudioDevice m_device = AudioDevice::Default;
+	Audio m_audio;
+	std::thread m_thread;
+	std::atomic<bool> m_quit{ false };
+
+	// ミキサー用のスレッド：出力の空きに合わせて（Null なら実時間の速さで）ブロックごとに混ぜる
+	void run()
+	{
+		Array<Request> requests(RequestCapacity);
+		Array<Candidate> candidates;
+		Array<Voice> voices;
+		std::array<StereoFrame, BlockSize> block;
+
+		candidates.reserve(MaxVoices * Sounds.size());
+		voices.reserve(MaxVoices);
+
+		const auto blockDuration = std::chrono::microseconds{ (BlockSize * 1'000'000) / SampleRate };
+		auto nextBlock = std::chrono::steady_clock::now();
+
+		while (not m_quit)
+		{
+			if (m_device == AudioDevice::Null)
+			{
+				std::this_thread::sleep_until(nextBlock);
+				nextBlock += blockDuration;
+			}
+			else if (BufferedFrames < (m_pcm.size() + BlockSize))
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+				continue;
+			}
+
+			const size_t count = m_requests.pop(requests.data(), requests.size());
+			collectCandidates(requests.data(), count, candidates);
+			startVoices(candidates, voices);
+			mix(voices, block);
+
+			if (m_device == AudioDevice::Default)
+			{
+				for (const auto& frame : block)
+				{
+					m_pcm.push(frame);
+				}
+			}
+		}
+	}
+
+	// 要求を、小さすぎるものを捨て、近い同じ音をまとめて、音ごとに同時発音数までの候補にする
+	void collectCandidates(const Request* requests, size_t count, Array<Candidate>& candidates)
+	{
+		candidates.clear();
+
+		const Float2 listener{ m_listenerX.load(std::memory_order_relaxed), m_listenerY.load(std::memory_order_relaxed) };
+		uint64 coalesced = 0, culled = 0;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const Request& request = requests[i];
+			const float audibility = (request.volume / (1.0f + (request.pos.distanceFrom(listener) / RolloffDistance)));
+
+			if (audibility < MinAudibility)
+			{
+				++culled;
+				continue;
+			}
+
+			Candidate* weakest = nullptr;
+			size_t sameSound = 0;
+			bool merged = false;
+
+			for (auto& candidate : candidates)
+			{
+				if (candidate.sound != request.sound)
+				{
+					continue;
+				}
+
+				if (candidate.pos.distanceFrom(request.pos) < CoalesceDistance)
+				{
+					candidate.audibility = Max(candidate.audibility, audibility);
+					merged = true;
+					break;
+				}
+
+				++sameSound;
+
+				if ((not weakest) || (candidate.audibility < weakest->audibility))
+				{
+					weakest = &candidate;
+				}
+			}
+
+			if (merged)
+			{
+				++coalesced;
+			}
+			else if (sameSound < Sounds[FromEnum(request.sound)].maxVoices)
+			{
+				candidates << Candidate{ request.sound, request.pos, audibility };
+			}
+			else if (weakest->audibility < audibility)
+			{
+				*weakest = Candidate{ request.sound, request.pos, audibility };
+				++culled;
+			}
+			else
+			{
+				++culled;
+			}
+		}
+
+		m_coalesced.fetch_add(coalesced, std::memory_order_relaxed);
+		m_culled.fetch_add(culled, std::memory_order_relaxed);
+	}
+
+	// 候補を鳴らし始める。同時発音数を超えるなら、今より小さく聞こえている音を置き換える
+	// 音ごとの上限に達しているときは同じ音の中から、全体の上限に達しているときはすべての音の中から置き換える音を選ぶ
+	void startVoices(const Array<Candidate>& candidates, Array<Voice>& voices)
+	{
+		const float listenerX = m_listenerX.load(std::memory_order_relaxed);
+		uint64 started = 0, culled = 0;
+
+		for (const auto& candidate : candidates)
+		{
+			const uint32 length = static_cast<uint32>(m_samples[FromEnum(candidate.sound)].size());
+			Voice* weakest = nullptr;
+			Voice* weakestSame = nullptr;
+			size_t sameSound = 0;
+
+			for (auto& voice : voices)
+			{
+				// 鳴り終わりに近い音ほど小さいとみなす
+				if (voice.sound == candidate.sound)
+				{
+					++sameSound;
+
+					if ((not weakestSame) || (remaining(voice) < remaining(*weakestSame)))
+					{
+						weakestSame = &voice;
+					}
+				}
+
+				if ((not weakest) || (remaining(voice) < remaining(*weakest)))
+				{
+					weakest = &voice;
+				}
+			}
+
+			// 音ごとの上限に達していれば、ほかの音の発音は奪わない
+			if (Sounds[FromEnum(candidate.sound)].maxVoices <= sameSound)
+			{
+				weakest = weakestSame;
+			}
+
+			// 左右の定位（等パワー）
+			const float pan = Clamp(((candidate.pos.x - listenerX) / PanDistance), -1.0f, 1.0f);
+			const float angle = ((pan + 1.0f) * 0.25f * Math::PiF);
+			const Voice voice{ candidate.sound, 0, (candidate.audibility * std::cos(angle)), (candidate.audibility * std::sin(angle)), candidate.audibility };
+
+			if ((length != 0) && (sameSound < Sounds[FromEnum(candidate.sound)].maxVoices) && (voices.size() < MaxVoices))
+			{
+				voices << voice;
+				++started;
+			}
+			else if ((length != 0) && weakest && (remaining(*weakest) < candidate.audibility))
+			{
+				*weakest = voice;
+				++started;
+				++culled;
+			}
+			else
+			{
+				++culled;
+			}
+		}
+
+		m_started.fetch_add(started, std::memory_order_relaxed);
+		m_culled.fetch_add(culled, std::memory_order_relaxed);
+	}
+
+	// 鳴っている音を 1 ブロック分混ぜ、鳴り終わった音を外す
+	void mix(Array<Voice>& voices, std::array<StereoFrame, BlockSize>& block)
+	{
+		block.fill(StereoFrame{});
+
+		for (auto& voice : voices)
+		{
+			const Array<float>& samples = m_samples[FromEnum(voice.sound)];
+			const size_t count = Min(BlockSize, (samples.size() - voice.position));
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				const float sample = samples[voice.position + i];
+				block[i].left += (sample * voice.left);
+				block[i].right += (sample * voice.right);
+			}
+
+			voice.position += static_cast<uint32>(count);
+		}
+
+		voices.remove_if([this](const Voice& voice) { return (m_samples[FromEnum(voice.sound)].size() <= voice.position); });
+		m_voiceCount.store(voices.size(), std::memory_order_relaxed);
+
+		for (auto& frame : block)
+		{
+			frame.left = Clamp(frame.left, -1.0f, 1.0f);
+			frame.right = Clamp(frame.right, -1.0f, 1.0f);
+		}
+	}
+
+	// 鳴っている音の、残りの長さで重みをつけた聞こえる大きさ
+	[[nodiscard]]
+	float remaining(const Voice& voice) const
+	{
+		const size_t length = m_samples[FromEnum(voice.sound)].size();
+		return (voice.audibility * (static_cast<float>(length - voice.position) / static_cast<float>(length)));
+	}
+};
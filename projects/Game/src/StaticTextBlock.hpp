@@ -0,0 +1,111 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "DrawList.hpp"
+
+// 内容が変わらない複数行テキストを一度だけレイアウトし、テクスチャに焼き込んで描画するブロック
+// （クレジット・チュートリアル・ヘルプ画面など、毎フレーム同じ文字列を描く画面用）
+class StaticTextBlock
+{
+public:
+
+	// 1 行分のテキスト（位置はブロック左上からの相対座標）
+	struct Line
+	{
+		String text;
+		Vec2 pos;
+		double fontSize;
+		ColorF color{ 0.0 };
+	};
+
+	StaticTextBlock() = default;
+
+	StaticTextBlock(const Font& font, const Array<Line>& lines)
+		: m_font{ font }
+		, m_lines{ lines }
+	{
+		// 全行の外接矩形からテクスチャの大きさを決める（レイアウトはここで一度だけ行う）
+		for (const auto& line : m_lines)
+		{
+			const RectF region = m_font(line.text).region(line.fontSize, line.pos);
+			m_size.x = Max(m_size.x, region.br().x);
+			m_size.y = Max(m_size.y, region.br().y);
+		}
+
+		bake();
+	}
+
+	// DPI（ウィンドウの拡大率）が変わっていたら焼き直す
+	void update()
+	{
+		if (CurrentScaling() != m_scaling)
+		{
+			bake();
+		}
+	}
+
+	// 焼き込んだテクスチャを描く記録を list に加える
+	void draw(DrawList& list, DrawLayer layer, const Vec2& pos = Vec2{ 0, 0 }) const
+	{
+		list.texture(layer, TextureRegion{ m_texture }, pos, (1.0 / m_scaling));
+	}
+
+	[[nodiscard]]
+	const SizeF& size() const noexcept
+	{
+		return m_size;
+	}
+
+	[[nodiscard]]
+	bool isEmpty() const noexcept
+	{
+		return m_lines.isEmpty();
+	}
+
+private:
+
+	Font m_font;
+	Array<Line> m_lines;
+	SizeF m_size{ 0, 0 };
+	double m_scaling = 1.0;
+	RenderTexture m_texture;
+
+	// シーン座標 1 あたりのフレームバッファのピクセル数
+	[[nodiscard]]
+	static double CurrentScaling()
+	{
+		return Max(1.0, static_cast<double>(Window::GetState().frameBufferSize.x) / Scene::Width());
+	}
+
+	// 透過テクスチャへ文字を書き込むとき、アルファを上書きせず最大値で合成するブレンドステート
+	[[nodiscard]]
+	static BlendState MakeBlendState()
+	{
+		BlendState blendState = BlendState::Default2D;
+		blendState.srcAlpha = Blend::SrcAlpha;
+		blendState.dstAlpha = Blend::DestAlpha;
+		blendState.opAlpha = BlendOp::Max;
+		return blendState;
+	}
+
+	void bake()
+	{
+		m_scaling = CurrentScaling();
+
+		const Size textureSize = (m_size * m_scaling).asPoint() + Size{ 1, 1 };
+
+		if (m_texture.size() != textureSize)
+		{
+			m_texture = RenderTexture{ textureSize, ColorF{ 0.0, 0.0 } };
+		}
+
+		const ScopedRenderTarget2D target{ m_texture.clear(ColorF{ 0.0, 0.0 }) };
+		const ScopedRenderStates2D blend{ MakeBlendState() };
+		const Transformer2D scaling{ Mat3x2::Scale(m_scaling), TransformCursor::No, Transformer2D::Target::SetLocal };
+		const Transformer2D camera{ Mat3x2::Identity(), TransformCursor::No, Transformer2D::Target::SetCamera };
+
+		for (const auto& line : m_lines)
+		{
+			m_font(line.text).draw(line.fontSize, line.pos, line.color);
+		}
+	}
+};
@@ -0,0 +1,228 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <thread>
+# include <condition_variable>
+
+// 依存関係のある作業をスレッドプールで並列に実行する
+// GPU へのアップロードなどメインスレッドでしか行えない作業は MainThread として登録し、
+// run() を呼んだスレッドが、ほかの作業の完了を待つ間に実行する
+// 実行後は作業ごとの開始・終了時刻と、全体の時間を決めていた依存の連鎖（クリティカルパス）を報告できる
+class TaskGraph
+{
+public:
+
+	using TaskID = size_t;
+
+	// 作業を実行するスレッド
+	enum class Affinity : uint8
+	{
+		// ワーカースレッド
+		Worker,
+
+		// run() を呼んだスレッド
+		MainThread,
+	};
+
+	// 作業を登録する。dependencies の作業がすべて終わってから実行される
+	TaskID add(const String& name, std::function<void()> function, const Array<TaskID>& dependencies = {}, Affinity affinity = Affinity::Worker)
+	{
+		const TaskID id = m_tasks.size();
+
+		Task task;
+		task.name = name;
+		task.function = std::move(function);
+		task.dependencies = dependencies;
+		task.affinity = affinity;
+		task.remaining = dependencies.size();
+		m_tasks << std::move(task);
+
+		for (const TaskID dependency : dependencies)
+		{
+			m_tasks[dependency].dependents << id;
+		}
+
+		return id;
+	}
+
+	// すべての作業が終わるまで実行する（workerCount: ワーカースレッドの数、0 なら CPU のスレッド数 - 1）
+	void run(size_t workerCount = 0)
+	{
+		if (workerCount == 0)
+		{
+			// hardware_concurrency() は分からなければ 0 を返す
+			workerCount = Max<size_t>(1, (Max<size_t>(1, std::thread::hardware_concurrency()) - 1));
+		}
+
+		m_clock.restart();
+		m_finished = 0;
+
+		for (TaskID id = 0; id < m_tasks.size(); ++id)
+		{
+			if (m_tasks[id].remaining == 0)
+			{
+				queueOf(id) << id;
+			}
+		}
+
+		Array<std::thread> workers;
+
+		for (size_t i = 0; i < workerCount; ++i)
+		{
+			workers.emplace_back([this]() { work(Affinity::Worker); });
+		}
+
+		work(Affinity::MainThread);
+
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+
+		m_totalTime = m_clock.sF();
+	}
+
+	// 全体の時間 [秒]
+	[[nodiscard]]
+	double totalTime() const noexcept
+	{
+		return m_totalTime;
+	}
+
+	// 作業ごとの時間と、クリティカルパスの報告
+	[[nodiscard]]
+	String report() const
+	{
+		String text = U"startup: {:.1f} ms, {} tasks\n"_fmt(m_totalTime * 1000.0, m_tasks.size());
+
+		for (const auto& task : m_tasks)
+		{
+			text += U"  {:<16} {:7.1f} - {:7.1f} ms ({:.1f} ms){}\n"_fmt(task.name, task.start * 1000.0, task.end * 1000.0,
+				(task.end - task.start) * 1000.0, ((task.affinity == Affinity::MainThread) ? U" [main]" : U""));
+		}
+
+		text += U"  critical path: ";
+
+		const Array<TaskID> path = criticalPath();
+
+		for (size_t i = 0; i < path.size(); ++i)
+		{
+			text += ((i == 0) ? U"" : U" -> ") + m_tasks[path[i]].name;
+		}
+
+		return text;
+	}
+
+	// 全体の時間を決めていた依存の連鎖（最後に終わった作業から、開始を遅らせていた依存先をたどる）
+	[[nodiscard]]
+	Array<TaskID> criticalPath() const
+	{
+		Array<TaskID> path;
+
+		if (m_tasks.isEmpty())
+		{
+			return path;
+		}
+
+		TaskID current = 0;
+
+		for (TaskID id = 1; id < m_tasks.size(); ++id)
+		{
+			if (m_tasks[current].end < m_tasks[id].end)
+			{
+				current = id;
+			}
+		}
+
+		for (;;)
+		{
+			path.push_front(current);
+
+			const Task& task = m_tasks[current];
+
+			if (task.dependencies.isEmpty())
+			{
+				break;
+			}
+
+			current = *std::max_element(task.dependencies.begin(), task.dependencies.end(),
+				[&](TaskID a, TaskID b) { return (m_tasks[a].end < m_tasks[b].end); });
+		}
+
+		return path;
+	}
+
+private:
+
+	struct Task
+	{
+		String name;
+		std::function<void()> function;
+		Array<TaskID> dependencies;
+		Array<TaskID> dependents;
+		Affinity affinity = Affinity::Worker;
+		size_t remaining = 0;
+
+		// run() の開始からの時刻 [秒]
+		double start = 0.0;
+		double end = 0.0;
+	};
+
+	Array<Task> m_tasks;
+	Array<TaskID> m_workerQueue;
+	Array<TaskID> m_mainQueue;
+	size_t m_finished = 0;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	Stopwatch m_clock;
+	double m_totalTime = 0.0;
+
+	[[nodiscard]]
+	Array<TaskID>& queueOf(TaskID id)
+	{
+		return ((m_tasks[id].affinity == Affinity::MainThread) ? m_mainQueue : m_workerQueue);
+	}
+
+	// affinity の作業を、すべての作業が終わるまで取り出して実行する
+	void work(Affinity affinity)
+	{
+		Array<TaskID>& queue = ((affinity == Affinity::MainThread) ? m_mainQueue : m_workerQueue);
+
+		for (;;)
+		{
+			TaskID id;
+			{
+				std::unique_lock lock{ m_mutex };
+				m_condition.wait(lock, [&]() { return ((not queue.isEmpty()) || (m_finished == m_tasks.size())); });
+
+				if (queue.isEmpty())
+				{
+					return;
+				}
+
+				id = queue.front();
+				queue.pop_front();
+			}
+
+			Task& task = m_tasks[id];
+			task.start = m_clock.sF();
+			task.function();
+			task.end = m_clock.sF();
+
+			{
+				std::lock_guard lock{ m_mutex };
+				++m_finished;
+
+				for (const TaskID dependent : task.dependents)
+				{
+					if (--m_tasks[dependent].remaining == 0)
+					{
+						queueOf(dependent) << dependent;
+					}
+				}
+			}
+
+			m_condition.notify_all();
+		}
+	}
+};
@@ -0,0 +1,263 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <atomic>
+# include <thread>
+# include <condition_variable>
+
+// 単一の生産者スレッドと単一の消費者スレッドの間で使う、ロックを使わない固定長のリングバッファ
+// Capacity は 2 のべき乗であること
+template <class Type, size_t Capacity>
+class SPSCRing
+{
+	static_assert(((Capacity & (Capacity - 1)) == 0), "Capacity must be a power of two");
+
+public:
+
+	// 生産者スレッドから呼ぶ。満杯なら false を返す
+	bool push(const Type& value) noexcept
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+
+		if ((head - m_tail.load(std::memory_order_acquire)) == Capacity)
+		{
+			return false;
+		}
+
+		m_buffer[head & (Capacity - 1)] = value;
+		m_head.store((head + 1), std::memory_order_release);
+		return true;
+	}
+
+	// 消費者スレッドから呼ぶ。最大 maxCount 個を out に取り出し、取り出した数を返す
+	size_t pop(Type* out, size_t maxCount) noexcept
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		const size_t count = Min((m_head.load(std::memory_order_acquire) - tail), maxCount);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			out[i] = m_buffer[(tail + i) & (Capacity - 1)];
+		}
+
+		m_tail.store((tail + count), std::memory_order_release);
+		return count;
+	}
+
+	// おおよその要素数
+	[[nodiscard]]
+	size_t size() const noexcept
+	{
+		return (m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire));
+	}
+
+private:
+
+	std::array<Type, Capacity> m_buffer{};
+
+	// 生産者と消費者が同じキャッシュラインを書き換えないよう離して置く
+	alignas(64) std::atomic<size_t> m_head{ 0 };
+	alignas(64) std::atomic<size_t> m_tail{ 0 };
+};
+
+// テレメトリのレコードの種類
+enum class TelemetryType : uint16
+{
+	// value: フレーム時間 [秒]
+	FrameTime,
+
+	// arg: 1 フレームの物理ステップ数
+	PhysicsSteps,
+
+	// arg: 移り先のシーン, flag: キャッシュから再開したか, value: シーンの準備にかかった時間 [秒]
+	SceneTransition,
+
+	// arg: ステージ, flag: 結果（TelemetryOutcome）, value: 挑戦時間 [秒]
+	StageOutcome,
+};
+
+// ステージの結果
+enum class TelemetryOutcome : uint16
+{
+	Abandoned,
+	Cleared,
+	Failed,
+};
+
+// 固定長のテレメトリのレコード（ファイルにもこの形のまま書き出す）
+struct TelemetryRecord
+{
+	// セッション開始からの時間 [マイクロ秒]
+	uint64 timeUs = 0;
+
+	TelemetryType type = TelemetryType::FrameTime;
+
+	uint16 flag = 0;
+
+	uint32 arg = 0;
+
+	double value = 0.0;
+};
+
+static_assert(sizeof(TelemetryRecord) == 24);
+
+// プレイセッションのテレメトリを、ゲームのスレッドを止めずにファイルへ書き出す
+// ゲームのスレッドは固定長のレコードをリングバッファに積むだけで、
+// 書き出し用のスレッドがまとめて取り出し、圧縮してファイルに追記する
+//
+// ファイルの形式:
+//   "NTLM" (4 バイト), バージョン (uint32), レコードの大きさ (uint32)
+//   以降、バッチごとに 圧縮前の大きさ (uint32), 圧縮後の大きさ (uint32), zstd で圧縮したレコード列
+class TelemetryLog
+{
+public:
+
+	static constexpr uint32 Version = 1;
+
+	// リングバッファに入るレコード数
+	static constexpr size_t RingCapacity = 8192;
+
+	// 1 つのバッチに入れるレコードの最大数
+	static constexpr size_t BatchSize = 2048;
+
+	TelemetryLog() = default;
+
+	~TelemetryLog()
+	{
+		close();
+	}
+
+	TelemetryLog(const TelemetryLog&) = delete;
+	TelemetryLog& operator =(const TelemetryLog&) = delete;
+
+	// path に書き出しを始める
+	bool open(const FilePath& path)
+	{
+		close();
+
+		if (not m_writer.open(path))
+		{
+			return false;
+		}
+
+		m_writer.write("NTLM", 4);
+		m_writer.write(Version);
+		m_writer.write(static_cast<uint32>(sizeof(TelemetryRecord)));
+
+		m_clock.restart();
+		m_quit = false;
+		m_thread = std::thread{ [this]() { run(); } };
+		m_opened = true;
+		return true;
+	}
+
+	// 残りのレコードを書き出して閉じる
+	void close()
+	{
+		if (not m_opened)
+		{
+			return;
+		}
+
+		{
+			std::lock_guard lock{ m_mutex };
+			m_quit = true;
+		}
+
+		m_condition.notify_one();
+		m_thread.join();
+		m_writer.close();
+		m_opened = false;
+	}
+
+	// ゲームのスレッドから呼ぶ。リングバッファが満杯ならレコードを捨てて数える
+	void push(TelemetryType type, uint32 arg = 0, uint16 flag = 0, double value = 0.0) noexcept
+	{
+		if (not m_opened)
+		{
+			return;
+		}
+
+		const TelemetryRecord record{ static_cast<uint64>(m_clock.us()), type, flag, arg, value };
+
+		if (not m_ring.push(record))
+		{
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// リングバッファがあふれて捨てたレコードの数
+	[[nodiscard]]
+	uint64 dropped() const noexcept
+	{
+		return m_dropped.load(std::memory_order_relaxed);
+	}
+
+	// 書き出したバッチの数
+	[[nodiscard]]
+	uint64 batches() const noexcept
+	{
+		return m_batches.load(std::memory_order_relaxed);
+	}
+
+	[[nodiscard]]
+	bool isOpen() const noexcept
+	{
+		return m_opened;
+	}
+
+private:
+
+	SPSCRing<TelemetryRecord, RingCapacity> m_ring;
+	std::atomic<uint64> m_dropped{ 0 };
+	std::atomic<uint64> m_batches{ 0 };
+
+	Stopwatch m_clock;
+	BinaryWriter m_writer;
+	bool m_opened = false;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_quit = false;
+
+	// 書き出し用のスレッド：一定間隔でリングバッファを空にし、圧縮して追記する
+	void run()
+	{
+		Array<TelemetryRecord> batch(BatchSize);
+
+		for (;;)
+		{
+			bool quit;
+			{
+				std::unique_lock lock{ m_mutex };
+				m_condition.wait_for(lock, std::chrono::milliseconds{ 250 }, [this]() { return m_quit; });
+				quit = m_quit;
+			}
+
+			while (const size_t count = m_ring.pop(batch.data(), batch.size()))
+			{
+				writeBatch(batch.data(), count);
+			}
+
+			if (quit)
+			{
+				break;
+			}
+		}
+
+		m_writer.flush();
+	}
+
+	void writeBatch(const TelemetryRecord* records, size_t count)
+	{
+		Blob raw;
+		raw.append(records, (sizeof(TelemetryRecord) * count));
+
+		const Blob compressed = Compression::Compress(raw);
+
+		m_writer.write(static_cast<uint32>(raw.size()));
+		m_writer.write(static_cast<uint32>(compressed.size()));
+		m_writer.write(compressed.data(), compressed.size());
+		m_batches.fetch_add(1, std::memory_order_relaxed);
+	}
+};
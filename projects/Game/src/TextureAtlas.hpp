@@ -0,0 +1,440 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "AssetPack.hpp"
+
+// ステージで使うスプライトを数枚のページ（大きなテクスチャ）にまとめたアトラス
+//
+// atlas/<名前>.json  … まとめるスプライトの一覧（手で編集する）
+//   {
+//     "pageSize": 2048,
+//     "mipLevels": 4,
+//     "sprites": [
+//       { "name": "needle", "path": "example/needle.png", "scale": 0.25 },
+//       ...
+//     ]
+//   }
+//   scale: ページに詰めるときの縮小率。描画時の大きさは元の画像の大きさのまま
+//   mipLevels: 縮小したミップマップで隣のスプライトの色が混ざらないようにする段数
+//     スプライトを 2^mipLevels の倍数の位置と大きさの区画に置き、区画の余白（2^mipLevels px）にはスプライトの端の色を延ばして塗る
+//     mipLevels 段目（1/2^mipLevels）まではほかのスプライトの色を拾わない
+//
+// atlas/<名前>.atlas … --pack-atlas=<名前> で作るファイル。ページの画像と各スプライトの位置をまとめて持つ
+//   "NATL" (4 バイト), バージョン (uint32), ページ数 (uint32), スプライト数 (uint32)
+//   スプライトごとに ページ番号 (uint16), x, y, w, h (uint16), 元の幅, 高さ (float), 名前の長さ (uint16), 名前 (UTF-8)
+//   ページごとに PNG の大きさ (uint32), PNG
+//
+// .atlas がなければ、一覧の画像を 1 枚ずつ別のテクスチャとして読み込む（開発中の確認用）
+
+// スプライトの番号。名前からの検索は読み込み時に一度だけ行い、描画時はこの番号で引く
+struct SpriteHandle
+{
+	static constexpr uint32 Invalid = UINT32_MAX;
+
+	uint32 index = Invalid;
+
+	[[nodiscard]]
+	explicit operator bool() const noexcept
+	{
+		return (index != Invalid);
+	}
+};
+
+class TextureAtlas
+{
+public:
+
+	static constexpr uint32 Version = 1;
+
+	struct Sprite
+	{
+		uint16 page = 0;
+
+		// ページ上の位置と大きさ
+		Rect rect{ 0, 0, 0, 0 };
+
+		// 描画するときの大きさ（元の画像の大きさ）
+		SizeF size{ 0, 0 };
+	};
+
+	// 画像の展開までを済ませたアトラス（テクスチャを作る前の段階。別のスレッドで作ってよい）
+	struct Decoded
+	{
+		Array<Image> pages;
+		Array<Sprite> sprites;
+		HashTable<String, uint32> indices;
+	};
+
+	TextureAtlas() = default;
+
+	// 展開済みの画像からテクスチャを作る（メインスレッドで呼ぶ）
+	explicit TextureAtlas(Decoded&& decoded)
+		: m_sprites{ std::move(decoded.sprites) }
+		, m_indices{ std::move(decoded.indices) }
+	{
+		for (const auto& page : decoded.pages)
+		{
+			m_pages << Texture{ page, TextureDesc::Mipped };
+		}
+	}
+
+	// atlas/<name>.atlas を読み込む。なければ atlas/<name>.json の画像を個別に読み込む
+	[[nodiscard]]
+	static TextureAtlas Load(StringView name)
+	{
+		if (auto decoded = Decode(name))
+		{
+			return TextureAtlas{ std::move(*decoded) };
+		}
+
+		return TextureAtlas{};
+	}
+
+	// Load() のうち、ファイルの読み込みと画像の展開だけを行う
+	[[nodiscard]]
+	static Optional<Decoded> Decode(StringView name)
+	{
+		if (auto decoded = DecodePacked(U"atlas/{}.atlas"_fmt(name)))
+		{
+			return decoded;
+		}
+
+		return DecodeLoose(U"atlas/{}.json"_fmt(name));
+	}
+
+	// 名前からスプライトの番号を得る（見つからなければ無効な番号）
+	[[nodiscard]]
+	SpriteHandle find(const String& name) const
+	{
+		if (const auto it = m_indices.find(name); it != m_indices.end())
+		{
+			return SpriteHandle{ it->second };
+		}
+
+		return SpriteHandle{};
+	}
+
+	// スプライトの領域（無効な番号なら空の領域）
+	[[nodiscard]]
+	TextureRegion operator ()(SpriteHandle handle) const
+	{
+		if (not handle)
+		{
+			return TextureRegion{};
+		}
+
+		const Sprite& sprite = m_sprites[handle.index];
+		return m_pages[sprite.page](sprite.rect).resized(sprite.size);
+	}
+
+	[[nodiscard]]
+	size_t pageCount() const noexcept
+	{
+		return m_pages.size();
+	}
+
+	[[nodiscard]]
+	size_t spriteCount() const noexcept
+	{
+		return m_sprites.size();
+	}
+
+	// ページの推定メモリ使用量 [バイト]
+	[[nodiscard]]
+	size_t memoryUsage() const
+	{
+		size_t bytes = 0;
+
+		for (const auto& page : m_pages)
+		{
+			bytes += (page.width() * page.height() * 4);
+		}
+
+		return bytes;
+	}
+
+	// manifestPath の一覧の画像をページに詰めて outputPath に書き出す
+	static bool Pack(const FilePath& manifestPath, const FilePath& outputPath)
+	{
+		const JSON json = JSON::Load(manifestPath);
+
+		if (not json)
+		{
+			Console << U"atlas: failed to load {}"_fmt(manifestPath);
+			return false;
+		}
+
+		const int32 pageSize = (json.hasElement(U"pageSize") ? json[U"pageSize"].get<int32>() : 2048);
+		const int32 mipLevels = Clamp((json.hasElement(U"mipLevels") ? json[U"mipLevels"].get<int32>() : 4), 0, 8);
+
+		// 区画の位置と大きさの単位で、区画の余白の幅
+		const int32 alignment = (1 << mipLevels);
+		const auto alignUp = [alignment](int32 value) { return (((value + alignment - 1) / alignment) * alignment); };
+
+		struct Entry
+		{
+			String name;
+			Image image;
+			SizeF size;
+			uint16 page = 0;
+			Point pos{ 0, 0 };
+
+			// 余白を含めた区画の大きさ
+			Size cell{ 0, 0 };
+		};
+
+		Array<Entry> entries;
+
+		for (const auto& sprite : json[U"sprites"].arrayView())
+		{
+			const FilePath path = sprite[U"path"].getString();
+			Image image{ path };
+
+			if (not image)
+			{
+				Console << U"atlas: failed to load {}"_fmt(path);
+				return false;
+			}
+
+			const SizeF size = image.size();
+
+			if (sprite.hasElement(U"scale"))
+			{
+				image = image.scaled(sprite[U"scale"].get<double>(), InterpolationAlgorithm::Area);
+			}
+
+			const Size cell{ alignUp(image.width() + alignment * 2), alignUp(image.height() + alignment * 2) };
+
+			if ((pageSize < cell.x) || (pageSize < cell.y))
+			{
+				Console << U"atlas: {} does not fit in a {}px page"_fmt(path, pageSize);
+				return false;
+			}
+
+			entries << Entry{ sprite[U"name"].getString(), std::move(image), size, 0, Point{ 0, 0 }, cell };
+		}
+
+		// 高さの順に並べ、棚（行）ごとに左から詰める
+		entries.sort_by([](const Entry& a, const Entry& b) { return (a.cell.y > b.cell.y); });
+
+		Array<Image> pages;
+		Point cursor{ 0, 0 };
+		int32 shelfHeight = 0;
+
+		for (auto& entry : entries)
+		{
+			if (pageSize < (cursor.x + entry.cell.x))
+			{
+				cursor = Point{ 0, (cursor.y + shelfHeight) };
+				shelfHeight = 0;
+			}
+
+			if (pages.isEmpty() || (pageSize < (cursor.y + entry.cell.y)))
+			{
+				pages << Image{ Size{ pageSize, pageSize }, Color{ 0, 0 } };
+				cursor = Point{ 0, 0 };
+				shelfHeight = 0;
+			}
+
+			entry.page = static_cast<uint16>(pages.size() - 1);
+			entry.pos = (cursor + Point{ alignment, alignment });
+			Extrude(entry.image, pages.back(), Rect{ cursor, entry.cell }, entry.pos);
+
+			cursor.x += entry.cell.x;
+			shelfHeight = Max(shelfHeight, entry.cell.y);
+		}
+
+		BinaryWriter writer{ outputPath };
+
+		if (not writer)
+		{
+			Console << U"atlas: failed to open {}"_fmt(outputPath);
+			return false;
+		}
+
+		writer.write("NATL", 4);
+		writer.write(Version);
+		writer.write(static_cast<uint32>(pages.size()));
+		writer.write(static_cast<uint32>(entries.size()));
+
+		for (const auto& entry : entries)
+		{
+			const std::string name = entry.name.toUTF8();
+			writer.write(entry.page);
+			writer.write(static_cast<uint16>(entry.pos.x));
+			writer.write(static_cast<uint16>(entry.pos.y));
+			writer.write(static_cast<uint16>(entry.image.width()));
+			writer.write(static_cast<uint16>(entry.image.height()));
+			writer.write(static_cast<float>(entry.size.x));
+			writer.write(static_cast<float>(entry.size.y));
+			writer.write(static_cast<uint16>(name.size()));
+			writer.write(name.data(), name.size());
+		}
+
+		for (const auto& page : pages)
+		{
+			const Blob png = page.encodePNG();
+			writer.write(static_cast<uint32>(png.size()));
+			writer.write(png.data(), png.size());
+		}
+
+		Console << U"atlas: {} sprites in {} pages -> {}"_fmt(entries.size(), pages.size(), outputPath);
+		return true;
+	}
+
+private:
+
+	Array<Texture> m_pages;
+	Array<Sprite> m_sprites;
+	HashTable<String, uint32> m_indices;
+
+	// image を page の pos に書き、区画 cell の残りにはいちばん近いスプライトの端の色を塗る
+	static void Extrude(const Image& image, Image& page, const Rect& cell, const Point& pos)
+	{
+		for (int32 y = cell.y; y < cell.bottomY(); ++y)
+		{
+			const int32 sy = Clamp((y - pos.y), 0, (image.height() - 1));
+
+			for (int32 x = cell.x; x < cell.rightX(); ++x)
+			{
+				const int32 sx = Clamp((x - pos.x), 0, (image.width() - 1));
+				page[y][x] = image[sy][sx];
+			}
+		}
+	}
+
+	// 個別のファイルがあればそこから、なければアセットパックから（圧縮していなければコピーせずに）読む
+	[[nodiscard]]
+	static Optional<Decoded> DecodePacked(const FilePath& path)
+	{
+		if (HasLooseFile(path))
+		{
+			BinaryReader reader{ path };
+			return DecodePacked(reader);
+		}
+
+		if (const auto view = GameAssets().view(path))
+		{
+			MemoryViewReader reader{ view->data(), view->size() };
+			return DecodePacked(reader);
+		}
+
+		if (const auto data = GameAssets().read(path))
+		{
+			MemoryViewReader reader{ data->data(), data->size() };
+			return DecodePacked(reader);
+		}
+
+		BinaryReader reader{ path };
+
+		if (not reader)
+		{
+			return none;
+		}
+
+		return DecodePacked(reader);
+	}
+
+	[[nodiscard]]
+	static Optional<Decoded> DecodePacked(IReader& reader)
+	{
+		char magic[4];
+		uint32 version = 0, pageCount = 0, spriteCount = 0;
+
+		if ((not reader.read(magic, 4)) || (std::memcmp(magic, "NATL", 4) != 0)
+			|| (not reader.read(version)) || (version != Version)
+			|| (not reader.read(pageCount)) || (not reader.read(spriteCount)))
+		{
+			return none;
+		}
+
+		Decoded decoded;
+		Array<Sprite>& sprites = decoded.sprites;
+		sprites.resize(spriteCount);
+
+		for (uint32 i = 0; i < spriteCount; ++i)
+		{
+			uint16 x, y, w, h, nameLength;
+			float width, height;
+
+			if ((not reader.read(sprites[i].page)) || (not reader.read(x)) || (not reader.read(y))
+				|| (not reader.read(w)) || (not reader.read(h)) || (not reader.read(width)) || (not reader.read(height))
+				|| (not reader.read(nameLength)))
+			{
+				return none;
+			}
+
+			// 存在しないページを指すスプライトは、壊れたファイルとして扱う
+			if (pageCount <= sprites[i].page)
+			{
+				return none;
+			}
+
+			std::string name(nameLength, '\0');
+
+			if (not reader.read(name.data(), nameLength))
+			{
+				return none;
+			}
+
+			sprites[i].rect = Rect{ x, y, w, h };
+			sprites[i].size = SizeF{ width, height };
+			decoded.indices.emplace(Unicode::FromUTF8(name), i);
+		}
+
+		for (uint32 i = 0; i < pageCount; ++i)
+		{
+			uint32 size = 0;
+
+			if (not reader.read(size))
+			{
+				return none;
+			}
+
+			Blob png(size);
+
+			if (not reader.read(png.data(), size))
+			{
+				return none;
+			}
+
+			decoded.pages << Image{ MemoryReader{ std::move(png) } };
+		}
+
+		// スプライトの矩形がページの画像からはみ出していたら、壊れたファイルとして扱う
+		for (const auto& sprite : sprites)
+		{
+			const Image& page = decoded.pages[sprite.page];
+
+			if (page.isEmpty() || (not Rect{ page.size() }.contains(sprite.rect)))
+			{
+				return none;
+			}
+		}
+
+		return decoded;
+	}
+
+	[[nodiscard]]
+	static Optional<Decoded> DecodeLoose(const FilePath& manifestPath)
+	{
+		const JSON json = JSON::Load(manifestPath);
+
+		if (not json)
+		{
+			return none;
+		}
+
+		Decoded decoded;
+
+		for (const auto& sprite : json[U"sprites"].arrayView())
+		{
+			Image image{ sprite[U"path"].getString() };
+
+			decoded.indices.emplace(sprite[U"name"].getString(), static_cast<uint32>(decoded.sprites.size()));
+			decoded.sprites << Sprite{ static_cast<uint16>(decoded.pages.size()), Rect{ image.size() }, image.size() };
+			decoded.pages << std::move(image);
+		}
+
+		return decoded;
+	}
+};
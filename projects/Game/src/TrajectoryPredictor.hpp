@@ -0,0 +1,292 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <atomic>
+# include <thread>
+# include <condition_variable>
+# include "LevelStreaming.hpp"
+
+// ワールドに設置した物の形（ワールド座標）
+struct PlacedShapes
+{
+	Array<Circle> circles;
+
+	Array<RectF> rects;
+
+	[[nodiscard]]
+	bool isEmpty() const noexcept
+	{
+		return (circles.isEmpty() && rects.isEmpty());
+	}
+
+	// 形どうしが重なっているか
+	[[nodiscard]]
+	bool intersects(const PlacedShapes& other) const
+	{
+		for (const auto& circle : circles)
+		{
+			if (other.circles.any([&](const Circle& c) { return circle.intersects(c); })
+				|| other.rects.any([&](const RectF& r) { return circle.intersects(r); }))
+			{
+				return true;
+			}
+		}
+
+		for (const auto& rect : rects)
+		{
+			if (other.circles.any([&](const Circle& c) { return rect.intersects(c); })
+				|| other.rects.any([&](const RectF& r) { return rect.intersects(r); }))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	[[nodiscard]]
+	friend bool operator ==(const PlacedShapes& a, const PlacedShapes& b) noexcept
+	{
+		return ((a.circles == b.circles) && (a.rects == b.rects));
+	}
+};
+
+// 予測に使うワールドの写し
+// 地面は読み込み済みの ChunkData（書き換えられない）を共有するので、写しを作る費用は設置物と針の数に比例する
+struct PredictionSnapshot
+{
+	struct Needle
+	{
+		Vec2 pos{ 0, 0 };
+		double angle = 0.0;
+		Vec2 velocity{ 0, 0 };
+		double angularVelocity = 0.0;
+	};
+
+	Array<std::shared_ptr<const ChunkData>> chunks;
+
+	PlacedShapes placed;
+
+	Array<Needle> needles;
+
+	// 針の大きさ
+	Vec2 needleSize{ 10, 120 };
+
+	// 入ったら予測を打ち切る領域（落下判定）
+	Array<RectF> killRegions;
+
+	// 物理演算の 1 ステップの時間 [秒]
+	double stepTime = (1.0 / 200.0);
+};
+
+// 設置物をドラッグしている間、針の軌跡を別のスレッドで予測する
+// 実行する予測は 1 つだけで、実行中に来た要求は最新の写しだけを残し、今の予測が終わってから始める
+// ドラッグし続けて要求が途切れなくても予測は最後まで進むので、軌跡は少し遅れて追いかける形で出る
+// メインスレッドは写しを渡すのと、出来上がった結果を受け取るだけで、予測の完了を待たない
+class TrajectoryPredictor
+{
+public:
+
+	// 予測するステップ数（200 ステップで 1 秒）と、軌跡に点を加える間隔
+	static constexpr int32 Steps = 800;
+	static constexpr int32 SampleInterval = 4;
+
+	// 予測の結果
+	struct Result
+	{
+		// 何番目の要求に対する結果か
+		uint64 generation = 0;
+
+		// 針ごとの軌跡
+		Array<LineString> paths;
+	};
+
+	TrajectoryPredictor()
+		: m_thread{ [this]() { run(); } } {}
+
+	~TrajectoryPredictor()
+	{
+		{
+			std::lock_guard lock{ m_mutex };
+			m_quit = true;
+		}
+
+		++m_cancelCount;
+		m_condition.notify_one();
+		m_thread.join();
+	}
+
+	TrajectoryPredictor(const TrajectoryPredictor&) = delete;
+	TrajectoryPredictor& operator =(const TrajectoryPredictor&) = delete;
+
+	// 新しい写しで予測を頼む（実行中の予測があれば、それが終わってから始める。まだ始まっていない要求は置き換える）
+	void request(PredictionSnapshot&& snapshot)
+	{
+		{
+			std::lock_guard lock{ m_mutex };
+			m_pending = std::move(snapshot);
+			m_pendingGeneration = ++m_generation;
+		}
+
+		m_condition.notify_one();
+	}
+
+	// 予測をやめ（実行中の予測はステップの途中で打ち切る）、結果を消す
+	void cancel()
+	{
+		std::lock_guard lock{ m_mutex };
+		m_pending.reset();
+		++m_cancelCount;
+		m_result.reset();
+	}
+
+	// 最後に完了した予測の結果（まだなければ nullptr）。新しい要求の予測が終わるまでは、前の要求の結果を返す
+	[[nodiscard]]
+	std::shared_ptr<const Result> result() const
+	{
+		std::lock_guard lock{ m_mutex };
+		return m_result;
+	}
+
+	// 完了した予測の数
+	[[nodiscard]]
+	uint64 completed() const noexcept
+	{
+		return m_completed.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_quit = false;
+
+	// 要求のたびに増える番号
+	uint64 m_generation = 0;
+
+	// cancel() のたびに増える番号。予測中に変わったら打ち切る
+	std::atomic<uint64> m_cancelCount{ 0 };
+
+	Optional<PredictionSnapshot> m_pending;
+	uint64 m_pendingGeneration = 0;
+	std::shared_ptr<const Result> m_result;
+	std::atomic<uint64> m_completed{ 0 };
+
+	// 他のメンバーを初期化してから起動するよう、最後に置く
+	std::thread m_thread;
+
+	void run()
+	{
+		for (;;)
+		{
+			PredictionSnapshot snapshot;
+			uint64 generation, cancelCount;
+			{
+				std::unique_lock lock{ m_mutex };
+				m_condition.wait(lock, [this]() { return (m_quit || m_pending.has_value()); });
+
+				if (m_quit)
+				{
+					return;
+				}
+
+				snapshot = std::move(*m_pending);
+				generation = m_pendingGeneration;
+				cancelCount = m_cancelCount.load();
+				m_pending.reset();
+			}
+
+			if (auto result = simulate(snapshot, generation, cancelCount))
+			{
+				std::lock_guard lock{ m_mutex };
+
+				// 予測中に取り消されていなければ結果を差し替える
+				if (m_cancelCount.load() == cancelCount)
+				{
+					m_result = std::move(result);
+					m_completed.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		}
+	}
+
+	// 写しから P2World を作って進める。途中で取り消されたら nullptr を返す
+	[[nodiscard]]
+	std::shared_ptr<const Result> simulate(const PredictionSnapshot& snapshot, uint64 generation, uint64 cancelCount) const
+	{
+		P2World world;
+		Array<P2Body> statics;
+
+		for (const auto& chunk : snapshot.chunks)
+		{
+			for (const auto& line : chunk->lines)
+			{
+				statics << world.createLine(P2Static, Vec2{ 0, 0 }, line);
+			}
+
+			for (const auto& lineString : chunk->lineStrings)
+			{
+				statics << world.createLineString(P2Static, Vec2{ 0, 0 }, lineString);
+			}
+
+			for (const auto& rect : chunk->rects)
+			{
+				statics << world.createRect(P2Static, rect.center(), rect.size);
+			}
+		}
+
+		for (const auto& circle : snapshot.placed.circles)
+		{
+			statics << world.createCircle(P2Static, circle.center, circle.r);
+		}
+
+		for (const auto& rect : snapshot.placed.rects)
+		{
+			statics << world.createRect(P2Static, rect.center(), rect.size);
+		}
+
+		Array<P2Body> needles;
+		auto result = std::make_shared<Result>();
+		result->generation = generation;
+
+		for (const auto& needle : snapshot.needles)
+		{
+			needles << world.createRect(P2Dynamic, needle.pos, snapshot.needleSize);
+			needles.back().setAngle(needle.angle);
+			needles.back().setVelocity(needle.velocity);
+			needles.back().setAngularVelocity(needle.angularVelocity);
+			result->paths << LineString{ needle.pos };
+		}
+
+		// 落下判定の領域に入った針は、それ以上軌跡を伸ばさない
+		Array<bool> finished(needles.size(), false);
+
+		for (int32 i = 1; i <= Steps; ++i)
+		{
+			if (m_cancelCount.load(std::memory_order_relaxed) != cancelCount)
+			{
+				return nullptr;
+			}
+
+			world.update(snapshot.stepTime);
+
+			if ((i % SampleInterval) != 0)
+			{
+				continue;
+			}
+
+			for (size_t n = 0; n < needles.size(); ++n)
+			{
+				if (finished[n])
+				{
+					continue;
+				}
+
+				const Vec2 pos = needles[n].getPos();
+				result->paths[n] << pos;
+				finished[n] = snapshot.killRegions.any([&](const RectF& rect) { return rect.intersects(pos); });
+			}
+		}
+
+		return result;
+	}
+};
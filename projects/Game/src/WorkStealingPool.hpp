@@ -0,0 +1,194 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <deque>
+# include <thread>
+# include <condition_variable>
+
+// 同じ処理を番号ごとに並列に実行する、常駐のスレッドプール
+// parallelFor() は番号を各スレッドのキューに順に配り、自分のキューが空になったスレッドは
+// ほかのスレッドのキューの末尾から番号を盗む。重い番号を先に渡せば、最後に残るのは軽い番号だけになる
+// parallelFor() を呼んだスレッドも 1 つのキューを受け持つ
+class WorkStealingPool
+{
+public:
+
+	// workerCount: ワーカースレッドの数（0 なら呼んだスレッドだけで実行する）
+	explicit WorkStealingPool(size_t workerCount = DefaultWorkerCount())
+	{
+		for (size_t i = 0; i <= workerCount; ++i)
+		{
+			m_queues << std::make_unique<Queue>();
+		}
+
+		for (size_t i = 1; i <= workerCount; ++i)
+		{
+			m_threads.emplace_back([this, i]() { run(i); });
+		}
+	}
+
+	~WorkStealingPool()
+	{
+		{
+			std::lock_guard lock{ m_mutex };
+			m_quit = true;
+		}
+
+		m_wake.notify_all();
+
+		for (auto& thread : m_threads)
+		{
+			thread.join();
+		}
+	}
+
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator =(const WorkStealingPool&) = delete;
+
+	// CPU のスレッド数 - 1（呼んだスレッドの分を除く）
+	[[nodiscard]]
+	static size_t DefaultWorkerCount()
+	{
+		return (Max<size_t>(1, std::thread::hardware_concurrency()) - 1);
+	}
+
+	// 呼んだスレッドを含めたスレッドの数
+	[[nodiscard]]
+	size_t threadCount() const noexcept
+	{
+		return m_queues.size();
+	}
+
+	// [0, count) の番号ごとに f(index) を実行し、すべて終わるまで待つ
+	// どの番号がどのスレッドで実行されるかは決まらないので、f は番号ごとに別のデータだけを書き換えること
+	template <class Function>
+	void parallelFor(size_t count, Function&& f)
+	{
+		if ((count <= 1) || m_threads.empty())
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				f(i);
+			}
+
+			return;
+		}
+
+		m_context = &f;
+		m_invoke = [](void* context, size_t index) { (*static_cast<std::remove_reference_t<Function>*>(context))(index); };
+		m_remaining.store(count, std::memory_order_relaxed);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			Queue& queue = *m_queues[i % m_queues.size()];
+			std::lock_guard lock{ queue.mutex };
+			queue.tasks.push_back(i);
+		}
+
+		{
+			std::lock_guard lock{ m_mutex };
+			++m_generation;
+		}
+
+		m_wake.notify_all();
+
+		work(0);
+
+		std::unique_lock lock{ m_mutex };
+		m_done.wait(lock, [this]() { return (m_remaining.load(std::memory_order_acquire) == 0); });
+	}
+
+private:
+
+	struct Queue
+	{
+		std::mutex mutex;
+
+		std::deque<size_t> tasks;
+	};
+
+	// 0 番は parallelFor() を呼んだスレッドのキュー
+	Array<std::unique_ptr<Queue>> m_queues;
+
+	Array<std::thread> m_threads;
+
+	// 実行中の parallelFor() の処理
+	void* m_context = nullptr;
+	void (*m_invoke)(void*, size_t) = nullptr;
+
+	std::atomic<size_t> m_remaining{ 0 };
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	uint64 m_generation = 0;
+	bool m_quit = false;
+
+	void run(size_t self)
+	{
+		uint64 seen = 0;
+
+		for (;;)
+		{
+			{
+				std::unique_lock lock{ m_mutex };
+				m_wake.wait(lock, [&]() { return (m_quit || (m_generation != seen)); });
+
+				if (m_quit)
+				{
+					return;
+				}
+
+				seen = m_generation;
+			}
+
+			work(self);
+		}
+	}
+
+	// キューが空になるまで実行する
+	void work(size_t self)
+	{
+		while (const auto index = take(self))
+		{
+			m_invoke(m_context, *index);
+
+			if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				std::lock_guard lock{ m_mutex };
+				m_done.notify_all();
+			}
+		}
+	}
+
+	// 自分のキューの先頭から取り、空ならほかのキューの末尾から盗む
+	[[nodiscard]]
+	Optional<size_t> take(size_t self)
+	{
+		{
+			Queue& own = *m_queues[self];
+			std::lock_guard lock{ own.mutex };
+
+			if (not own.tasks.empty())
+			{
+				const size_t index = own.tasks.front();
+				own.tasks.pop_front();
+				return index;
+			}
+		}
+
+		for (size_t i = 1; i < m_queues.size(); ++i)
+		{
+			Queue& victim = *m_queues[(self + i) % m_queues.size()];
+			std::lock_guard lock{ victim.mutex };
+
+			if (not victim.tasks.empty())
+			{
+				const size_t index = victim.tasks.back();
+				victim.tasks.pop_back();
+				return index;
+			}
+		}
+
+		return none;
+	}
+};